@@ -0,0 +1,53 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+*
+* This file is part of udpproxy.
+*
+* udpproxy is free software; you can redistribute it and/or
+        * modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+        * version 2.1 of the License, or (at your option) any later version.
+*
+* udpproxy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdint.h>
+
+/* Timestamp packet written by udpproxy-seggen as the first TS packet of
+ * every segment and picked up by udpproxy-sink to measure segment to
+ * wire latency. It is an ordinary TS packet on a private PID:
+ *
+ *     payload: "UPXB" sequence(4) completed_us(8), big-endian
+ *
+ * completed_us is CLOCK_REALTIME when the segment became visible in
+ * work_dir, so both ends must run on the same host. */
+#define BENCH_PID 0x1ffa
+#define BENCH_MAGIC "UPXB"
+#define BENCH_STAMP_LEN 16
+
+static inline void bench_stamp_put(unsigned char *payload, uint32_t seq, int64_t us) {
+	int i;
+	payload[0] = 'U'; payload[1] = 'P'; payload[2] = 'X'; payload[3] = 'B';
+	for (i = 0; i < 4; i++) payload[4 + i] = seq >> (24 - 8 * i);
+	for (i = 0; i < 8; i++) payload[8 + i] = (uint64_t)us >> (56 - 8 * i);
+}
+/* returns 0 and fills seq/us if payload carries a stamp */
+static inline int bench_stamp_get(const unsigned char *payload, uint32_t *seq, int64_t *us) {
+	uint64_t v = 0;
+	int i;
+	if (payload[0] != 'U' || payload[1] != 'P' || payload[2] != 'X' || payload[3] != 'B')
+		return -1;
+	*seq = ((uint32_t)payload[4] << 24) | (payload[5] << 16) | (payload[6] << 8) | payload[7];
+	for (i = 0; i < 8; i++) v = (v << 8) | payload[8 + i];
+	*us = (int64_t)v;
+	return 0;
+}
+#endif
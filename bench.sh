@@ -0,0 +1,124 @@
+#!/bin/sh
+# End-to-end udpproxy benchmark, run by "make -f udp.mak bench".
+#
+# udpproxy-seggen writes synthetic segments into a tmpfs work_dir,
+# udpproxy sends them to udpproxy-sink on loopback. Every run appends one
+# row to $BENCH_OUT/results.csv and leaves the details of the last run in
+# $BENCH_OUT:
+#
+#   summary.json   sink summary plus cpu and run parameters
+#   timeline.csv   once per second: generated/received segments, queue
+#                  depth (generated - received), udpproxy cpu seconds, Mbit/s
+#
+# Parameters are taken from the environment:
+#
+#   BENCH_BITRATE     bit/s of the generated segments        (100000000)
+#   BENCH_SEGMENT_MS  segment duration                       (1000)
+#   BENCH_SECONDS     segments generated, in media seconds   (20)
+#   BENCH_SPEED       1 real time, 0 as fast as possible     (1)
+#   BENCH_MODE        plain, rtp or reliable                 (plain)
+#   BENCH_PORT        loopback port of the sink              (19999)
+#   BENCH_DIR         scratch directory, should be tmpfs     (/dev/shm/udpproxy-bench)
+#   BENCH_OUT         result directory                       (bench-results)
+
+BIN=${1:-Debug}
+BENCH_BITRATE=${BENCH_BITRATE:-100000000}
+BENCH_SEGMENT_MS=${BENCH_SEGMENT_MS:-1000}
+BENCH_SECONDS=${BENCH_SECONDS:-20}
+BENCH_SPEED=${BENCH_SPEED:-1}
+BENCH_MODE=${BENCH_MODE:-plain}
+BENCH_PORT=${BENCH_PORT:-19999}
+BENCH_DIR=${BENCH_DIR:-/dev/shm/udpproxy-bench}
+BENCH_OUT=${BENCH_OUT:-bench-results}
+
+BIN=$(cd "$BIN" && pwd) || exit 1
+mkdir -p "$BENCH_OUT" && BENCH_OUT=$(cd "$BENCH_OUT" && pwd) || exit 1
+COUNT=$((BENCH_SECONDS * 1000 / BENCH_SEGMENT_MS))
+[ "$COUNT" -gt 0 ] || COUNT=1
+
+rm -rf "$BENCH_DIR"
+mkdir -p "$BENCH_DIR/work" "$BENCH_DIR/log" || exit 1
+
+# the dummy file is only there so the send thread sleeps between segments
+"$BIN/udpproxy-seggen" -o "$BENCH_DIR" -b "$BENCH_BITRATE" -s 100 -n 1 -x 0 \
+	| while read -r seq name rest; do mv "$BENCH_DIR/$name" "$BENCH_DIR/dummy.ts"; done
+
+case "$BENCH_MODE" in
+rtp)      MODE_CONF="rtp = 1" ;;
+reliable) MODE_CONF="reliable = 1" ;;
+*)        MODE_CONF="" ;;
+esac
+cat > "$BENCH_DIR/udpproxy.conf" <<EOF
+network:
+	ip = 127.0.0.1
+	port = $BENCH_PORT
+	$MODE_CONF
+directory:
+	work_dir = $BENCH_DIR/work
+	log_dir = $BENCH_DIR/log
+	dummy_file = $BENCH_DIR/dummy.ts
+	file_template = %ms.ts
+	keep_segments = 4
+time:
+	send_dummy_interval = 3600
+	start_wait_interval = 0
+EOF
+
+"$BIN/udpproxy-sink" -p "$BENCH_PORT" -b 127.0.0.1 -i 1 -j > "$BENCH_DIR/sink.json" &
+SINK=$!
+(cd "$BENCH_DIR" && exec "$BIN/udp" > "$BENCH_DIR/udp.out" 2>&1) &
+UDP=$!
+sleep 1
+"$BIN/udpproxy-seggen" -o "$BENCH_DIR/work" -b "$BENCH_BITRATE" -s "$BENCH_SEGMENT_MS" \
+	-n "$COUNT" -x "$BENCH_SPEED" > "$BENCH_DIR/seggen.out" &
+GEN=$!
+
+cpu_seconds() {
+	# utime + stime of udpproxy, in clock ticks
+	awk -v hz="$(getconf CLK_TCK)" '{ sub(/.*\) /, ""); printf "%.2f", ($12 + $13) / hz }' \
+		"/proc/$UDP/stat" 2>/dev/null
+}
+json_field() {
+	sed -n "s/.*\"$1\":\([^,}]*\).*/\1/p" | tail -n 1
+}
+
+echo "t,generated,received,queue_depth,udp_cpu_s,mbps" > "$BENCH_OUT/timeline.csv"
+T=0
+IDLE=0
+while [ "$IDLE" -lt 3 ]; do
+	sleep 1
+	T=$((T + 1))
+	GENERATED=$(wc -l < "$BENCH_DIR/seggen.out")
+	LAST=$(grep '"t"' "$BENCH_DIR/sink.json" | tail -n 1)
+	RECEIVED=$(echo "$LAST" | json_field segments)
+	MBPS=$(echo "$LAST" | json_field mbps)
+	echo "$T,$GENERATED,${RECEIVED:-0},$((GENERATED - ${RECEIVED:-0})),$(cpu_seconds),${MBPS:-0}" \
+		>> "$BENCH_OUT/timeline.csv"
+	# done once every segment arrived, or nothing moved for 3 seconds
+	if ! kill -0 $GEN 2>/dev/null; then
+		[ "${RECEIVED:-0}" -ge "$COUNT" ] && break
+		[ "$MBPS" = "0.000" ] && IDLE=$((IDLE + 1))
+	fi
+done
+
+CPU=$(cpu_seconds)
+kill $GEN $UDP 2>/dev/null
+kill -INT $SINK
+wait $SINK
+
+SUMMARY=$(grep '"seconds"' "$BENCH_DIR/sink.json")
+BYTES=$(echo "$SUMMARY" | json_field bytes)
+CPU_PER_GBIT=$(awk -v c="$CPU" -v b="${BYTES:-0}" 'BEGIN { printf "%.3f", b ? c / (b * 8 / 1e9) : 0 }')
+MBPS=$(echo "$SUMMARY" | json_field mbps)
+
+echo "$SUMMARY" | sed "s/}\$/,\"mode\":\"$BENCH_MODE\",\"bitrate\":$BENCH_BITRATE,\"segment_ms\":$BENCH_SEGMENT_MS,\"speed\":$BENCH_SPEED,\"generated\":$COUNT,\"udp_cpu_s\":$CPU,\"cpu_s_per_gbit\":$CPU_PER_GBIT}/" \
+	> "$BENCH_OUT/summary.json"
+
+[ -f "$BENCH_OUT/results.csv" ] || \
+	echo "date,commit,mode,bitrate,segment_ms,speed,generated,received,mbps,udp_cpu_s,cpu_s_per_gbit,latency_p50_ms,latency_p90_ms,latency_p99_ms,latency_max_ms,lost,cc_errors" \
+	> "$BENCH_OUT/results.csv"
+echo "$(date +%Y-%m-%dT%H:%M:%S),$(git rev-parse --short HEAD 2>/dev/null),$BENCH_MODE,$BENCH_BITRATE,$BENCH_SEGMENT_MS,$BENCH_SPEED,$COUNT,$(echo "$SUMMARY" | json_field segments),$MBPS,$CPU,$CPU_PER_GBIT,$(echo "$SUMMARY" | json_field latency_p50_ms),$(echo "$SUMMARY" | json_field latency_p90_ms),$(echo "$SUMMARY" | json_field latency_p99_ms),$(echo "$SUMMARY" | json_field latency_max_ms),$(echo "$SUMMARY" | json_field lost),$(echo "$SUMMARY" | json_field cc_errors)" \
+	>> "$BENCH_OUT/results.csv"
+
+cat "$BENCH_OUT/summary.json"
+rm -rf "$BENCH_DIR"
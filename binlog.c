@@ -0,0 +1,405 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "binlog.h"
+/* ------------------------------------------------------------------------- */
+#define BINLOG_DEFAULT_FILE_SIZE (64UL << 20)
+#define BINLOG_ALIGN(n) (((n) + 7) & ~7U)
+
+static __thread unsigned long tls_binlog_tid;
+
+/* ------------------------------------------------------------------------- */
+int binlog_parse_format(const char *fmt, struct binlog_conv *conv, int max) {
+	const char *p, *start;
+	int n = 0, lng, type, stars;
+	for (p = fmt; *p; ++p) {
+		if (*p != '%') continue;
+		start = p++;
+		stars = 0;
+		lng = 0;
+		while (*p && strchr("-+ #0'", *p)) ++p;
+		if (*p == '*') {
+			++stars;
+			++p;
+		} else {
+			while (*p >= '0' && *p <= '9') ++p;
+		}
+		if (*p == '.') {
+			if (*++p == '*') {
+				++stars;
+				++p;
+			} else {
+				while (*p >= '0' && *p <= '9') ++p;
+			}
+		}
+		while (*p && strchr("hlLqjzt", *p)) {
+			if (*p != 'h') lng = 1;
+			++p;
+		}
+		switch (*p) {
+		case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+			type = lng ? BINLOG_ARG_LONG : BINLOG_ARG_INT;
+			break;
+		case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+			type = BINLOG_ARG_DOUBLE;
+			break;
+		case 's':
+			type = BINLOG_ARG_STR;
+			break;
+		case 'p': case 'n':
+			type = BINLOG_ARG_PTR;
+			break;
+		case '\0':
+			return n; /* '%' at the end, printed as is */
+		default:
+			type = BINLOG_ARG_NONE;
+			break;
+		}
+		if (n >= max) return -1;
+		conv[n].start = start;
+		conv[n].len = p + 1 - start;
+		conv[n].type = type;
+		conv[n].stars = stars;
+		++n;
+	}
+	return n;
+}
+/* ------------------------------------------------------------------------- */
+static int64_t realtime_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+static struct binlog_file *file_open(struct binlog *b) {
+	struct binlog_file *f;
+	struct binlog_file_header *hdr;
+	struct tm tm;
+	time_t now = time(NULL);
+	char path[sizeof(b->prefix) + 48];
+	int len, i;
+
+	f = calloc(1, sizeof(*f));
+	if (!f) return NULL;
+	localtime_r(&now, &tm);
+	len = snprintf(path, sizeof(path), "%s", b->prefix);
+	len += strftime(path + len, sizeof(path) - len, "%F_%T", &tm);
+	/* the counter keeps files of one second apart and in order */
+	for (i = 0; i < 1000; ++i) {
+		snprintf(path + len, sizeof(path) - len, ".%03u.blog", b->file_seq++ % 1000);
+		f->fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+		if (f->fd >= 0 || errno != EEXIST) break;
+	}
+	if (f->fd < 0) {
+		fprintf(stderr, "cannot create binary log `%s':%s\n", path, strerror(errno));
+		free(f);
+		return NULL;
+	}
+	f->size = b->file_size;
+	if (ftruncate(f->fd, f->size) < 0 ||
+		(f->map = mmap(NULL, f->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+					   f->fd, 0)) == MAP_FAILED) {
+		fprintf(stderr, "cannot map binary log `%s':%s\n", path, strerror(errno));
+		close(f->fd);
+		unlink(path);
+		free(f);
+		return NULL;
+	}
+	hdr = (struct binlog_file_header *)f->map;
+	memcpy(hdr->magic, BINLOG_MAGIC, sizeof(hdr->magic));
+	hdr->version = BINLOG_VERSION;
+	hdr->header_size = sizeof(*hdr);
+	hdr->created_ns = realtime_ns();
+	f->used = BINLOG_ALIGN(sizeof(*hdr));
+	return f;
+}
+/* unmap f once its writers are done; the struct itself goes on the
+ * retired list, a writer that loaded b->cur just before the switch still
+ * bumps its counter */
+static void file_retire(struct binlog *b, struct binlog_file *f) {
+	uint64_t used;
+	if (!f) return;
+	while (__atomic_load_n(&f->writers, __ATOMIC_SEQ_CST))
+		sched_yield();
+	used = f->used < f->size ? f->used : f->size;
+	munmap(f->map, f->size);
+	f->map = NULL;
+	/* give back the sparse tail */
+	if (ftruncate(f->fd, used) < 0)
+		fprintf(stderr, "cannot truncate binary log:%s\n", strerror(errno));
+	close(f->fd);
+	f->next = b->retired;
+	b->retired = f;
+}
+/* DEF record of site s with format fmt; s->fmt is only set once the
+ * record is in the file */
+static uint32_t def_size(const struct binlog_site *s, const char *fmt) {
+	return BINLOG_ALIGN(sizeof(struct binlog_def) + strlen(s->file) + strlen(fmt));
+}
+static void def_put(char *dst, const struct binlog_site *s, const char *fmt,
+					uint32_t len) {
+	struct binlog_def def;
+	uint16_t file_len = strlen(s->file), fmt_len = strlen(fmt);
+	memset(&def, 0, sizeof(def));
+	def.hdr.size = len;
+	def.hdr.level = s->level;
+	def.hdr.id = s->id;
+	def.line = s->line;
+	def.file_len = file_len;
+	def.fmt_len = fmt_len;
+	memcpy(dst, &def, sizeof(def));
+	memcpy(dst + sizeof(def), s->file, file_len);
+	memcpy(dst + sizeof(def) + file_len, fmt, fmt_len);
+	__atomic_store_n(&((struct binlog_record *)dst)->type, BINLOG_DEF, __ATOMIC_RELEASE);
+}
+/* switch to a new file, b->lock held. The old file is unmapped once the
+ * writers that reserved space in it have committed their records. */
+static int rotate(struct binlog *b) {
+	struct binlog_file *f = file_open(b), *old;
+	unsigned int i;
+	uint32_t len;
+	if (!f) return -1;
+	/* every file carries the definitions of the sites seen so far */
+	for (i = 0; i < BINLOG_SITES; ++i) {
+		const struct binlog_site *s = &b->sites[i];
+		const char *fmt = __atomic_load_n(&s->fmt, __ATOMIC_ACQUIRE);
+		if (!fmt) continue;
+		len = def_size(s, fmt);
+		if (f->used + len > f->size) break;
+		def_put(f->map + f->used, s, fmt, len);
+		f->used += len;
+	}
+	old = b->cur;
+	__atomic_store_n(&b->cur, f, __ATOMIC_SEQ_CST);
+	file_retire(b, old);
+	return 0;
+}
+/* space for len bytes in *fp, NULL if there is no file to write to. The
+ * caller calls release() once the record type is stored. The writer count is
+ * raised before b->cur is checked again and rotate() switches b->cur
+ * before it reads the count, so either the writer backs off or the
+ * rotation waits for it. */
+static char *reserve(struct binlog *b, uint32_t len, int locked,
+					 struct binlog_file **fp) {
+	struct binlog_file *f;
+	uint64_t off;
+	int ret;
+	for (;;) {
+		f = __atomic_load_n(&b->cur, __ATOMIC_SEQ_CST);
+		if (!f) return NULL;
+		__atomic_add_fetch(&f->writers, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&b->cur, __ATOMIC_SEQ_CST) != f) {
+			__atomic_sub_fetch(&f->writers, 1, __ATOMIC_RELEASE);
+			continue;
+		}
+		off = __atomic_fetch_add(&f->used, len, __ATOMIC_RELAXED);
+		if (off + len <= f->size) {
+			*fp = f;
+			return f->map + off;
+		}
+		__atomic_sub_fetch(&f->writers, 1, __ATOMIC_RELEASE);
+		/* full: whoever gets the lock first rotates */
+		if (!locked) pthread_mutex_lock(&b->lock);
+		ret = b->cur == f ? rotate(b) : 0;
+		if (!locked) pthread_mutex_unlock(&b->lock);
+		if (ret < 0) return NULL;
+	}
+}
+/* the record reserved in f is complete, type stored */
+static inline void release(struct binlog_file *f) {
+	__atomic_sub_fetch(&f->writers, 1, __ATOMIC_RELEASE);
+}
+static struct binlog_site *site_register(struct binlog *b, int level,
+										 const char *filename, int line,
+										 const char *fmt) {
+	struct binlog_conv conv[BINLOG_MAX_ARGS];
+	struct binlog_site *s = NULL;
+	unsigned int h = ((uintptr_t)fmt >> 3) ^ (line * 0x9e3779b1u), i;
+	int n, j, k, nargs = 0;
+	struct binlog_file *f;
+	uint32_t len;
+	char *dst;
+
+	pthread_mutex_lock(&b->lock);
+	for (i = 0; i < BINLOG_SITES; ++i) {
+		s = &b->sites[(h + i) & (BINLOG_SITES - 1)];
+		if (!s->fmt) break;
+		if (s->fmt == fmt && s->line == line && s->file == filename) goto out;
+	}
+	if (i == BINLOG_SITES) {
+		s = NULL;
+		goto out;
+	}
+	n = binlog_parse_format(fmt, conv, BINLOG_MAX_ARGS);
+	for (j = 0; j < n; ++j) {
+		if (conv[j].type == BINLOG_ARG_NONE) continue;
+		if (nargs + conv[j].stars + 1 > BINLOG_MAX_ARGS) {
+			n = -1;
+			break;
+		}
+		for (k = 0; k < conv[j].stars; ++k) s->args[nargs++] = BINLOG_ARG_INT;
+		s->args[nargs++] = conv[j].type;
+	}
+	/* too many arguments: only the format is logged, logcat prints it as is */
+	s->nargs = n < 0 ? 0 : nargs;
+	s->file = filename;
+	s->line = line;
+	s->level = level;
+	s->id = ++b->next_id;
+	len = def_size(s, fmt);
+	dst = reserve(b, len, 1, &f);
+	if (dst) {
+		def_put(dst, s, fmt, len);
+		release(f);
+	}
+	__atomic_store_n(&s->fmt, fmt, __ATOMIC_RELEASE);
+out:
+	pthread_mutex_unlock(&b->lock);
+	return s;
+}
+static inline struct binlog_site *site_lookup(struct binlog *b, int level,
+											  const char *filename, int line,
+											  const char *fmt) {
+	unsigned int h = ((uintptr_t)fmt >> 3) ^ (line * 0x9e3779b1u), i;
+	struct binlog_site *s;
+	const char *key;
+	for (i = 0; i < BINLOG_SITES; ++i) {
+		s = &b->sites[(h + i) & (BINLOG_SITES - 1)];
+		key = __atomic_load_n(&s->fmt, __ATOMIC_ACQUIRE);
+		if (!key) break;
+		if (key == fmt && s->line == line && s->file == filename) return s;
+	}
+	return site_register(b, level, filename, line, fmt);
+}
+/* ------------------------------------------------------------------------- */
+int binlog_open(struct binlog *b, const char *prefix, uint64_t file_size) {
+	memset(b, 0, sizeof(*b));
+	snprintf(b->prefix, sizeof(b->prefix), "%s", prefix);
+	b->file_size = file_size ? file_size : BINLOG_DEFAULT_FILE_SIZE;
+	pthread_mutex_init(&b->lock, NULL);
+	pthread_mutex_lock(&b->lock);
+	if (rotate(b) < 0) {
+		pthread_mutex_unlock(&b->lock);
+		pthread_mutex_destroy(&b->lock);
+		return -1;
+	}
+	pthread_mutex_unlock(&b->lock);
+	return 0;
+}
+void binlog_write(struct binlog *b, int level, const char *filename, int line,
+				  const char *fmt, va_list args) {
+	char buf[BINLOG_RECORD_MAX];
+	struct binlog_event *ev = (struct binlog_event *)buf;
+	struct binlog_site *s;
+	struct binlog_file *f;
+	char *p = buf + sizeof(*ev), *dst;
+	const char *str;
+	size_t slen;
+	long room;
+	union { int i; long long l; double d; void *p; } v;
+	uint16_t n16;
+	uint32_t len;
+	int i;
+
+	s = site_lookup(b, level, filename, line, fmt);
+	if (!s) {
+		__atomic_add_fetch(&b->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	for (i = 0; i < s->nargs; ++i) {
+		switch (s->args[i]) {
+		case BINLOG_ARG_INT:
+			v.i = va_arg(args, int);
+			memcpy(p, &v.i, 4);
+			p += 4;
+			break;
+		case BINLOG_ARG_LONG:
+			v.l = va_arg(args, long long);
+			memcpy(p, &v.l, 8);
+			p += 8;
+			break;
+		case BINLOG_ARG_DOUBLE:
+			v.d = va_arg(args, double);
+			memcpy(p, &v.d, 8);
+			p += 8;
+			break;
+		case BINLOG_ARG_PTR:
+			v.p = va_arg(args, void *);
+			memcpy(p, &v.p, 8);
+			p += 8;
+			break;
+		case BINLOG_ARG_STR:
+			str = va_arg(args, const char *);
+			if (!str) {
+				n16 = 0xffff;
+				memcpy(p, &n16, 2);
+				p += 2;
+				break;
+			}
+			/* leave room for the fixed size arguments still to come */
+			room = buf + sizeof(buf) - p - 2 - 8 * (s->nargs - i);
+			slen = strnlen(str, room > 0 ? room : 0);
+			n16 = slen;
+			memcpy(p, &n16, 2);
+			memcpy(p + 2, str, slen);
+			p += 2 + slen;
+			break;
+		}
+	}
+	len = BINLOG_ALIGN(p - buf);
+	memset(p, 0, buf + len - p);
+	ev->hdr.size = len;
+	ev->hdr.type = 0;
+	ev->hdr.level = level;
+	ev->hdr.id = s->id;
+	ev->ns = realtime_ns();
+	if (!tls_binlog_tid) tls_binlog_tid = syscall(__NR_gettid);
+	ev->tid = tls_binlog_tid;
+	ev->reserved = 0;
+
+	dst = reserve(b, len, 0, &f);
+	if (!dst) {
+		__atomic_add_fetch(&b->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	memcpy(dst, buf, len);
+	__atomic_store_n(&((struct binlog_record *)dst)->type, BINLOG_EVENT, __ATOMIC_RELEASE);
+	release(f);
+}
+void binlog_close(struct binlog *b) {
+	struct binlog_file *f;
+	pthread_mutex_lock(&b->lock);
+	f = b->cur;
+	__atomic_store_n(&b->cur, NULL, __ATOMIC_SEQ_CST);
+	file_retire(b, f);
+	while ((f = b->retired)) {
+		b->retired = f->next;
+		free(f);
+	}
+	pthread_mutex_unlock(&b->lock);
+	pthread_mutex_destroy(&b->lock);
+}
@@ -0,0 +1,133 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+*
+* This file is part of udpproxy.
+*
+* udpproxy is free software; you can redistribute it and/or
+        * modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+        * version 2.1 of the License, or (at your option) any later version.
+*
+* udpproxy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#ifndef __BINLOG_H__
+#define __BINLOG_H__
+
+#include <stdint.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+/* Binary log: instead of formatting, a log call stores its call site id,
+ * time, thread id and raw printf arguments; udpproxy-logcat renders the
+ * text offline.
+ *
+ * File layout (little-endian, host order): a binlog_file_header, then
+ * records padded to 8 bytes. A call site is described once per file by a
+ * DEF record (id, level, line, file name and format) ahead of its first
+ * EVENT record. Space is reserved with one atomic add on a memory-mapped
+ * file and the record type is stored last, so a reader treats type 0 as
+ * not (yet) written and size 0 as the end of the file. Files rotate at
+ * the logger's size limit; DEF records are repeated at the start of
+ * every file so each one decodes on its own.
+ *
+ * Event arguments follow the format's conversions in order, '*' width
+ * and precision first: int conversions 4 bytes, long/long long/size_t/
+ * pointer 8 bytes, floating point as an 8 byte double, strings as a
+ * 16 bit length (0xffff for NULL) and the bytes without terminator. */
+#define BINLOG_MAGIC "UPXBLOG1"
+#define BINLOG_VERSION 1
+#define BINLOG_RECORD_MAX 4096  /* longer records have strings cut */
+#define BINLOG_MAX_ARGS 32
+#define BINLOG_SITES 2048       /* distinct call sites, power of 2 */
+
+enum binlog_record_type { BINLOG_DEF = 1, BINLOG_EVENT = 2 };
+enum binlog_arg_type {
+	BINLOG_ARG_NONE,            /* %% */
+	BINLOG_ARG_INT,
+	BINLOG_ARG_LONG,
+	BINLOG_ARG_DOUBLE,
+	BINLOG_ARG_STR,
+	BINLOG_ARG_PTR,
+};
+
+struct binlog_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	int64_t created_ns;         /* CLOCK_REALTIME */
+};
+struct binlog_record {
+	uint16_t size;              /* whole record including padding */
+	uint8_t type;               /* stored last */
+	uint8_t level;
+	uint32_t id;
+};
+struct binlog_def {
+	struct binlog_record hdr;
+	uint32_t line;
+	uint16_t file_len;
+	uint16_t fmt_len;
+	/* file name, then format, neither terminated */
+};
+struct binlog_event {
+	struct binlog_record hdr;
+	int64_t ns;                 /* CLOCK_REALTIME */
+	uint32_t tid;
+	uint32_t reserved;
+	/* arguments */
+};
+
+/* one conversion of a printf format */
+struct binlog_conv {
+	const char *start;          /* at '%' */
+	int len;                    /* up to and including the conversion char */
+	int type;                   /* enum binlog_arg_type */
+	int stars;                  /* '*' int arguments taken before the value */
+};
+/* returns the number of conversions, -1 if there are more than max */
+int binlog_parse_format(const char *fmt, struct binlog_conv *conv, int max);
+
+/* ------------------------------------------------------------------------- */
+struct binlog_file {
+	int fd;
+	char *map;
+	uint64_t size;
+	uint64_t used;              /* reserved bytes, runs past size once full */
+	unsigned int writers;       /* records reserved but not yet committed */
+	struct binlog_file *next;   /* retired files, freed by binlog_close */
+};
+struct binlog_site {
+	const char *fmt;            /* key, published last; NULL: free slot */
+	const char *file;
+	int line;
+	int level;
+	uint32_t id;
+	int nargs;
+	unsigned char args[BINLOG_MAX_ARGS]; /* enum binlog_arg_type, '*' flattened */
+};
+struct binlog {
+	char prefix[1024];
+	uint64_t file_size;
+	struct binlog_file *cur;
+	struct binlog_file *retired; /* unmapped, kept as late writers may still
+								  * look at their counters */
+	pthread_mutex_t lock;       /* site registration and rotation */
+	uint32_t next_id;
+	unsigned int file_seq;
+	unsigned long dropped;
+	struct binlog_site sites[BINLOG_SITES];
+};
+
+/* files are named <prefix>YYYY-MM-DD_hh:mm:ss.NNN.blog (NNN counts the
+ * files of this process) and rotate at file_size, 0 for 64MB */
+int binlog_open(struct binlog *, const char *prefix, uint64_t file_size);
+void binlog_write(struct binlog *, int level, const char *filename, int line,
+				  const char *fmt, va_list args);
+void binlog_close(struct binlog *);
+#endif
@@ -0,0 +1,168 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include "checkpoint.h"
+#include "logger.h"
+/* ------------------------------------------------------------------------- */
+#define CHECKPOINT_MAGIC 0x55504350 /* "UPCP" */
+#define CHECKPOINT_VERSION 1
+struct checkpoint_record {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t seq;
+	int64_t sent_timestamp;
+	int64_t cur_timestamp;
+	int64_t cur_offset;
+	int64_t next_sequence;
+	int64_t next_clock;
+	uint32_t check;           /* FNV-1a of all preceding fields */
+	uint32_t pad;
+};
+/* both slots live in the first page of the file */
+struct checkpoint_file {
+	struct checkpoint_record slot[2];
+	char reserved[256 - 2 * sizeof(struct checkpoint_record)];
+};
+
+/* ------------------------------------------------------------------------- */
+static int64_t now_us(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+static uint32_t record_check(const struct checkpoint_record *r) {
+	const unsigned char *p = (const unsigned char *)r;
+	size_t i, len = offsetof(struct checkpoint_record, check);
+	uint32_t h = 2166136261u;
+	for (i = 0; i < len; ++i) {
+		h ^= p[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+static int record_valid(const struct checkpoint_record *r) {
+	return r->magic == CHECKPOINT_MAGIC &&
+		   r->version == CHECKPOINT_VERSION &&
+		   r->check == record_check(r);
+}
+/* ------------------------------------------------------------------------- */
+int checkpoint_open(struct checkpoint *cp, const char *path,
+					unsigned int sync_interval_ms, struct checkpoint_pos *pos) {
+	struct checkpoint_record *a, *b, *r = NULL;
+	memset(cp, 0, sizeof(*cp));
+	cp->fd = -1;
+	pos->sent_timestamp = -1;
+	pos->cur_timestamp = -1;
+	pos->cur_offset = 0;
+	pos->next_sequence = -1;
+	pos->next_clock = 0;
+
+	cp->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (cp->fd < 0) {
+		log_error("open checkpoint %s failed:%s", path, strerror(errno));
+		return -1;
+	}
+	if (ftruncate(cp->fd, sizeof(struct checkpoint_file)) < 0) {
+		log_error("ftruncate checkpoint %s failed:%s", path, strerror(errno));
+		close(cp->fd);
+		cp->fd = -1;
+		return -1;
+	}
+	cp->map = mmap(NULL, sizeof(struct checkpoint_file), PROT_READ | PROT_WRITE,
+				   MAP_SHARED, cp->fd, 0);
+	if (cp->map == MAP_FAILED) {
+		log_error("mmap checkpoint %s failed:%s", path, strerror(errno));
+		close(cp->fd);
+		cp->fd = -1;
+		cp->map = NULL;
+		return -1;
+	}
+	cp->sync_interval = (int64_t)sync_interval_ms * 1000;
+	cp->last_sync = now_us();
+
+	/* pick the newest valid slot */
+	a = &cp->map->slot[0];
+	b = &cp->map->slot[1];
+	if (record_valid(a)) r = a;
+	if (record_valid(b) && (!r || b->seq > r->seq)) r = b;
+	if (r) {
+		pos->sent_timestamp = r->sent_timestamp;
+		pos->cur_timestamp = r->cur_timestamp;
+		pos->cur_offset = r->cur_offset;
+		pos->next_sequence = r->next_sequence;
+		pos->next_clock = r->next_clock;
+		cp->seq = r->seq;
+		cp->slot = r - cp->map->slot;
+		log_info("checkpoint %s restored: seq=%llu sent_timestamp=%lld "
+				 "cur_timestamp=%lld cur_offset=%lld next_sequence=%lld", path,
+				 (unsigned long long)r->seq, (long long)r->sent_timestamp,
+				 (long long)r->cur_timestamp, (long long)r->cur_offset,
+				 (long long)r->next_sequence);
+	} else {
+		log_info("checkpoint %s has no valid record, starting fresh", path);
+	}
+	return 0;
+}
+void checkpoint_update(struct checkpoint *cp, const struct checkpoint_pos *pos) {
+	struct checkpoint_record *r;
+	int64_t now;
+	if (!cp->map) return;
+	/* never overwrite the slot holding the latest valid record */
+	cp->slot ^= 1;
+	r = &cp->map->slot[cp->slot];
+	r->magic = CHECKPOINT_MAGIC;
+	r->version = CHECKPOINT_VERSION;
+	r->seq = ++cp->seq;
+	r->sent_timestamp = pos->sent_timestamp;
+	r->cur_timestamp = pos->cur_timestamp;
+	r->cur_offset = pos->cur_offset;
+	r->next_sequence = pos->next_sequence;
+	r->next_clock = pos->next_clock;
+	r->pad = 0;
+	r->check = record_check(r);
+	cp->dirty = 1;
+
+	/* sync_interval_ms == 0 syncs every update */
+	now = now_us();
+	if (now - cp->last_sync >= cp->sync_interval) {
+		checkpoint_sync(cp);
+		cp->last_sync = now;
+	}
+}
+void checkpoint_sync(struct checkpoint *cp) {
+	if (!cp->map || !cp->dirty) return;
+	msync(cp->map, sizeof(struct checkpoint_file), MS_SYNC);
+	cp->dirty = 0;
+}
+void checkpoint_close(struct checkpoint *cp) {
+	if (!cp->map) return;
+	checkpoint_sync(cp);
+	munmap(cp->map, sizeof(struct checkpoint_file));
+	close(cp->fd);
+	cp->map = NULL;
+	cp->fd = -1;
+}
@@ -0,0 +1,59 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+*
+* This file is part of udpproxy.
+*
+* udpproxy is free software; you can redistribute it and/or
+        * modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+        * version 2.1 of the License, or (at your option) any later version.
+*
+* udpproxy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <stdint.h>
+
+/* Crash-safe send position, kept in a small memory-mapped file.
+ *
+ * The file holds two record slots that are written alternately; every
+ * record carries a sequence number and a checksum, so a torn write can
+ * only ever invalidate the slot being written and checkpoint_open()
+ * falls back to the other one. Updates are plain stores into the
+ * mapping (they survive a process crash immediately); msync() to disk
+ * is batched to at most once per sync_interval_ms (0 syncs every update). */
+struct checkpoint {
+	int fd;
+	struct checkpoint_file *map;
+	unsigned int slot;        /* slot written by the last update */
+	uint64_t seq;
+	int64_t sync_interval;    /* microseconds */
+	int64_t last_sync;
+	int dirty;
+};
+
+/* position restored by checkpoint_open() */
+struct checkpoint_pos {
+	int64_t sent_timestamp;   /* last segment sent completely, -1 if none */
+	int64_t cur_timestamp;    /* segment in progress, -1 if none */
+	int64_t cur_offset;       /* bytes of cur_timestamp already sent */
+	/* playlist mode: the media timestamps are a running sum of #EXTINF
+	 * durations, so the sequence and clock after the last sent segment
+	 * are kept with it to rebuild the same timeline after a restart */
+	int64_t next_sequence;    /* first media sequence not sent, -1 if unused */
+	int64_t next_clock;       /* media timestamp of next_sequence */
+};
+
+int checkpoint_open(struct checkpoint *, const char *path,
+					unsigned int sync_interval_ms, struct checkpoint_pos *pos);
+void checkpoint_update(struct checkpoint *, const struct checkpoint_pos *pos);
+void checkpoint_sync(struct checkpoint *);
+void checkpoint_close(struct checkpoint *);
+#endif
@@ -76,3 +76,15 @@ struct config {
     struct  section *section_ptr ;
     struct  config *next ;
 } ;
+
+// user callable functions, see config.c
+int     cfg_read_config_file( char * ) ;
+char    **cfg_get_sections( int ) ;
+char    **cfg_get_hash_keys( int, char *, char *) ;
+char    *cfg_get_hash_value( int, char *, char *, char *) ;
+char    **cfg_get_keywords( int, char * ) ;
+char    *cfg_get_value( int, char *, char * ) ;
+char    **cfg_get_values( int, char *, char * ) ;
+char    *cfg_error_msg( int ) ;
+char    *cfg_get_type_str( int, char *, char * ) ;
+int     cfg_get_type( int, char *, char * ) ;
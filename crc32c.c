@@ -0,0 +1,114 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#include <string.h>
+#include <pthread.h>
+#include "crc32c.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_X86 1
+#endif
+/* ------------------------------------------------------------------------- */
+#define CRC32C_POLY 0x82f63b78u   /* reflected 0x1edc6f41 */
+
+static uint32_t table[8][256];
+static uint32_t (*crc_impl)(uint32_t, const unsigned char *, size_t);
+static const char *impl_name;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+/* ------------------------------------------------------------------------- */
+static uint32_t crc_slicing8(uint32_t crc, const unsigned char *p, size_t len) {
+	uint32_t lo, hi;
+	for (; len && ((uintptr_t)p & 7); len--)
+		crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		lo = __builtin_bswap32(lo);
+		hi = __builtin_bswap32(hi);
+#endif
+		lo ^= crc;
+		crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^
+			  table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24] ^
+			  table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^
+			  table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+	}
+	for (; len; len--)
+		crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+#ifdef CRC32C_X86
+__attribute__((target("sse4.2")))
+static uint32_t crc_sse42(uint32_t crc, const unsigned char *p, size_t len) {
+	for (; len && ((uintptr_t)p & 7); len--)
+		crc = _mm_crc32_u8(crc, *p++);
+#ifdef __x86_64__
+	{
+		uint64_t c = crc, v;
+		for (; len >= 8; len -= 8, p += 8) {
+			memcpy(&v, p, 8);
+			c = _mm_crc32_u64(c, v);
+		}
+		crc = (uint32_t)c;
+	}
+#endif
+	for (; len >= 4; len -= 4, p += 4) {
+		uint32_t v;
+		memcpy(&v, p, 4);
+		crc = _mm_crc32_u32(crc, v);
+	}
+	for (; len; len--)
+		crc = _mm_crc32_u8(crc, *p++);
+	return crc;
+}
+#endif
+static void crc32c_init(void) {
+	uint32_t c;
+	int i, j;
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = (c >> 1) ^ (CRC32C_POLY & (0u - (c & 1)));
+		table[0][i] = c;
+	}
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			table[j][i] = (table[j - 1][i] >> 8) ^ table[0][table[j - 1][i] & 0xff];
+	crc_impl = crc_slicing8;
+	impl_name = "slicing-by-8";
+#ifdef CRC32C_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2")) {
+		crc_impl = crc_sse42;
+		impl_name = "sse4.2";
+	}
+#endif
+}
+/* ------------------------------------------------------------------------- */
+uint32_t crc32c_update(uint32_t crc, const void *buf, size_t len) {
+	pthread_once(&init_once, crc32c_init);
+	return ~crc_impl(~crc, buf, len);
+}
+uint32_t crc32c(const void *buf, size_t len) {
+	return crc32c_update(0, buf, len);
+}
+const char *crc32c_impl(void) {
+	pthread_once(&init_once, crc32c_init);
+	return impl_name;
+}
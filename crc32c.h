@@ -0,0 +1,39 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+*
+* This file is part of udpproxy.
+*
+* udpproxy is free software; you can redistribute it and/or
+        * modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+        * version 2.1 of the License, or (at your option) any later version.
+*
+* udpproxy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#ifndef __CRC32C_H__
+#define __CRC32C_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* CRC32C (Castagnoli, the iSCSI/SCTP polynomial).
+ *
+ * Uses the SSE4.2 crc32 instruction when the CPU has it, otherwise a
+ * slicing-by-8 table lookup; the choice is made once on first use.
+ * crc32c_update() continues a running CRC, so a segment can be checked
+ * block by block:
+ *
+ *     uint32_t crc = 0;
+ *     crc = crc32c_update(crc, a, alen);
+ *     crc = crc32c_update(crc, b, blen);   == crc32c(ab, alen + blen) */
+uint32_t crc32c_update(uint32_t crc, const void *buf, size_t len);
+uint32_t crc32c(const void *buf, size_t len);
+/* "sse4.2" or "slicing-by-8" */
+const char *crc32c_impl(void);
+#endif
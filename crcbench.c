@@ -0,0 +1,71 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+/* CRC32C throughput benchmark.
+ *
+ *     udpproxy-crcbench [block size] [MB]
+ *
+ * Checks the implementation against the standard test vector, then
+ * reports single core GB/s for the datagram payload size and for the
+ * given block size. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "crc32c.h"
+/* ------------------------------------------------------------------------- */
+#define BENCH_DATAGRAM (7 * 188)
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+static void run(const unsigned char *buf, size_t block, size_t total) {
+	size_t done = 0, off = 0;
+	uint32_t crc = 0;
+	double t = now();
+	while (done < total) {
+		crc = crc32c_update(crc, buf + off, block);
+		done += block;
+		off = (off + block) % (1 << 20);
+	}
+	t = now() - t;
+	printf("block %6zu: %8.2f GB/s (%08x)\n", block, total / t / 1e9, crc);
+}
+int main(int argc, char *argv[]) {
+	size_t block = argc > 1 ? strtoul(argv[1], NULL, 0) : 65536;
+	size_t total = (argc > 2 ? strtoul(argv[2], NULL, 0) : 4096) << 20;
+	unsigned char *buf;
+	size_t i;
+
+	if (crc32c("123456789", 9) != 0xe3069283) {
+		fprintf(stderr, "crc32c(\"123456789\") = %08x, expected e3069283\n",
+				crc32c("123456789", 9));
+		return 1;
+	}
+	if (block < 1 || block > (1 << 20)) block = 65536;
+	buf = malloc((2 << 20));
+	if (!buf) return 1;
+	for (i = 0; i < (2 << 20); i++) buf[i] = (unsigned char)(i * 131 + (i >> 9));
+	printf("crc32c implementation: %s\n", crc32c_impl());
+	run(buf, BENCH_DATAGRAM, total);
+	run(buf, block, total);
+	free(buf);
+	return 0;
+}
@@ -0,0 +1,267 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include "fec.h"
+#include "logger.h"
+#include "metrics.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FEC_X86 1
+#endif
+/* ------------------------------------------------------------------------- */
+#define FEC_PT 96
+#define FEC_COL_PORT_OFFSET 2
+#define FEC_ROW_PORT_OFFSET 4
+
+/* ------------------------------------------------------------------------- */
+static void xor_scalar(unsigned char *dst, const unsigned char *src, size_t n) {
+	size_t i = 0;
+	uint64_t a, b;
+	for (; i + 8 <= n; i += 8) {
+		memcpy(&a, dst + i, 8);
+		memcpy(&b, src + i, 8);
+		a ^= b;
+		memcpy(dst + i, &a, 8);
+	}
+	for (; i < n; i++) dst[i] ^= src[i];
+}
+#ifdef FEC_X86
+__attribute__((target("sse2")))
+static void xor_sse2(unsigned char *dst, const unsigned char *src, size_t n) {
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(dst + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(a, b));
+	}
+	xor_scalar(dst + i, src + i, n - i);
+}
+__attribute__((target("avx2")))
+static void xor_avx2(unsigned char *dst, const unsigned char *src, size_t n) {
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(dst + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(src + i));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(a, b));
+	}
+	xor_sse2(dst + i, src + i, n - i);
+}
+#endif
+static void (*xor_block)(unsigned char *, const unsigned char *, size_t) = xor_scalar;
+static const char *xor_name = "scalar";
+
+static void select_kernel(void) {
+	static int selected;
+	if (selected) return;
+	selected = 1;
+#ifdef FEC_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		xor_block = xor_avx2;
+		xor_name = "avx2";
+	} else if (__builtin_cpu_supports("sse2")) {
+		xor_block = xor_sse2;
+		xor_name = "sse2";
+	}
+#endif
+}
+const char *fec_kernel_name(void) {
+	return xor_name;
+}
+int fec_set_kernel(const char *name) {
+	select_kernel();
+	if (!strcmp(name, "scalar")) {
+		xor_block = xor_scalar;
+		xor_name = "scalar";
+		return 0;
+	}
+#ifdef FEC_X86
+	if (!strcmp(name, "sse2") && __builtin_cpu_supports("sse2")) {
+		xor_block = xor_sse2;
+		xor_name = "sse2";
+		return 0;
+	}
+	if (!strcmp(name, "avx2") && __builtin_cpu_supports("avx2")) {
+		xor_block = xor_avx2;
+		xor_name = "avx2";
+		return 0;
+	}
+#endif
+	return -1;
+}
+/* ------------------------------------------------------------------------- */
+static void accum_add(struct fec_accum *a, uint16_t seq, uint8_t pt, uint32_t ts,
+					  const unsigned char *payload, unsigned int len) {
+	unsigned char *parity = a->pkt + FEC_RTP_HEADER_LEN + FEC_HEADER_LEN;
+	if (len > FEC_MAX_PAYLOAD) len = FEC_MAX_PAYLOAD;
+	if (!a->count) {
+		a->sn_base = seq;
+		a->len_recovery = len;
+		a->pt_recovery = pt;
+		a->ts_recovery = ts;
+		memcpy(parity, payload, len);
+		a->len = len;
+	} else {
+		a->len_recovery ^= len;
+		a->pt_recovery ^= pt;
+		a->ts_recovery ^= ts;
+		/* shorter payloads are zero padded, the tail of the parity grows */
+		if (len > a->len) {
+			memset(parity + a->len, 0, len - a->len);
+			a->len = len;
+		}
+		xor_block(parity, payload, len);
+	}
+	a->count++;
+}
+static void put16(unsigned char *p, uint16_t v) {
+	p[0] = v >> 8;
+	p[1] = v;
+}
+static void put32(unsigned char *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+/* d: 0 column, 1 row */
+static void accum_send(struct fec_encoder *e, struct fec_accum *a, int d, uint16_t *seq,
+					   const struct sockaddr_in *dst) {
+	unsigned char *rtp = a->pkt, *fec = a->pkt + FEC_RTP_HEADER_LEN;
+	ssize_t len;
+	rtp[0] = 0x80;
+	rtp[1] = FEC_PT;
+	put16(rtp + 2, (*seq)++);
+	put32(rtp + 4, 0);
+	put32(rtp + 8, 0);
+	put16(fec, a->sn_base);
+	put16(fec + 2, a->len_recovery);
+	fec[4] = 0x80 | (a->pt_recovery & 0x7f);   /* E = 1 */
+	fec[5] = fec[6] = fec[7] = 0;              /* mask */
+	put32(fec + 8, a->ts_recovery);
+	fec[12] = d ? 0x40 : 0;                     /* X = 0, D, type 0 XOR, index 0 */
+	fec[13] = d ? 1 : e->columns;               /* offset */
+	fec[14] = d ? e->columns : e->rows;         /* NA */
+	fec[15] = 0;                                /* SNBase ext */
+	len = sendto(e->fd, a->pkt, FEC_RTP_HEADER_LEN + FEC_HEADER_LEN + a->len, 0,
+				 (const struct sockaddr *)dst, sizeof(*dst));
+	if (len < 0)
+		metrics_send_error(METRICS_OUT_FEC, errno);
+	else
+		metrics_sent(METRICS_OUT_FEC, len, 1);
+	a->count = 0;
+	e->packets++;
+}
+/* ------------------------------------------------------------------------- */
+int fec_init(struct fec_encoder *e, int fd, const struct sockaddr_in *dst,
+			 unsigned int columns, unsigned int rows, int row_fec) {
+	memset(e, 0, sizeof(*e));
+	if (columns < 1 || columns > 20 || rows < 4 || rows > 20 || columns * rows > 100) {
+		log_error("fec: invalid matrix %ux%u, need 1<=L<=20, 4<=D<=20, L*D<=100",
+				  columns, rows);
+		return -1;
+	}
+	e->col = calloc(columns, sizeof(*e->col));
+	if (!e->col) return -1;
+	select_kernel();
+	e->fd = fd;
+	e->columns = columns;
+	e->rows = rows;
+	e->row_fec = row_fec;
+	e->col_dst = e->row_dst = *dst;
+	e->col_dst.sin_port = htons(ntohs(dst->sin_port) + FEC_COL_PORT_OFFSET);
+	e->row_dst.sin_port = htons(ntohs(dst->sin_port) + FEC_ROW_PORT_OFFSET);
+	log_info("fec: %ux%u matrix, column FEC to port %d, row FEC %s%d, %s XOR",
+			 columns, rows, ntohs(e->col_dst.sin_port), row_fec ? "to port " : "off ",
+			 row_fec ? ntohs(e->row_dst.sin_port) : 0, xor_name);
+	return 0;
+}
+void fec_add(struct fec_encoder *e, uint16_t seq, uint8_t pt, uint32_t ts,
+			 const unsigned char *payload, unsigned int len) {
+	unsigned int c = e->index % e->columns;
+
+	accum_add(&e->col[c], seq, pt, ts, payload, len);
+	if (e->row_fec) {
+		accum_add(&e->row, seq, pt, ts, payload, len);
+		if (c == e->columns - 1)
+			accum_send(e, &e->row, 1, &e->row_seq, &e->row_dst);
+	}
+	if (++e->index == e->columns * e->rows) {
+		for (c = 0; c < e->columns; c++)
+			accum_send(e, &e->col[c], 0, &e->col_seq, &e->col_dst);
+		e->index = 0;
+	}
+}
+void fec_destroy(struct fec_encoder *e) {
+	free(e->col);
+	e->col = NULL;
+}
+/* ------------------------------------------------------------------------- */
+static uint16_t get16(const unsigned char *p) {
+	return (uint16_t)(p[0] << 8 | p[1]);
+}
+static uint32_t get32(const unsigned char *p) {
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+int fec_parse(struct fec_parity *p, const unsigned char *pkt, unsigned int len) {
+	const unsigned char *fec = pkt + FEC_RTP_HEADER_LEN;
+	if (len < FEC_RTP_HEADER_LEN + FEC_HEADER_LEN || (pkt[0] & 0xc0) != 0x80 ||
+		(fec[12] & 0x38) != 0 || !fec[13] || !fec[14])
+		return -1;
+	p->sn_base = get16(fec);
+	p->len_recovery = get16(fec + 2);
+	p->pt_recovery = fec[4] & 0x7f;
+	p->ts_recovery = get32(fec + 8);
+	p->row = !!(fec[12] & 0x40);
+	p->offset = fec[13];
+	p->na = fec[14];
+	p->payload = pkt + FEC_RTP_HEADER_LEN + FEC_HEADER_LEN;
+	p->len = len - FEC_RTP_HEADER_LEN - FEC_HEADER_LEN;
+	if (p->len > FEC_MAX_PAYLOAD) return -1;
+	return 0;
+}
+int fec_recover(const struct fec_parity *p, const struct fec_media *members,
+				unsigned char *out, uint8_t *pt, uint32_t *ts) {
+	unsigned int i, n, missing = 0, len = p->len_recovery;
+	uint8_t pt_rec = p->pt_recovery;
+	uint32_t ts_rec = p->ts_recovery;
+
+	for (i = 0; i < p->na; i++)
+		if (!members[i].payload) missing++;
+	if (missing != 1) return -1;
+	select_kernel();
+	memcpy(out, p->payload, p->len);
+	memset(out + p->len, 0, FEC_MAX_PAYLOAD - p->len);
+	for (i = 0; i < p->na; i++) {
+		if (!members[i].payload) continue;
+		n = members[i].len < FEC_MAX_PAYLOAD ? members[i].len : FEC_MAX_PAYLOAD;
+		xor_block(out, members[i].payload, n);
+		len ^= n;
+		pt_rec ^= members[i].pt;
+		ts_rec ^= members[i].ts;
+	}
+	if (len > p->len) return -1;
+	*pt = pt_rec & 0x7f;
+	*ts = ts_rec;
+	return len;
+}
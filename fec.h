@@ -0,0 +1,117 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+*
+* This file is part of udpproxy.
+*
+* udpproxy is free software; you can redistribute it and/or
+        * modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+        * version 2.1 of the License, or (at your option) any later version.
+*
+* udpproxy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#ifndef __FEC_H__
+#define __FEC_H__
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+/* SMPTE 2022-1 style XOR FEC encoder.
+ *
+ * Media datagrams are arranged in an L x D matrix in the order they are
+ * sent (L columns, D rows). For every column a parity packet is sent to
+ * port + 2 once the matrix is complete, and with row FEC enabled one for
+ * every row to port + 4 once the row is complete. Parity packets are
+ * an RTP header, the 16 byte 2022-1 FEC header (SNBase, length recovery,
+ * PT/TS recovery, D, offset, NA) and the XOR of the media payloads
+ * zero padded to the longest one, so a receiver can rebuild any single
+ * lost datagram of a column or row.
+ *
+ * fec_add() expects consecutive media sequence numbers. The XOR kernel
+ * is picked once at startup: AVX2 or SSE2 where the CPU has it, else
+ * a scalar loop.
+ *
+ * The receiving side parses a parity packet with fec_parse() and, when
+ * exactly one media datagram of its column or row is missing, rebuilds
+ * it with fec_recover() from the parity and the datagrams that did
+ * arrive. Member i of the group has sequence sn_base + i * offset. */
+#define FEC_MAX_PAYLOAD 1472
+#define FEC_RTP_HEADER_LEN 12
+#define FEC_HEADER_LEN 16
+
+struct fec_accum {
+	uint16_t sn_base;
+	uint16_t len_recovery;
+	uint8_t pt_recovery;
+	uint32_t ts_recovery;
+	unsigned int count;
+	unsigned int len;             /* longest payload so far */
+	/* RTP + FEC header room, then the parity payload */
+	unsigned char pkt[FEC_RTP_HEADER_LEN + FEC_HEADER_LEN + FEC_MAX_PAYLOAD];
+};
+
+struct fec_encoder {
+	int fd;
+	struct sockaddr_in col_dst;
+	struct sockaddr_in row_dst;
+	unsigned int columns;         /* L */
+	unsigned int rows;            /* D */
+	int row_fec;
+	unsigned int index;           /* position of the next media packet in the matrix */
+	uint16_t col_seq;             /* RTP sequence of the FEC streams */
+	uint16_t row_seq;
+	struct fec_accum *col;
+	struct fec_accum row;
+	uint64_t packets;
+};
+
+/* parsed parity packet, payload points into the packet */
+struct fec_parity {
+	uint16_t sn_base;
+	uint16_t len_recovery;
+	uint8_t pt_recovery;
+	uint32_t ts_recovery;
+	int row;                      /* D bit: 1 row FEC, 0 column FEC */
+	unsigned int offset;          /* sequence distance between members */
+	unsigned int na;              /* number of members */
+	const unsigned char *payload;
+	unsigned int len;
+};
+
+/* a media datagram of a column or row as the receiver saw it */
+struct fec_media {
+	const unsigned char *payload; /* NULL if lost */
+	unsigned int len;
+	uint8_t pt;                   /* 0 for non RTP media */
+	uint32_t ts;
+};
+
+/* dst is the media destination; returns -1 for L/D outside 2022-1 limits
+ * (1 <= L <= 20, 4 <= D <= 20, L * D <= 100) */
+int fec_init(struct fec_encoder *, int fd, const struct sockaddr_in *dst,
+			 unsigned int columns, unsigned int rows, int row_fec);
+/* feed one media datagram; pt/ts are its RTP payload type and timestamp,
+ * 0 for non RTP media */
+void fec_add(struct fec_encoder *, uint16_t seq, uint8_t pt, uint32_t ts,
+			 const unsigned char *payload, unsigned int len);
+void fec_destroy(struct fec_encoder *);
+/* returns -1 if pkt is not a 2022-1 XOR parity packet */
+int fec_parse(struct fec_parity *, const unsigned char *pkt, unsigned int len);
+/* members[0 .. na) of the group, payload NULL for the one that is
+ * missing; rebuilds it into out (FEC_MAX_PAYLOAD bytes) with its RTP
+ * payload type and timestamp, returns its length or -1 unless exactly
+ * one member is missing */
+int fec_recover(const struct fec_parity *, const struct fec_media *members,
+				unsigned char *out, uint8_t *pt, uint32_t *ts);
+/* name of the XOR kernel in use, for logging */
+const char *fec_kernel_name(void);
+/* use kernel "scalar", "sse2" or "avx2" instead of the one picked for
+ * the CPU, for benchmarks; returns -1 if it is unknown or unsupported */
+int fec_set_kernel(const char *name);
+#endif
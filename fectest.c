@@ -0,0 +1,264 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+/* FEC encode/recover round trip check and encoder throughput.
+ *
+ *     udpproxy-fectest [-t seconds] [columns] [rows] [base port]
+ *
+ * Feeds two matrices of media datagrams with varying lengths, payload
+ * types and timestamps through the encoder, with sequence numbers that
+ * wrap in the second matrix, and collects the column and row parity
+ * packets it sends to 127.0.0.1 base port + 2 / + 4. Then for every
+ * column one datagram (a different row each time) and for every row one
+ * datagram is dropped and rebuilt from the parity, and must match the
+ * original bytes, length, payload type and timestamp.
+ *
+ * With -t the encoder is fed the given number of seconds (default 10) of
+ * a 100 Mbit/s stream of 7 x 188 byte datagrams once per XOR kernel the
+ * CPU supports, as fast as it takes them, parity packets included. The
+ * process CPU time over the media time is the load at the real rate and
+ * is printed against the 10% target. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "fec.h"
+#include "logger.h"
+/* ------------------------------------------------------------------------- */
+#define TEST_MATRICES 2
+#define TEST_MAX_PACKETS 100
+#define TEST_FIRST_SEQ 65500
+
+#define BENCH_RATE 100000000ULL   /* bit/s */
+#define BENCH_PAYLOAD (7 * 188)
+#define BENCH_PAYLOADS 64
+#define BENCH_CPU_TARGET 10.0     /* percent */
+
+struct media {
+	unsigned char data[FEC_MAX_PAYLOAD];
+	unsigned int len;
+	uint16_t seq;
+	uint8_t pt;
+	uint32_t ts;
+};
+
+static unsigned int columns = 5, rows = 4;
+static struct media media[TEST_MATRICES * TEST_MAX_PACKETS];
+static unsigned int media_count;
+
+/* ------------------------------------------------------------------------- */
+static int bind_udp(unsigned short port) {
+	struct sockaddr_in addr;
+	struct timeval tv = { 1, 0 };
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+static struct media *find_media(uint16_t seq) {
+	unsigned int i;
+	for (i = 0; i < media_count; i++)
+		if (media[i].seq == seq) return &media[i];
+	return NULL;
+}
+/* drop member lost of the group described by pkt and rebuild it */
+static int check_group(const unsigned char *pkt, unsigned int pkt_len, unsigned int lost) {
+	struct fec_media members[TEST_MAX_PACKETS];
+	unsigned char out[FEC_MAX_PAYLOAD];
+	struct fec_parity p;
+	struct media *m, *dropped = NULL;
+	unsigned int i;
+	uint32_t ts;
+	uint8_t pt;
+	int len;
+
+	if (fec_parse(&p, pkt, pkt_len) < 0) {
+		fprintf(stderr, "parity packet of %u bytes does not parse\n", pkt_len);
+		return -1;
+	}
+	for (i = 0; i < p.na; i++) {
+		m = find_media((uint16_t)(p.sn_base + i * p.offset));
+		if (!m) {
+			fprintf(stderr, "%s base %u: member %u not sent\n",
+					p.row ? "row" : "column", p.sn_base, i);
+			return -1;
+		}
+		members[i].payload = i == lost % p.na ? NULL : m->data;
+		members[i].len = m->len;
+		members[i].pt = m->pt;
+		members[i].ts = m->ts;
+		if (!members[i].payload) dropped = m;
+	}
+	len = fec_recover(&p, members, out, &pt, &ts);
+	if (len != (int)dropped->len || memcmp(out, dropped->data, dropped->len) ||
+		pt != (dropped->pt & 0x7f) || ts != dropped->ts) {
+		fprintf(stderr, "%s base %u: seq %u not restored (len %d/%u pt %u/%u ts %u/%u)\n",
+				p.row ? "row" : "column", p.sn_base, dropped->seq, len, dropped->len,
+				pt, dropped->pt & 0x7f, ts, dropped->ts);
+		return -1;
+	}
+	/* a second loss in the same group cannot be repaired */
+	members[(lost + 1) % p.na].payload = NULL;
+	if (p.na > 1 && fec_recover(&p, members, out, &pt, &ts) >= 0) {
+		fprintf(stderr, "%s base %u: two losses reported as recovered\n",
+				p.row ? "row" : "column", p.sn_base);
+		return -1;
+	}
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+static double cpu_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+static int throughput(unsigned short port, unsigned int seconds) {
+	static const char *kernels[] = { "scalar", "sse2", "avx2" };
+	static unsigned char payload[BENCH_PAYLOADS][BENCH_PAYLOAD];
+	unsigned long long i, count = BENCH_RATE * seconds / 8 / BENCH_PAYLOAD;
+	struct fec_encoder enc;
+	struct sockaddr_in dst;
+	unsigned int k, j;
+	int fd, col_fd, row_fd;
+	double start, cpu;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	/* the parity has somewhere to go, nobody reads it */
+	col_fd = bind_udp(port + 2);
+	row_fd = bind_udp(port + 4);
+	if (fd < 0 || col_fd < 0 || row_fd < 0) return 1;
+	memset(&dst, 0, sizeof(dst));
+	dst.sin_family = AF_INET;
+	dst.sin_port = htons(port);
+	dst.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	srand(1);
+	for (i = 0; i < BENCH_PAYLOADS; i++)
+		for (j = 0; j < BENCH_PAYLOAD; j++)
+			payload[i][j] = j % 188 ? rand() : 0x47;
+
+	for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+		if (fec_set_kernel(kernels[k]) < 0) {
+			printf("%s XOR: not supported by this CPU\n", kernels[k]);
+			continue;
+		}
+		if (fec_init(&enc, fd, &dst, columns, rows, 1) < 0) {
+			fprintf(stderr, "fec_init %ux%u failed\n", columns, rows);
+			return 1;
+		}
+		start = cpu_seconds();
+		for (i = 0; i < count; i++)
+			fec_add(&enc, (uint16_t)i, 33, (uint32_t)(i * 90), payload[i % BENCH_PAYLOADS],
+					BENCH_PAYLOAD);
+		cpu = cpu_seconds() - start;
+		printf("%ux%u matrix, %s XOR: %llu datagrams (%u s at %llu Mbit/s) in %.3f s CPU, "
+			   "%.2f%% CPU, target < %.0f%% %s\n", columns, rows, kernels[k], count, seconds,
+			   BENCH_RATE / 1000000, cpu, cpu * 100 / seconds, BENCH_CPU_TARGET,
+			   cpu * 100 / seconds < BENCH_CPU_TARGET ? "met" : "MISSED");
+		fec_destroy(&enc);
+	}
+	close(fd);
+	close(col_fd);
+	close(row_fd);
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+int main(int argc, char *argv[]) {
+	unsigned short port = 29000;
+	unsigned char pkt[2048];
+	struct fec_encoder enc;
+	struct sockaddr_in dst;
+	unsigned int i, j, col_count = 0, row_count = 0;
+	int fd, col_fd, row_fd, failed = 0, opt, bench = 0;
+	ssize_t n;
+
+	/* the tool reports on stdout, the process logger is never opened */
+	log_set_level(LOG_LEVEL_MAX);
+	while ((opt = getopt(argc, argv, "t:")) != -1) {
+		if (opt != 't') {
+			fprintf(stderr, "usage: %s [-t seconds] [columns] [rows] [base port]\n", argv[0]);
+			return 1;
+		}
+		bench = atoi(optarg) > 0 ? atoi(optarg) : 10;
+	}
+	if (argc > optind) columns = atoi(argv[optind]);
+	if (argc > optind + 1) rows = atoi(argv[optind + 1]);
+	if (argc > optind + 2) port = atoi(argv[optind + 2]);
+	if (bench) return throughput(port, bench);
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	col_fd = bind_udp(port + 2);
+	row_fd = bind_udp(port + 4);
+	if (fd < 0 || col_fd < 0 || row_fd < 0) return 1;
+	memset(&dst, 0, sizeof(dst));
+	dst.sin_family = AF_INET;
+	dst.sin_port = htons(port);
+	dst.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (fec_init(&enc, fd, &dst, columns, rows, 1) < 0) {
+		fprintf(stderr, "fec_init %ux%u failed\n", columns, rows);
+		return 1;
+	}
+
+	/* lengths cover short, odd and full sized payloads */
+	media_count = TEST_MATRICES * columns * rows;
+	srand(1);
+	for (i = 0; i < media_count; i++) {
+		struct media *m = &media[i];
+		m->seq = (uint16_t)(TEST_FIRST_SEQ + i);
+		m->len = i % 7 == 0 ? FEC_MAX_PAYLOAD : 1 + rand() % FEC_MAX_PAYLOAD;
+		m->pt = (i % 3 ? 33 : 0x80 | 33);
+		m->ts = 90000u * i + rand();
+		for (j = 0; j < m->len; j++) m->data[j] = rand();
+		fec_add(&enc, m->seq, m->pt, m->ts, m->data, m->len);
+	}
+
+	while ((n = recv(col_fd, pkt, sizeof(pkt), 0)) > 0) {
+		/* column c of a matrix loses its member in row c mod D */
+		if (check_group(pkt, n, col_count % columns) < 0) failed = 1;
+		col_count++;
+		if (col_count == TEST_MATRICES * columns) break;
+	}
+	while ((n = recv(row_fd, pkt, sizeof(pkt), 0)) > 0) {
+		/* row r loses its member in column r mod L */
+		if (check_group(pkt, n, row_count % rows) < 0) failed = 1;
+		row_count++;
+		if (row_count == TEST_MATRICES * rows) break;
+	}
+	if (col_count != TEST_MATRICES * columns || row_count != TEST_MATRICES * rows) {
+		fprintf(stderr, "got %u column and %u row parity packets, expected %u and %u\n",
+				col_count, row_count, TEST_MATRICES * columns, TEST_MATRICES * rows);
+		failed = 1;
+	}
+	printf("%ux%u matrix, %s XOR: %u column and %u row losses %s\n", columns, rows,
+		   fec_kernel_name(), col_count, row_count, failed ? "NOT restored" : "restored");
+	fec_destroy(&enc);
+	close(fd);
+	close(col_fd);
+	close(row_fd);
+	return failed;
+}
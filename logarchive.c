@@ -0,0 +1,310 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#define _GNU_SOURCE /* posix_fadvise */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include "logarchive.h"
+/* ------------------------------------------------------------------------- */
+/* the worker runs at least this often, for keep_age */
+#define LOG_ARCHIVE_IDLE_WAIT_SEC 60
+#define LOG_ARCHIVE_BUFLEN (64 * 1024)
+/* <linux/ioprio.h> is not part of every toolchain */
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+
+struct log_archive_item {
+	struct list_head list;
+	time_t mtime;
+	uint64_t size;
+	char path[];
+};
+extern char **environ;
+
+/* ------------------------------------------------------------------------- */
+int log_archive_policy_enabled(const struct log_archive_policy *p) {
+	return p->compress || p->keep_bytes || p->keep_age > 0;
+}
+static struct log_archive_item *item_new(const char *path) {
+	size_t len = strlen(path);
+	struct log_archive_item *item = malloc(sizeof(*item) + len + 1);
+	if (!item) return NULL;
+	memcpy(item->path, path, len + 1);
+	item->mtime = 0;
+	item->size = 0;
+	return item;
+}
+#ifdef HAVE_ZLIB
+static int gzip_file(const char *src, const char *dst) {
+	char buf[LOG_ARCHIVE_BUFLEN], tmp[PATH_MAX];
+	gzFile gz;
+	ssize_t n;
+	int fd, ret = 0;
+
+	fd = open(src, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return -1;
+	snprintf(tmp, sizeof(tmp), "%s.tmp", dst);
+	gz = gzopen(tmp, "wb6");
+	if (!gz) {
+		close(fd);
+		return -1;
+	}
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		if (gzwrite(gz, buf, n) != n) {
+			ret = -1;
+			break;
+		}
+	}
+	if (n < 0) ret = -1;
+	/* the log is not going to be read again, keep it out of the page cache */
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+	if (gzclose(gz) != Z_OK) ret = -1;
+	if (!ret) ret = rename(tmp, dst);
+	if (ret) unlink(tmp);
+	else unlink(src);
+	return ret;
+}
+#else
+/* gzip replaces src with src.gz; it inherits the worker's priorities but
+ * not its blocked signals. Returns -2 if gzip cannot be run at all. */
+static int gzip_file(const char *src, const char *dst) {
+	char *argv[] = { "gzip", "-6", "-f", "--", (char *)src, NULL };
+	posix_spawnattr_t attr;
+	sigset_t none;
+	pid_t pid;
+	int status, ret;
+	sigemptyset(&none);
+	if (posix_spawnattr_init(&attr) != 0) return -1;
+	posix_spawnattr_setsigmask(&attr, &none);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+	ret = posix_spawnp(&pid, "gzip", NULL, &attr, argv, environ);
+	posix_spawnattr_destroy(&attr);
+	if (ret != 0) return -2;
+	while (waitpid(pid, &status, 0) < 0)
+		if (errno != EINTR) return -1;
+	/* 127: the shell convention for a command that was not found */
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 127) return -2;
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+#endif
+/* compress if configured, then record the file in the retained list */
+static void archive(struct log_archive *a, struct log_archive_item *item) {
+	struct log_archive_item *gz;
+	struct stat st;
+	int ret;
+	if (a->policy.compress) {
+		gz = malloc(sizeof(*gz) + strlen(item->path) + 4);
+		if (gz) {
+			sprintf(gz->path, "%s.gz", item->path);
+			ret = gzip_file(item->path, gz->path);
+			if (ret == 0) {
+				free(item);
+				item = gz;
+			} else if (ret == -2) {
+				/* no gzip: keep pruning, leave this and later files as they are */
+				fprintf(stderr, "cannot run gzip, rotated logs are kept uncompressed\n");
+				a->policy.compress = 0;
+				free(gz);
+			} else {
+				fprintf(stderr, "cannot compress log `%s'\n", item->path);
+				free(gz);
+			}
+		}
+	}
+	if (stat(item->path, &st) < 0) {
+		free(item);
+		return;
+	}
+	item->mtime = st.st_mtime;
+	item->size = st.st_size;
+	list_add_tail(&item->list, &a->retained);
+	a->retained_bytes += item->size;
+}
+static void prune(struct log_archive *a) {
+	struct list_head *pos, *n;
+	struct log_archive_item *item;
+	time_t now = time(NULL);
+	list_for_each_safe(pos, n, &a->retained) {
+		item = list_entry(pos, struct log_archive_item, list);
+		if (!((a->policy.keep_bytes && a->retained_bytes > a->policy.keep_bytes) ||
+			  (a->policy.keep_age > 0 && item->mtime < now - a->policy.keep_age)))
+			break;
+		if (unlink(item->path) < 0 && errno != ENOENT)
+			fprintf(stderr, "cannot remove log `%s':%s\n", item->path, strerror(errno));
+		list_del(pos);
+		a->retained_bytes -= item->size;
+		free(item);
+	}
+}
+static int item_cmp(const void *x, const void *y) {
+	const struct log_archive_item *a = *(struct log_archive_item *const *)x;
+	const struct log_archive_item *b = *(struct log_archive_item *const *)y;
+	return a->mtime < b->mtime ? -1 : a->mtime > b->mtime;
+}
+/* YYYY-MM-DD[_hh[:mm:ss]].<level> with the time part before first_name:
+ * a file an earlier run rotated away from without compressing it */
+static int earlier_rotated(const struct log_archive *a, const char *name) {
+	const char *dot = strrchr(name, '.'), *p;
+	size_t time_len, first_len = strlen(a->first_name), i;
+	int cmp;
+	if (!dot || dot - name < 10 || name[4] != '-' || name[7] != '-') return 0;
+	for (i = 0; i < 10; i++)
+		if (i != 4 && i != 7 && (name[i] < '0' || name[i] > '9')) return 0;
+	/* the level; rules out .gz, .tmp and the binary log's .NNN.blog */
+	if (!dot[1]) return 0;
+	for (p = dot + 1; *p; p++)
+		if (*p < 'a' || *p > 'z') return 0;
+	if (!strcmp(dot, ".gz") || !strcmp(dot, ".tmp") || !strcmp(dot, ".blog")) return 0;
+	for (p = name; p < dot; p++)
+		if (*p == '.') return 0;
+	/* a shorter time part is the start of a longer one, it sorts first */
+	time_len = dot - name;
+	cmp = strncmp(name, a->first_name, time_len < first_len ? time_len : first_len);
+	return cmp < 0 || (cmp == 0 && time_len < first_len);
+}
+/* archives and uncompressed rotated files left by earlier runs, oldest
+ * first */
+static void scan(struct log_archive *a) {
+	struct log_archive_item **items = NULL, **tmp;
+	size_t count = 0, cap = 0, base_len = strlen(a->base), len, i;
+	char path[PATH_MAX];
+	struct dirent *de;
+	struct stat st;
+	DIR *dir = opendir(a->dir);
+	if (!dir) return;
+	while ((de = readdir(dir))) {
+		len = strlen(de->d_name);
+		if (len < base_len + 3 || strncmp(de->d_name, a->base, base_len) ||
+			(strcmp(de->d_name + len - 3, ".gz") && !earlier_rotated(a, de->d_name + base_len)))
+			continue;
+		snprintf(path, sizeof(path), "%s%s", a->dir, de->d_name);
+		if (stat(path, &st) < 0 || !S_ISREG(st.st_mode)) continue;
+		if (count == cap) {
+			tmp = realloc(items, (cap = cap ? cap * 2 : 64) * sizeof(*items));
+			if (!tmp) break;
+			items = tmp;
+		}
+		if (!(items[count] = item_new(path))) break;
+		items[count]->mtime = st.st_mtime;
+		items[count]->size = st.st_size;
+		count++;
+	}
+	closedir(dir);
+	qsort(items, count, sizeof(*items), item_cmp);
+	for (i = 0; i < count; ++i) {
+		list_add_tail(&items[i]->list, &a->retained);
+		a->retained_bytes += items[i]->size;
+	}
+	free(items);
+}
+static void *log_archive_worker(void *arg) {
+	struct log_archive *a = arg;
+	struct list_head batch, *pos, *n;
+	struct timespec outtime;
+	int exiting = 0;
+
+	/* compression must never compete with the send path, for CPU or disk */
+	setpriority(PRIO_PROCESS, 0, 19);
+	syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+	scan(a);
+	prune(a);
+	while (!exiting) {
+		INIT_LIST_HEAD(&batch);
+		pthread_mutex_lock(&a->lock);
+		if (list_empty(&a->pending) && !a->exit) {
+			clock_gettime(CLOCK_REALTIME, &outtime);
+			outtime.tv_sec += LOG_ARCHIVE_IDLE_WAIT_SEC;
+			pthread_cond_timedwait(&a->cond, &a->lock, &outtime);
+		}
+		exiting = a->exit;
+		list_splice_init(&a->pending, &batch);
+		pthread_mutex_unlock(&a->lock);
+
+		list_for_each_safe(pos, n, &batch) {
+			list_del(pos);
+			archive(a, list_entry(pos, struct log_archive_item, list));
+		}
+		prune(a);
+	}
+	return NULL;
+}
+/* ------------------------------------------------------------------------- */
+int log_archive_start(struct log_archive *a, const char *prefix, const char *first_name,
+					  const struct log_archive_policy *policy) {
+	const char *slash = strrchr(prefix, '/');
+	memset(a, 0, sizeof(*a));
+	a->policy = *policy;
+	snprintf(a->first_name, sizeof(a->first_name), "%s", first_name);
+	if (slash) {
+		snprintf(a->dir, sizeof(a->dir), "%.*s", (int)(slash + 1 - prefix), prefix);
+		snprintf(a->base, sizeof(a->base), "%s", slash + 1);
+	} else {
+		snprintf(a->dir, sizeof(a->dir), "./");
+		snprintf(a->base, sizeof(a->base), "%s", prefix);
+	}
+	INIT_LIST_HEAD(&a->pending);
+	INIT_LIST_HEAD(&a->retained);
+	pthread_mutex_init(&a->lock, NULL);
+	pthread_cond_init(&a->cond, NULL);
+	if (pthread_create(&a->tid, NULL, log_archive_worker, a) != 0) {
+		pthread_mutex_destroy(&a->lock);
+		pthread_cond_destroy(&a->cond);
+		return -1;
+	}
+	return 0;
+}
+void log_archive_add(struct log_archive *a, const char *path) {
+	struct log_archive_item *item = item_new(path);
+	if (!item) return;
+	pthread_mutex_lock(&a->lock);
+	list_add_tail(&item->list, &a->pending);
+	pthread_cond_signal(&a->cond);
+	pthread_mutex_unlock(&a->lock);
+}
+void log_archive_stop(struct log_archive *a) {
+	struct list_head *pos, *n;
+	pthread_mutex_lock(&a->lock);
+	a->exit = 1;
+	pthread_cond_signal(&a->cond);
+	pthread_mutex_unlock(&a->lock);
+	pthread_join(a->tid, NULL);
+	list_for_each_safe(pos, n, &a->retained) {
+		list_del(pos);
+		free(list_entry(pos, struct log_archive_item, list));
+	}
+	pthread_mutex_destroy(&a->lock);
+	pthread_cond_destroy(&a->cond);
+}
@@ -0,0 +1,66 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+*
+* This file is part of udpproxy.
+*
+* udpproxy is free software; you can redistribute it and/or
+        * modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+        * version 2.1 of the License, or (at your option) any later version.
+*
+* udpproxy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#ifndef __LOGARCHIVE_H__
+#define __LOGARCHIVE_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include "list.h"
+
+/* Background compression and pruning of rotated log files.
+ *
+ * The logger hands every file it rotates away from to log_archive_add(),
+ * which only appends to a pending list. A worker thread running at nice
+ * 19 and idle I/O priority gzips it (through zlib when built with
+ * HAVE_ZLIB, otherwise by running gzip) and then prunes: the oldest
+ * archives go once their total exceeds keep_bytes or they are older than
+ * keep_age (0 disables a limit). Archives of earlier runs, <prefix>*.gz,
+ * and their rotated files left uncompressed, <prefix><time>.<level>, are
+ * picked up at start; uncompressed files named at or after first_name
+ * (the time part of the first file this run's logger opens) are the
+ * logger's and come through log_archive_add(). log_archive_stop()
+ * finishes the pending files first. */
+struct log_archive_policy {
+	int compress;                 /* gzip rotated files */
+	uint64_t keep_bytes;          /* keep at most N bytes of rotated files */
+	int64_t keep_age;             /* keep rotated files newer than N seconds */
+};
+
+struct log_archive {
+	struct log_archive_policy policy;
+	char dir[1024];
+	char base[256];               /* file name part of the logger prefix */
+	char first_name[32];          /* uncompressed files from here on are the logger's */
+	int exit;
+	pthread_t tid;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct list_head pending;     /* handed over by the logger, protected by lock */
+	struct list_head retained;    /* owned by the worker, oldest first */
+	uint64_t retained_bytes;
+};
+
+/* returns 1 if the policy needs a worker at all */
+int log_archive_policy_enabled(const struct log_archive_policy *);
+int log_archive_start(struct log_archive *, const char *prefix, const char *first_name,
+					  const struct log_archive_policy *);
+/* path of a log file that will not be written again */
+void log_archive_add(struct log_archive *, const char *path);
+void log_archive_stop(struct log_archive *);
+#endif
@@ -0,0 +1,311 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+/* Offline decoder for the binary log (binlog.h).
+ *
+ *     udpproxy-logcat [-j] [-l level] file.blog...
+ *
+ * Renders every record as the text logger would have written it,
+ * "[level] [datetime] [tid] [file:line]\tmessage", or with -j as one JSON
+ * object per line. -l skips records below the given level. A record that
+ * was reserved but never completed (crash) is skipped, the file ends at
+ * the first empty record. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "binlog.h"
+/* ------------------------------------------------------------------------- */
+#define MSG_LEN 8192
+
+/* same order as the levels in logger.c */
+static const char *level_str[] = {
+	"debug", "user", "info", "warning", "error", "fatal",
+};
+#define LEVEL_MAX ((int)(sizeof(level_str) / sizeof(level_str[0])))
+
+struct site {
+	char *file;
+	char *fmt;
+	unsigned int line;
+	int level;
+};
+static struct site *sites;
+static unsigned int nsites;
+static int json, min_level;
+
+static void sites_reset(void) {
+	unsigned int i;
+	for (i = 0; i < nsites; ++i) {
+		free(sites[i].file);
+		free(sites[i].fmt);
+	}
+	free(sites);
+	sites = NULL;
+	nsites = 0;
+}
+static void site_define(const char *rec, uint32_t size) {
+	struct binlog_def def;
+	struct site *s;
+	memcpy(&def, rec, sizeof(def));
+	if (sizeof(def) + def.file_len + def.fmt_len > size) return;
+	if (def.hdr.id >= nsites) {
+		s = realloc(sites, (def.hdr.id + 64) * sizeof(*s));
+		if (!s) return;
+		memset(s + nsites, 0, (def.hdr.id + 64 - nsites) * sizeof(*s));
+		sites = s;
+		nsites = def.hdr.id + 64;
+	}
+	s = &sites[def.hdr.id];
+	free(s->file);
+	free(s->fmt);
+	s->file = strndup(rec + sizeof(def), def.file_len);
+	s->fmt = strndup(rec + sizeof(def) + def.file_len, def.fmt_len);
+	s->line = def.line;
+	s->level = def.hdr.level;
+}
+/* ------------------------------------------------------------------------- */
+/* the conversion with its length modifier replaced by what the stored
+ * argument is passed as */
+static void conv_spec(char *spec, const struct binlog_conv *c) {
+	int i, n = 0;
+	for (i = 0; i < c->len - 1; ++i) {
+		if (c->type != BINLOG_ARG_INT && strchr("hlLqjzt", c->start[i])) continue;
+		spec[n++] = c->start[i];
+	}
+	if (c->type == BINLOG_ARG_LONG) {
+		spec[n++] = 'l';
+		spec[n++] = 'l';
+	}
+	spec[n++] = c->start[c->len - 1];
+	spec[n] = '\0';
+}
+#define EMIT(v) (c->stars == 2 ? snprintf(o, room, spec, st[0], st[1], v) : \
+				 c->stars == 1 ? snprintf(o, room, spec, st[0], v) : \
+				 snprintf(o, room, spec, v))
+/* format with the arguments in [p, end) into out, returns the length */
+static int render(char *out, int size, const char *fmt, const char *p, const char *end) {
+	struct binlog_conv conv[BINLOG_MAX_ARGS], *c;
+	char spec[64], str[BINLOG_RECORD_MAX], *o;
+	const char *lit = fmt;
+	int n, i, j, k, len = 0, room, st[2];
+	union { int i; long long l; double d; void *p; } v;
+	uint16_t n16;
+
+	n = binlog_parse_format(fmt, conv, BINLOG_MAX_ARGS);
+	if (n < 0) n = 0; /* logged without arguments */
+	for (i = 0; i < n && len < size - 1; ++i) {
+		c = &conv[i];
+		k = c->start - lit;
+		if (k > size - 1 - len) k = size - 1 - len;
+		memcpy(out + len, lit, k);
+		len += k;
+		lit = c->start + c->len;
+		if ((int)sizeof(spec) < c->len + 3) continue;
+		for (j = 0; j < c->stars; ++j) {
+			if (end - p < 4) goto truncated;
+			memcpy(&st[j], p, 4);
+			p += 4;
+		}
+		conv_spec(spec, c);
+		o = out + len;
+		room = size - len;
+		switch (c->type) {
+		case BINLOG_ARG_NONE:
+			k = snprintf(o, room, "%s", strcmp(spec, "%%") ? "" : "%");
+			break;
+		case BINLOG_ARG_INT:
+			if (end - p < 4) goto truncated;
+			memcpy(&v.i, p, 4);
+			p += 4;
+			k = EMIT(v.i);
+			break;
+		case BINLOG_ARG_LONG:
+			if (end - p < 8) goto truncated;
+			memcpy(&v.l, p, 8);
+			p += 8;
+			k = EMIT(v.l);
+			break;
+		case BINLOG_ARG_DOUBLE:
+			if (end - p < 8) goto truncated;
+			memcpy(&v.d, p, 8);
+			p += 8;
+			k = EMIT(v.d);
+			break;
+		case BINLOG_ARG_PTR:
+			if (end - p < 8) goto truncated;
+			memcpy(&v.p, p, 8);
+			p += 8;
+			k = c->start[c->len - 1] == 'n' ? 0 : EMIT(v.p);
+			break;
+		case BINLOG_ARG_STR:
+			if (end - p < 2) goto truncated;
+			memcpy(&n16, p, 2);
+			p += 2;
+			if (n16 == 0xffff) {
+				strcpy(str, "(null)");
+			} else {
+				if (end - p < n16) goto truncated;
+				memcpy(str, p, n16);
+				str[n16] = '\0';
+				p += n16;
+			}
+			k = EMIT(str);
+			break;
+		default:
+			k = 0;
+			break;
+		}
+		len += k < room ? k : room - 1;
+	}
+	k = strlen(lit);
+	if (k > size - 1 - len) k = size - 1 - len;
+	memcpy(out + len, lit, k);
+	len += k;
+	out[len] = '\0';
+	return len;
+truncated:
+	len += snprintf(out + len, size - len, "<truncated record>");
+	return len < size ? len : size - 1;
+}
+/* ------------------------------------------------------------------------- */
+static void json_str(const char *s) {
+	putchar('"');
+	for (; *s; ++s) {
+		unsigned char ch = *s;
+		if (ch == '"' || ch == '\\') printf("\\%c", ch);
+		else if (ch == '\n') fputs("\\n", stdout);
+		else if (ch == '\t') fputs("\\t", stdout);
+		else if (ch < 0x20) printf("\\u%04x", ch);
+		else putchar(ch);
+	}
+	putchar('"');
+}
+static void print_event(const char *rec, uint32_t size) {
+	struct binlog_event ev;
+	const struct site *s;
+	char msg[MSG_LEN], datetime[32];
+	struct tm tm;
+	time_t sec;
+	int n;
+
+	memcpy(&ev, rec, sizeof(ev));
+	if (ev.hdr.level >= LEVEL_MAX || ev.hdr.level < min_level) return;
+	s = ev.hdr.id < nsites && sites[ev.hdr.id].fmt ? &sites[ev.hdr.id] : NULL;
+	if (s)
+		render(msg, sizeof(msg), s->fmt, rec + sizeof(ev), rec + size);
+	else
+		snprintf(msg, sizeof(msg), "<undefined format id %u>", ev.hdr.id);
+	sec = ev.ns / 1000000000;
+	localtime_r(&sec, &tm);
+	n = strftime(datetime, sizeof(datetime), "%F_%T", &tm);
+	snprintf(datetime + n, sizeof(datetime) - n, ".%06ld",
+			 (long)(ev.ns % 1000000000 / 1000));
+	if (json) {
+		printf("{\"time\":\"%s\",\"ns\":%lld,\"level\":\"%s\",\"tid\":%u,\"file\":",
+			   datetime, (long long)ev.ns, level_str[ev.hdr.level], ev.tid);
+		json_str(s ? s->file : "");
+		printf(",\"line\":%u,\"msg\":", s ? s->line : 0);
+		json_str(msg);
+		fputs("}\n", stdout);
+	} else {
+		printf("[%s] [%s] [%u] [%s:%u]\t%s\n", level_str[ev.hdr.level], datetime,
+			   ev.tid, s ? s->file : "?", s ? s->line : 0, msg);
+	}
+}
+static int decode(const char *path) {
+	struct binlog_file_header hdr;
+	struct binlog_record rec;
+	struct stat st;
+	const char *map;
+	uint64_t off;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	if ((size_t)st.st_size < sizeof(hdr)) {
+		fprintf(stderr, "%s: not a binary log\n", path);
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	memcpy(&hdr, map, sizeof(hdr));
+	if (memcmp(hdr.magic, BINLOG_MAGIC, sizeof(hdr.magic)) || hdr.version != BINLOG_VERSION) {
+		fprintf(stderr, "%s: not a binary log of version %d\n", path, BINLOG_VERSION);
+		munmap((void *)map, st.st_size);
+		return -1;
+	}
+	sites_reset();
+	for (off = (hdr.header_size + 7) & ~7U; off + sizeof(rec) <= (uint64_t)st.st_size;
+		 off += rec.size) {
+		memcpy(&rec, map + off, sizeof(rec));
+		if (!rec.size) break;
+		if (rec.size < sizeof(rec) || off + rec.size > (uint64_t)st.st_size) {
+			fprintf(stderr, "%s: corrupt record at offset %llu\n", path,
+					(unsigned long long)off);
+			break;
+		}
+		if (rec.type == BINLOG_DEF && rec.size >= sizeof(struct binlog_def))
+			site_define(map + off, rec.size);
+		else if (rec.type == BINLOG_EVENT && rec.size >= sizeof(struct binlog_event))
+			print_event(map + off, rec.size);
+	}
+	munmap((void *)map, st.st_size);
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+int main(int argc, char **argv) {
+	int c, i, ret = 0;
+	while ((c = getopt(argc, argv, "jl:")) != -1) {
+		switch (c) {
+		case 'j': json = 1; break;
+		case 'l':
+			for (min_level = 0; min_level < LEVEL_MAX; ++min_level)
+				if (!strcmp(optarg, level_str[min_level])) break;
+			if (min_level < LEVEL_MAX) break;
+			/* fall through */
+		default:
+			argc = 0;
+			break;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "usage: %s [-j] [-l debug|user|info|warning|error|fatal] "
+				"file.blog...\n", argv[0]);
+		return 1;
+	}
+	for (i = optind; i < argc; ++i)
+		if (decode(argv[i]) < 0) ret = 1;
+	sites_reset();
+	return ret;
+}
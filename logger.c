@@ -21,27 +21,22 @@
 #include <string.h>
 #include <stdarg.h>
 #include <time.h>
-#include <sys/time.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <pthread.h>
 #include "logger.h"
+#include "binlog.h"
+#include "logarchive.h"
 /* ------------------------------------------------------------------------- */
-#define LOG_LEVEL_DEBUG 0
-#define LOG_LEVEL_USER 1
-#define LOG_LEVEL_INFO 2
-#define LOG_LEVEL_WARNING 3
-#define LOG_LEVEL_ERROR 4
-#define LOG_LEVEL_FATAL 5
-#define LOG_LEVEL_MAX 6
 static const char *log_level_str[] = {
 	"debug", "user", "info", "warning", "error", "fatal",
 };
-/* fields of logging timestamp */
-struct log_tm {
-	unsigned short tm_year;
-	unsigned short tm_mon;
-	unsigned short tm_mday;
-	unsigned short tm_hour;
-} __attribute__((packed));
 /* log filename may be one of the following forms:
 * - <prefix>YYYY-MM-DD.<level>
 * - <prefix>YYYY-MM-DD_hh.<level>
@@ -54,96 +49,408 @@ struct log_tm {
 #define PATH_BUFLEN 1024
 #define PATH_PREFIX_BUFLEN (PATH_BUFLEN \
 - sizeof(unsigned long) \
-- sizeof(void*) - sizeof(void*))
+- sizeof(void*) - sizeof(void*) - sizeof(void*))
+#define LOG_TIME_MAX ((time_t)LONG_MAX)
 /* variables that will be initialized in logger_init() */
 struct logger_var {
-	unsigned long max_file_size;
-	int (*rotate_trigger)(const struct tm *current, const struct log_tm *old,
-						  unsigned long max_file_size, unsigned long filesize);
+	unsigned long max_file_size; /* ULONG_MAX: no size limit */
+	/* first second a file opened at ts must not be written after */
+	time_t (*next_deadline)(const struct tm *ts);
 	void (*get_filename)(char *buf, int level, const struct tm *ts);
+	struct log_archive *archive; /* takes the files rotated away from */
 	char path_prefix[PATH_PREFIX_BUFLEN];
 } __attribute__((packed));
 #define MAX_LOG_LEN (4096 \
-- sizeof(FILE*) \
-- sizeof(struct log_tm) \
+- sizeof(int) \
+- sizeof(char*) \
+- sizeof(time_t) \
 - sizeof(unsigned int) \
 - sizeof(unsigned long) \
 - sizeof(pthread_mutex_t))
 /* sizeof(logger_info) == 4096 */
 struct logger_info {
-	FILE *fp;
-	struct log_tm ts; /* timestamp of last write */
+	int fd;           /* O_APPEND, or stdout/stderr */
+	char *path;       /* of fd, NULL for stdout/stderr */
+	time_t deadline;  /* rotate once a line is stamped at or after this */
 	unsigned int level;
 	unsigned long filesize;
 	pthread_mutex_t lock;
 	char buf[MAX_LOG_LEN];
 } __attribute__((packed));
+/* asynchronous mode: a caller formats the complete line into a slot of
+ * a bounded multi-producer ring, claimed with one CAS, and a writer
+ * thread hands runs of records of the same level to writev(). When the
+ * ring is full records below warning are dropped and counted, warning
+ * and above wait for the writer. */
+#define ASYNC_RECORD_SIZE 1024
+#define ASYNC_DEFAULT_RECORDS 4096
+#define ASYNC_BATCH 64             /* iovecs per writev() */
+/* an idle writer is woken for warnings and above or once the ring is
+ * 1/ASYNC_WAKE_FRACTION full, otherwise it looks again after
+ * ASYNC_IDLE_WAIT_MS; this keeps the futex syscall off most lines */
+#define ASYNC_IDLE_WAIT_MS 10
+#define ASYNC_WAKE_FRACTION 8
+struct log_record {
+	unsigned long seq;         /* == position + 1 once published */
+	unsigned int level;
+	unsigned int len;
+	time_t sec;
+	char line[ASYNC_RECORD_SIZE - sizeof(unsigned long) - 2 * sizeof(unsigned int)
+			  - sizeof(time_t)];
+};
+struct log_async {
+	struct log_record *ring;
+	unsigned long mask;
+	unsigned long head __attribute__((aligned(64))); /* next slot to claim */
+	unsigned long tail __attribute__((aligned(64))); /* next slot to write, writer only */
+	unsigned long dropped;
+	uint32_t futex;
+	uint32_t sleeping;
+	int exit;
+	pthread_t tid;
+};
 struct logger_impl {
 	struct logger_var var;
 	struct logger_info o_o[LOG_LEVEL_MAX];
+	struct log_async *async;   /* NULL: every call writes synchronously */
+	struct binlog *binlog;     /* set: records go to the binary log only */
+	time_t start;              /* logger_init(), no file of this run is named earlier */
 };
 
 /* ------------------------------------------------------------------------- */
-static void __new_log_level_file(struct logger_info *logger,
-								 struct logger_var *var,
-								 const struct tm *ts) {
-	int len;
-	char path[PATH_BUFLEN];
-	logger->filesize = 0;
-	if (logger->fp && logger->fp != stdout && logger->fp != stderr) fclose(logger->fp);
+/* Per thread cache of the formatted time: localtime_r() and strftime()
+ * run once a second, other lines only patch the microseconds. The clock
+ * is read through the vDSO. */
+#define DATETIME_LEN 26 /* YYYY-MM-DD_hh:mm:ss.uuuuuu */
+struct datetime_cache {
+	time_t sec;
+	struct tm tm;
+	char str[DATETIME_LEN + 1];
+};
+static __thread struct datetime_cache tls_datetime = { .sec = -1 };
+static __thread unsigned long tls_tid;
+
+static inline const char *current_datetime(time_t *sec) {
+	struct datetime_cache *c = &tls_datetime;
+	struct timespec ts;
+	long usec;
+	int i;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	if (ts.tv_sec != c->sec) {
+		c->sec = ts.tv_sec;
+		localtime_r(&ts.tv_sec, &c->tm);
+		strftime(c->str, sizeof(c->str), "%F_%T.", &c->tm);
+	}
+	usec = ts.tv_nsec / 1000;
+	for (i = DATETIME_LEN - 1; i > DATETIME_LEN - 7; --i, usec /= 10)
+		c->str[i] = '0' + usec % 10;
+	c->str[DATETIME_LEN] = '\0';
+	*sec = c->sec;
+	return c->str;
+}
+static inline unsigned long current_tid(void) {
+	if (!tls_tid) tls_tid = syscall(__NR_gettid);
+	return tls_tid;
+}
+static inline char *put_str(char *p, const char *end, const char *s, size_t len) {
+	if (len > (size_t)(end - p)) len = end - p;
+	memcpy(p, s, len);
+	return p + len;
+}
+static inline char *put_uint(char *p, const char *end, unsigned long v) {
+	char tmp[20];
+	int i = 0;
+	do tmp[i++] = '0' + v % 10; while (v /= 10);
+	while (i && p < end) *p++ = tmp[--i];
+	return p;
+}
+/* "[level] [datetime] [tid] [file:line]\t" without going through printf,
+ * returns its length (cut at size) */
+static int format_header(char *buf, int size, int level,
+						 const char *filename, int line, time_t *sec) {
+	char *p = buf, *end = buf + size;
+	p = put_str(p, end, "[", 1);
+	p = put_str(p, end, log_level_str[level], strlen(log_level_str[level]));
+	p = put_str(p, end, "] [", 3);
+	p = put_str(p, end, current_datetime(sec), DATETIME_LEN);
+	p = put_str(p, end, "] [", 3);
+	p = put_uint(p, end, current_tid());
+	p = put_str(p, end, "] [", 3);
+	p = put_str(p, end, filename, strlen(filename));
+	p = put_str(p, end, ":", 1);
+	p = put_uint(p, end, line);
+	p = put_str(p, end, "]\t", 2);
+	return p - buf;
+}
+/* header, message and newline into buf; the message is cut so the
+ * newline always fits */
+static int format_line(char *buf, int size, int level, const char *filename,
+					   int line, time_t *sec, const char *fmt, va_list args) {
+	int n = format_header(buf, size - 1, level, filename, line, sec);
+	if (n < size - 1) {
+		n += vsnprintf(buf + n, size - 1 - n, fmt, args);
+		if (n > size - 2) n = size - 2; /* truncated */
+	}
+	buf[n++] = '\n';
+	return n;
+}
+/* the whole rotation check of a line: the deadline and the size limit
+ * are fixed when a file is opened */
+static inline int rotate_due(const struct logger_info *logger,
+							 const struct logger_var *var,
+							 time_t sec, unsigned long pending) {
+	return __builtin_expect(sec >= logger->deadline ||
+							logger->filesize + pending >= var->max_file_size, 0);
+}
+/* open the file for lines stamped sec into path, falls back to
+ * stdout/stderr; touches no state of the logger */
+static int rotate_open(const struct logger_info *logger,
+					   const struct logger_var *var,
+					   time_t sec, char *path, struct tm *tm) {
+	int len, fd;
+	localtime_r(&sec, tm);
 	len = sprintf(path, "%s", var->path_prefix);
-	var->get_filename(path + len, logger->level, ts);
-	logger->fp = fopen(path, "a+");
-	if (!logger->fp) {
+	var->get_filename(path + len, logger->level, tm);
+	fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0) {
 		fprintf(stderr, "cannot create/open file `%s', "
 				"log content of level [%s] is redirected to %s.\n",
 				path, log_level_str[logger->level],
 				(logger->level <= LOG_LEVEL_INFO) ? "stdout" : "stderr");
-		logger->fp = (logger->level <= LOG_LEVEL_INFO) ? stdout : stderr;
+		fd = (logger->level <= LOG_LEVEL_INFO) ? STDOUT_FILENO : STDERR_FILENO;
 	}
+	return fd;
+}
+/* make fd the file of logger; its previous fd and path are returned to
+ * be released by rotate_release() */
+static void rotate_install(struct logger_info *logger, const struct logger_var *var,
+						   int fd, const char *path, const struct tm *tm,
+						   int *old_fd, char **old_path) {
+	*old_fd = logger->fd;
+	*old_path = logger->path;
+	logger->path = fd > STDERR_FILENO ? strdup(path) : NULL;
+	logger->fd = fd;
+	/* counted from 0 even when appending: size rotations within one
+	 * second share a name */
+	logger->filesize = 0;
+	logger->deadline = var->next_deadline(tm);
+}
+static void rotate_release(const struct logger_var *var, int old_fd,
+						   char *old_path, const char *path) {
+	if (old_fd > STDERR_FILENO) close(old_fd);
+	/* size rotations within one second reopen the same file */
+	if (old_path && var->archive && strcmp(old_path, path))
+		log_archive_add(var->archive, old_path);
+	free(old_path);
+}
+/* the asynchronous writer is the only one using its loggers and rotates
+ * in place; kept out of line, it runs once per file */
+static void __attribute__((noinline, cold))
+rotate(struct logger_info *logger, struct logger_var *var, time_t sec) {
+	char path[PATH_BUFLEN], *old_path;
+	struct tm tm;
+	int fd, old_fd;
+	fd = rotate_open(logger, var, sec, path, &tm);
+	rotate_install(logger, var, fd, path, &tm, &old_fd, &old_path);
+	rotate_release(var, old_fd, old_path, path);
+}
+/* synchronous mode: called with the lock held and the line stamped sec
+ * in logger->buf. The line is copied and the lock dropped while the new
+ * file is opened, so the other threads logging at this level only wait
+ * for the swap of the fd, not for open() and close(); their lines go to
+ * the old file until then. Another thread may have rotated meanwhile,
+ * then the file opened here is closed again. Returns with the lock
+ * released. */
+static void __attribute__((noinline, cold))
+rotate_and_write(struct logger_info *logger, struct logger_var *var,
+				 time_t sec, int n) {
+	char line[MAX_LOG_LEN], path[PATH_BUFLEN], *old_path = NULL;
+	struct tm tm;
+	int fd, old_fd;
+	memcpy(line, logger->buf, n);
+	pthread_mutex_unlock(&logger->lock);
+	fd = rotate_open(logger, var, sec, path, &tm);
+	pthread_mutex_lock(&logger->lock);
+	if (rotate_due(logger, var, sec, 0))
+		rotate_install(logger, var, fd, path, &tm, &old_fd, &old_path);
+	else
+		old_fd = fd;
+	if (write(logger->fd, line, n) == n) logger->filesize += n;
+	pthread_mutex_unlock(&logger->lock);
+	rotate_release(var, old_fd, old_path, path);
 }
-/* time format: YYYY-MM-DD hh:mm:ss.uuuuuu
-* size >= 27 */
-static inline void current_datetime(char *buf, int size, struct tm *tp) {
-	int len;
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
-	localtime_r(&tv.tv_sec, tp);
-	len = strftime(buf, size, "%F_%T", tp);
-	sprintf(buf + len, ".%06ld", tv.tv_usec);
-}
-#include <unistd.h>
-#include <sys/syscall.h>
 static void generic_logger(struct logger_info *logger,
 						   struct logger_var *var,
 						   const char *filename, int line, /* extra info */
 						   const char *fmt, va_list args) {
-	struct tm tm;
-	char timestr[32];
+	time_t sec;
+	int n;
 	pthread_mutex_lock(&logger->lock);
-	current_datetime(timestr, 32, &tm);
-	if (var->rotate_trigger(&tm, &logger->ts, var->max_file_size,
-							logger->filesize)) {
-		__new_log_level_file(logger, var, &tm);
-		logger->ts.tm_hour = tm.tm_hour;
-		logger->ts.tm_mday = tm.tm_mday;
-		logger->ts.tm_mon = tm.tm_mon;
-		logger->ts.tm_year = tm.tm_year;
+	n = format_line(logger->buf, MAX_LOG_LEN, logger->level, filename, line,
+					&sec, fmt, args);
+	if (rotate_due(logger, var, sec, 0)) {
+		rotate_and_write(logger, var, sec, n);
+		return;
 	}
-	vsnprintf(logger->buf, MAX_LOG_LEN, fmt, args);
-	logger->filesize += fprintf(logger->fp, "[%s] [%s] [%lu] [%s:%u]\t%s\n",
-								log_level_str[logger->level], timestr,
-								syscall(__NR_gettid), filename, line,
-								logger->buf);
-	fflush(logger->fp); /* flush cache to disk */
+	if (write(logger->fd, logger->buf, n) == n) logger->filesize += n;
 	pthread_mutex_unlock(&logger->lock);
 }
+/* ------------------------------------------------------------------------- */
+static void futex_wait(uint32_t *addr, uint32_t val, int timeout_ms) {
+	struct timespec ts;
+	ts.tv_sec = timeout_ms / 1000;
+	ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, &ts, NULL, 0);
+}
+static void async_wake(struct log_async *a) {
+	if (!__atomic_load_n(&a->sleeping, __ATOMIC_SEQ_CST)) return;
+	__atomic_add_fetch(&a->futex, 1, __ATOMIC_SEQ_CST);
+	syscall(SYS_futex, &a->futex, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+/* claim a slot, NULL if the record is dropped */
+static struct log_record *async_claim(struct log_async *a, int level,
+									  unsigned long *pos) {
+	struct log_record *rec;
+	unsigned long p = __atomic_load_n(&a->head, __ATOMIC_RELAXED);
+	long diff;
+	for (;;) {
+		rec = &a->ring[p & a->mask];
+		diff = (long)(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) - p);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&a->head, &p, p + 1, 1,
+											__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			/* full: the slot still holds the record of the previous lap */
+			if (level < LOG_LEVEL_WARNING) {
+				__atomic_add_fetch(&a->dropped, 1, __ATOMIC_RELAXED);
+				return NULL;
+			}
+			async_wake(a);
+			sched_yield();
+			p = __atomic_load_n(&a->head, __ATOMIC_RELAXED);
+		} else {
+			p = __atomic_load_n(&a->head, __ATOMIC_RELAXED);
+		}
+	}
+	*pos = p;
+	return rec;
+}
+static void async_logger(struct log_async *a, int level,
+						 const char *filename, int line,
+						 const char *fmt, va_list args) {
+	struct log_record *rec;
+	unsigned long pos;
+
+	rec = async_claim(a, level, &pos);
+	if (!rec) return;
+	rec->len = format_line(rec->line, sizeof(rec->line), level, filename, line,
+						   &rec->sec, fmt, args);
+	rec->level = level;
+	__atomic_store_n(&rec->seq, pos + 1, __ATOMIC_SEQ_CST);
+	if (level >= LOG_LEVEL_WARNING ||
+		pos - __atomic_load_n(&a->tail, __ATOMIC_RELAXED) >= (a->mask + 1) / ASYNC_WAKE_FRACTION)
+		async_wake(a);
+}
+static void write_all(int fd, struct iovec *iov, int cnt) {
+	ssize_t n;
+	while (cnt > 0) {
+		n = writev(fd, iov, cnt);
+		if (n < 0) return;
+		while (cnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+}
+/* records dropped since the last report are logged as a warning,
+ * straight from the writer thread, at most once a second */
+static void async_report_drops(struct logger_impl *h, unsigned long *reported,
+							   time_t *last, int force) {
+	struct logger_info *logger = &h->o_o[LOG_LEVEL_WARNING];
+	unsigned long dropped = __atomic_load_n(&h->async->dropped, __ATOMIC_RELAXED);
+	char line[256];
+	time_t now, sec;
+	int n;
+	if (dropped == *reported) return;
+	now = time(NULL);
+	if (now == *last && !force) return;
+	*last = now;
+	n = format_header(line, sizeof(line), LOG_LEVEL_WARNING, __FILE__, __LINE__, &sec);
+	n += snprintf(line + n, sizeof(line) - n,
+				  "logger queue full, dropped %lu records (%lu in total)\n",
+				  dropped - *reported, dropped);
+	if (rotate_due(logger, &h->var, sec, 0))
+		rotate(logger, &h->var, sec);
+	if (write(logger->fd, line, n) == n) logger->filesize += n;
+	*reported = dropped;
+}
+static void *async_writer(void *arg) {
+	struct logger_impl *h = arg;
+	struct log_async *a = h->async;
+	struct logger_info *logger = NULL;
+	struct log_record *rec;
+	struct iovec iov[ASYNC_BATCH];
+	unsigned long reported = 0, pending, i;
+	time_t last_report = 0;
+	uint32_t val;
+	int n, exiting;
+
+	for (;;) {
+		/* a run of published records of one level, cut before a rotation */
+		for (n = 0, pending = 0; n < ASYNC_BATCH; n++) {
+			rec = &a->ring[(a->tail + n) & a->mask];
+			if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != a->tail + n + 1) break;
+			if (n == 0) {
+				logger = &h->o_o[rec->level];
+				if (rotate_due(logger, &h->var, rec->sec, 0))
+					rotate(logger, &h->var, rec->sec);
+			} else if (logger != &h->o_o[rec->level] ||
+					   rotate_due(logger, &h->var, rec->sec, pending)) {
+				break;
+			}
+			iov[n].iov_base = rec->line;
+			iov[n].iov_len = rec->len;
+			pending += rec->len;
+		}
+		if (n) {
+			write_all(logger->fd, iov, n);
+			logger->filesize += pending;
+			for (i = 0; i < (unsigned long)n; i++)
+				__atomic_store_n(&a->ring[(a->tail + i) & a->mask].seq,
+								 a->tail + i + a->mask + 1, __ATOMIC_RELEASE);
+			__atomic_store_n(&a->tail, a->tail + n, __ATOMIC_RELAXED);
+			continue;
+		}
+		exiting = __atomic_load_n(&a->exit, __ATOMIC_ACQUIRE);
+		async_report_drops(h, &reported, &last_report, exiting);
+		if (exiting) break;
+		val = __atomic_load_n(&a->futex, __ATOMIC_ACQUIRE);
+		__atomic_store_n(&a->sleeping, 1, __ATOMIC_SEQ_CST);
+		/* recheck after announcing, a producer may have missed the flag */
+		if (__atomic_load_n(&a->ring[a->tail & a->mask].seq, __ATOMIC_SEQ_CST) != a->tail + 1 &&
+			!__atomic_load_n(&a->exit, __ATOMIC_SEQ_CST))
+			futex_wait(&a->futex, val, ASYNC_IDLE_WAIT_MS);
+		__atomic_store_n(&a->sleeping, 0, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
 static inline void __vlogger(struct logger *l, int level,
 							 const char *filename, int line,
 							 const char *fmt, va_list args) {
 	struct logger_impl *handler = l->handler;
-	generic_logger(&handler->o_o[level], &handler->var,
-				   filename, line, fmt, args);
+	if (handler->binlog)
+		binlog_write(handler->binlog, level, filename, line, fmt, args);
+	else if (handler->async)
+		async_logger(handler->async, level, filename, line, fmt, args);
+	else
+		generic_logger(&handler->o_o[level], &handler->var,
+					   filename, line, fmt, args);
 }
 #ifndef NDEBUG
 void __logger_debug(struct logger *l, const char *filename, int line,
@@ -190,100 +497,69 @@ void __logger_fatal(struct logger *l, const char *filename, int line,
 	va_end(args);
 }
 /* ------------------------------------------------------------------------- */
-/* all possible combinations of rotating conditions */
-static inline int trigger_size(const struct tm *current,
-							   const struct log_tm *old,
-							   unsigned long max_file_size,
-							   unsigned long filesize) {
-	return (filesize >= max_file_size);
-}
+/* file names and rotation deadlines */
 static inline void filename_size(char *buf, int level, const struct tm *ts) {
 	sprintf(buf, "%04d-%02d-%02d_%02d:%02d:%02d.%s",
 			ts->tm_year + 1900, ts->tm_mon + 1, ts->tm_mday,
 			ts->tm_hour, ts->tm_min, ts->tm_sec,
 			log_level_str[level]);
 }
-static inline int trigger_hour(const struct tm *current,
-							   const struct log_tm *old,
-							   unsigned long max_file_size,
-							   unsigned long filesize) {
-	return (!((old->tm_hour == current->tm_hour) &&
-			  (old->tm_mday == current->tm_mday) &&
-			  (old->tm_mon == current->tm_mon) &&
-			  (old->tm_year == current->tm_year)));
-}
 static inline void filename_hour(char *buf, int level, const struct tm *ts) {
 	sprintf(buf, "%04d-%02d-%02d_%02d.%s",
 			ts->tm_year + 1900, ts->tm_mon + 1, ts->tm_mday, ts->tm_hour,
 			log_level_str[level]);
 }
-static inline int trigger_day(const struct tm *current,
-							  const struct log_tm *old,
-							  unsigned long max_file_size,
-							  unsigned long filesize) {
-	return (!((old->tm_mday == current->tm_mday) &&
-			  (old->tm_mon == current->tm_mon) &&
-			  (old->tm_year == current->tm_year)));
-}
 static inline void filename_day(char *buf, int level, const struct tm *ts) {
 	sprintf(buf, "%04d-%02d-%02d.%s",
 			ts->tm_year + 1900, ts->tm_mon + 1, ts->tm_mday,
 			log_level_str[level]);
 }
-static inline int trigger_size_hour(const struct tm *current,
-									const struct log_tm *old,
-									unsigned long max_file_size,
-									unsigned long filesize) {
-	return (trigger_size(current, old, max_file_size, filesize) ||
-			trigger_hour(current, old, max_file_size, filesize));
-}
-static inline void filename_size_hour(char *buf, int level, const struct tm *ts) {
-	filename_size(buf, level, ts);
-}
-static inline int trigger_size_day(const struct tm *current,
-								   const struct log_tm *old,
-								   unsigned long max_file_size,
-								   unsigned long filesize) {
-	return (trigger_size(current, old, max_file_size, filesize) ||
-			trigger_day(current, old, max_file_size, filesize));
-}
-static inline void filename_size_day(char *buf, int level, const struct tm *ts) {
-	filename_size(buf, level, ts);
-}
-static inline int trigger_none(const struct tm *current,
-							   const struct log_tm *old,
-							   unsigned long max_file_size,
-							   unsigned long filesize) {
-	return 0;
-}
 static inline void filename_none(char *buf, int level, const struct tm *ts)
 { }
+/* mktime() normalizes the overflowing field and handles DST changes */
+static time_t deadline_hour(const struct tm *ts) {
+	struct tm tm = *ts;
+	tm.tm_hour++;
+	tm.tm_min = tm.tm_sec = 0;
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
+static time_t deadline_day(const struct tm *ts) {
+	struct tm tm = *ts;
+	tm.tm_mday++;
+	tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
+static time_t deadline_none(const struct tm *ts) {
+	return LOG_TIME_MAX;
+}
 static void logger_var_set_func(struct logger_var *var, unsigned flags) {
 	switch (flags & LOGGER_ROTATE_FLAG_MASK) {
 	case LOGGER_ROTATE_BY_SIZE:
-		var->rotate_trigger = trigger_size;
+		var->next_deadline = deadline_none;
 		var->get_filename = filename_size;
 		break;
 	case LOGGER_ROTATE_PER_HOUR:
 	case LOGGER_ROTATE_PER_HOUR | LOGGER_ROTATE_PER_DAY:
-		var->rotate_trigger = trigger_hour;
+		var->next_deadline = deadline_hour;
 		var->get_filename = filename_hour;
 		break;
 	case LOGGER_ROTATE_PER_DAY:
-		var->rotate_trigger = trigger_day;
+		var->next_deadline = deadline_day;
 		var->get_filename = filename_day;
 		break;
 	case LOGGER_ROTATE_BY_SIZE | LOGGER_ROTATE_PER_HOUR:
 	case LOGGER_ROTATE_BY_SIZE | LOGGER_ROTATE_PER_HOUR | LOGGER_ROTATE_PER_DAY:
-		var->rotate_trigger = trigger_size_hour;
-		var->get_filename = filename_size_hour;
+		var->next_deadline = deadline_hour;
+		var->get_filename = filename_size;
 		break;
 	case LOGGER_ROTATE_BY_SIZE | LOGGER_ROTATE_PER_DAY:
-		var->rotate_trigger = trigger_size_day;
-		var->get_filename = filename_size_day;
+		var->next_deadline = deadline_day;
+		var->get_filename = filename_size;
 		break;
 	default:
-		var->rotate_trigger = trigger_day;
+		var->next_deadline = deadline_day;
 		var->get_filename = filename_day;
 	}
 }
@@ -304,13 +580,15 @@ static inline void logger_var_init(struct logger_var *var, const char *prefix,
 								   unsigned int max_megabytes) {
 	if (prefix) {
 		logger_var_set_func(var, flags);
-		var->max_file_size = max_megabytes << 20;
+		var->max_file_size = (flags & LOGGER_ROTATE_BY_SIZE) && max_megabytes ?
+			(unsigned long)max_megabytes << 20 : ULONG_MAX;
 		logger_var_set_path_prefix(var, prefix,
 								   PATH_PREFIX_BUFLEN > PATH_BUFLEN - 27 ?
 								   PATH_BUFLEN - 27 - 1 : PATH_PREFIX_BUFLEN - 1);
 	} else {
-		var->rotate_trigger = trigger_none;
+		var->next_deadline = deadline_none;
 		var->get_filename = filename_none;
+		var->max_file_size = ULONG_MAX;
 	}
 }
 /* ------------------------------------------------------------------------- */
@@ -323,22 +601,129 @@ int logger_init(struct logger *l, const char *prefix,
 	memset(handler, 0, sizeof(struct logger_impl));
 	for (i = 0; i < LOG_LEVEL_MAX; ++i) {
 		struct logger_info *logger = &handler->o_o[i];
-		if (i <= LOG_LEVEL_INFO) logger->fp = stdout;
-		else logger->fp = stderr;
+		logger->fd = (i <= LOG_LEVEL_INFO) ? STDOUT_FILENO : STDERR_FILENO;
+		/* the first line opens the file, without a prefix there is none */
+		logger->deadline = prefix ? 0 : LOG_TIME_MAX;
 		logger->level = i;
 		pthread_mutex_init(&logger->lock, NULL);
 	}
 	logger_var_init(&handler->var, prefix, flags, max_megabytes);
+	handler->start = time(NULL);
 	l->handler = handler;
+	l->level = LOG_LEVEL_DEBUG;
+	return 0;
+}
+int logger_start_async(struct logger *l, unsigned int records) {
+	struct logger_impl *handler = l->handler;
+	struct log_async *a;
+	unsigned long i, size = 1;
+	if (!handler || handler->async) return -1;
+	if (!records) records = ASYNC_DEFAULT_RECORDS;
+	while (size < records) size <<= 1;
+	a = calloc(1, sizeof(*a));
+	if (!a) return -1;
+	a->ring = malloc(size * sizeof(struct log_record));
+	if (!a->ring) {
+		free(a);
+		return -1;
+	}
+	for (i = 0; i < size; ++i) a->ring[i].seq = i;
+	a->mask = size - 1;
+	handler->async = a;
+	if (pthread_create(&a->tid, NULL, async_writer, handler) != 0) {
+		handler->async = NULL;
+		free(a->ring);
+		free(a);
+		return -1;
+	}
+	return 0;
+}
+int logger_start_binary(struct logger *l) {
+	struct logger_impl *handler = l->handler;
+	struct binlog *b;
+	if (!handler || handler->binlog || !handler->var.path_prefix[0]) return -1;
+	b = malloc(sizeof(*b));
+	if (!b) return -1;
+	if (binlog_open(b, handler->var.path_prefix, handler->var.max_file_size == ULONG_MAX ?
+					0 : handler->var.max_file_size) < 0) {
+		free(b);
+		return -1;
+	}
+	handler->binlog = b;
 	return 0;
 }
+int logger_start_archive(struct logger *l, const struct log_archive_policy *policy) {
+	struct logger_impl *handler = l->handler;
+	struct log_archive *a;
+	char first_name[PATH_BUFLEN], *dot;
+	struct tm tm;
+	if (!handler || handler->var.archive || !handler->var.path_prefix[0]) return -1;
+	a = malloc(sizeof(*a));
+	if (!a) return -1;
+	/* the time part of the first file name this run uses */
+	localtime_r(&handler->start, &tm);
+	handler->var.get_filename(first_name, LOG_LEVEL_DEBUG, &tm);
+	if ((dot = strrchr(first_name, '.'))) *dot = '\0';
+	if (log_archive_start(a, handler->var.path_prefix, first_name, policy) < 0) {
+		free(a);
+		return -1;
+	}
+	handler->var.archive = a;
+	return 0;
+}
+unsigned long logger_dropped(struct logger *l) {
+	struct logger_impl *handler = l->handler;
+	unsigned long dropped = 0;
+	if (!handler) return 0;
+	if (handler->async)
+		dropped += __atomic_load_n(&handler->async->dropped, __ATOMIC_RELAXED);
+	if (handler->binlog)
+		dropped += __atomic_load_n(&handler->binlog->dropped, __ATOMIC_RELAXED);
+	return dropped;
+}
+void logger_set_level(struct logger *l, int level) {
+	l->level = level;
+}
+int log_level_from_name(const char *name) {
+	int i;
+	for (i = 0; i < LOG_LEVEL_MAX; ++i)
+		if (!strcmp(name, log_level_str[i])) return i;
+	return -1;
+}
+const char *log_level_name(int level) {
+	return level >= 0 && level < LOG_LEVEL_MAX ? log_level_str[level] : "?";
+}
 void logger_destroy(struct logger *l) {
 	unsigned int i;
 	struct logger_impl *handler = l->handler;
+	struct log_async *a;
 	if (!handler) return;
+	if (handler->binlog) {
+		binlog_close(handler->binlog);
+		free(handler->binlog);
+		handler->binlog = NULL;
+	}
+	a = handler->async;
+	if (a) {
+		/* the writer drains the ring before it exits */
+		__atomic_store_n(&a->exit, 1, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&a->futex, 1, __ATOMIC_SEQ_CST);
+		syscall(SYS_futex, &a->futex, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+		pthread_join(a->tid, NULL);
+		handler->async = NULL;
+		free(a->ring);
+		free(a);
+	}
+	if (handler->var.archive) {
+		/* the files still open stay as they are */
+		log_archive_stop(handler->var.archive);
+		free(handler->var.archive);
+		handler->var.archive = NULL;
+	}
 	for (i = 0; i < LOG_LEVEL_MAX; ++i) {
 		struct logger_info *logger = &handler->o_o[i];
-		if (logger->fp && logger->fp != stdout && logger->fp != stderr) fclose(logger->fp);
+		if (logger->fd > STDERR_FILENO) close(logger->fd);
+		free(logger->path);
 		pthread_mutex_destroy(&logger->lock);
 	}
 	free(handler);
@@ -347,13 +732,59 @@ void logger_destroy(struct logger *l) {
 /* ------------------------------------------------------------------------- */
 /* singleton logger implementation */
 static struct logger o_o;
+volatile int __log_level = LOG_LEVEL_DEBUG;
 int log_init(const char *prefix, unsigned int flags,
 			 unsigned int max_megabytes) {
 	return logger_init(&o_o, prefix, flags, max_megabytes);
 }
+int log_start_async(unsigned int records) {
+	return logger_start_async(&o_o, records);
+}
+int log_start_binary(void) {
+	return logger_start_binary(&o_o);
+}
+int log_start_archive(const struct log_archive_policy *policy) {
+	return logger_start_archive(&o_o, policy);
+}
+unsigned long log_dropped(void) {
+	return logger_dropped(&o_o);
+}
+void log_set_level(int level) {
+	__log_level = level;
+}
+int log_get_level(void) {
+	return __log_level;
+}
 void log_destroy(void) {
 	logger_destroy(&o_o);
 }
+static void log_at(int level, const char *filename, int line, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	__vlogger(&o_o, level, filename, line, fmt, args);
+	va_end(args);
+}
+int __log_ratelimit(struct log_ratelimit *rl, int level, const char *filename, int line) {
+	struct timespec ts;
+	long long now, start;
+	unsigned int suppressed;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	now = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+	start = __atomic_load_n(&rl->start_ms, __ATOMIC_RELAXED);
+	/* one caller opens the new interval and reports the last one */
+	if (now - start >= LOG_RATELIMIT_INTERVAL_MS &&
+		__atomic_compare_exchange_n(&rl->start_ms, &start, now, 0,
+									__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&rl->count, 0, __ATOMIC_RELAXED);
+		suppressed = __atomic_exchange_n(&rl->suppressed, 0, __ATOMIC_RELAXED);
+		if (suppressed)
+			log_at(level, filename, line, "suppressed %u similar messages", suppressed);
+	}
+	if (__atomic_add_fetch(&rl->count, 1, __ATOMIC_RELAXED) <= LOG_RATELIMIT_BURST)
+		return 1;
+	__atomic_add_fetch(&rl->suppressed, 1, __ATOMIC_RELAXED);
+	return 0;
+}
 #ifndef NDEBUG
 void __log_debug(const char *filename, int line, const char *fmt, ...) {
 	va_list args;
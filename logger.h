@@ -21,8 +21,17 @@
 
 #ifndef __LOGGER_H__
 #define __LOGGER_H__
+/* levels in increasing severity */
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_USER 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARNING 3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_FATAL 5
+#define LOG_LEVEL_MAX 6
 struct logger {
 	struct logger_impl *handler;
+	int level; /* calls below this level return before any formatting */
 };
 /* flag definitions for logger_init() */
 #define LOGGER_ROTATE_BY_SIZE 0x1
@@ -31,19 +40,52 @@ struct logger {
 #define LOGGER_ROTATE_FLAG_MASK 0x7
 #define LOGGER_ROTATE_DEFAULT LOGGER_ROTATE_PER_DAY
 
+/* Without async mode the lines of a level are written under a lock of
+ * that level; on rotation the next file is opened with the lock dropped
+ * and only the swap of the fd happens under it. */
 int logger_init(struct logger *, const char *prefix,
 				unsigned int flags, unsigned int max_megabytes);
+/* Switch to asynchronous writing: records are queued in a ring of
+ * `records' slots (0 = default, rounded up to a power of 2) and written
+ * by a background thread. When the ring is full, debug/user/info records
+ * are dropped and counted, warning and above block until there is room.
+ * Records are cut at 1KB. logger_destroy() writes out what is queued. */
+int logger_start_async(struct logger *, unsigned int records);
+/* Switch to the binary log (see binlog.h): records keep their raw
+ * arguments and are rendered offline by udpproxy-logcat. All levels go
+ * to <prefix>YYYY-MM-DD_hh:mm:ss.NNN.blog, a new file is started at the
+ * size limit of logger_init(); the text files get no more lines. Needs
+ * a prefix. */
+int logger_start_binary(struct logger *);
+/* Hand every file rotated away from to a background worker that
+ * compresses and prunes them (see logarchive.h). Needs a prefix. */
+struct log_archive_policy;
+int logger_start_archive(struct logger *, const struct log_archive_policy *);
+unsigned long logger_dropped(struct logger *);
+void logger_set_level(struct logger *, int level);
 void logger_destroy(struct logger *);
+/* level by name ("debug" ... "fatal"), -1 if unknown */
+int log_level_from_name(const char *name);
+const char *log_level_name(int level);
+/* debug is expected to be filtered out, everything else to be logged */
+#define __logger_enabled(lp, level) \
+	__builtin_expect((lp)->level <= (level), (level) > LOG_LEVEL_DEBUG)
 #ifdef NDEBUG
 #define logger_debug(lp, fmt, ...)
 #else
-#define logger_debug(lp, fmt, ...) __logger_debug(lp, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
+#define logger_debug(lp, fmt, ...) do { if (__logger_enabled(lp, LOG_LEVEL_DEBUG)) \
+	__logger_debug(lp, __FILE__, __LINE__, fmt, ##__VA_ARGS__); } while (0)
 #endif
-#define logger_user(lp, fmt, ...) __logger_user(lp, __FILE__, __LINE__, fmt, ##__VA_ARGS__) /* user specific logs */
-#define logger_info(lp, fmt, ...) __logger_info(lp, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define logger_warning(lp, fmt, ...) __logger_warning(lp, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define logger_error(lp, fmt, ...) __logger_error(lp, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define logger_fatal(lp, fmt, ...) __logger_fatal(lp, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
+#define logger_user(lp, fmt, ...) do { if (__logger_enabled(lp, LOG_LEVEL_USER)) \
+	__logger_user(lp, __FILE__, __LINE__, fmt, ##__VA_ARGS__); } while (0) /* user specific logs */
+#define logger_info(lp, fmt, ...) do { if (__logger_enabled(lp, LOG_LEVEL_INFO)) \
+	__logger_info(lp, __FILE__, __LINE__, fmt, ##__VA_ARGS__); } while (0)
+#define logger_warning(lp, fmt, ...) do { if (__logger_enabled(lp, LOG_LEVEL_WARNING)) \
+	__logger_warning(lp, __FILE__, __LINE__, fmt, ##__VA_ARGS__); } while (0)
+#define logger_error(lp, fmt, ...) do { if (__logger_enabled(lp, LOG_LEVEL_ERROR)) \
+	__logger_error(lp, __FILE__, __LINE__, fmt, ##__VA_ARGS__); } while (0)
+#define logger_fatal(lp, fmt, ...) do { if (__logger_enabled(lp, LOG_LEVEL_FATAL)) \
+	__logger_fatal(lp, __FILE__, __LINE__, fmt, ##__VA_ARGS__); } while (0)
 /* ------------------------------------------------------------------------- */
 #ifndef NDEBUG
 void __logger_debug(struct logger *, const char *filename, int line,
@@ -61,17 +103,54 @@ void __logger_fatal(struct logger *, const char *filename, int line,
 					const char *fmt, ...);
 #endif
 
+int log_init(const char *prefix, unsigned int flags, unsigned int max_megabytes);
+int log_start_async(unsigned int records);
+int log_start_binary(void);
+int log_start_archive(const struct log_archive_policy *);
+unsigned long log_dropped(void);
+/* may be called from a signal handler */
+void log_set_level(int level);
+int log_get_level(void);
 void log_destroy(void);
+extern volatile int __log_level;
+#define __log_enabled(level) \
+	__builtin_expect(__log_level <= (level), (level) > LOG_LEVEL_DEBUG)
 #ifdef NDEBUG
 #define log_debug(fmt, ...)
 #else
-#define log_debug(fmt, ...) __log_debug(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
+#define log_debug(fmt, ...) do { if (__log_enabled(LOG_LEVEL_DEBUG)) \
+	__log_debug(__FILE__, __LINE__, fmt, ##__VA_ARGS__); } while (0)
 #endif
-#define log_user(fmt, ...) __log_user(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define log_info(fmt, ...) __log_info(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define log_warning(fmt, ...) __log_warning(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define log_error(fmt, ...) __log_error(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define log_fatal(fmt, ...) __log_fatal(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
+#define log_user(fmt, ...) do { if (__log_enabled(LOG_LEVEL_USER)) \
+	__log_user(__FILE__, __LINE__, fmt, ##__VA_ARGS__); } while (0)
+#define log_info(fmt, ...) do { if (__log_enabled(LOG_LEVEL_INFO)) \
+	__log_info(__FILE__, __LINE__, fmt, ##__VA_ARGS__); } while (0)
+#define log_warning(fmt, ...) do { if (__log_enabled(LOG_LEVEL_WARNING)) \
+	__log_warning(__FILE__, __LINE__, fmt, ##__VA_ARGS__); } while (0)
+#define log_error(fmt, ...) do { if (__log_enabled(LOG_LEVEL_ERROR)) \
+	__log_error(__FILE__, __LINE__, fmt, ##__VA_ARGS__); } while (0)
+#define log_fatal(fmt, ...) do { if (__log_enabled(LOG_LEVEL_FATAL)) \
+	__log_fatal(__FILE__, __LINE__, fmt, ##__VA_ARGS__); } while (0)
+/* For error paths that can repeat at line rate: each call site lets
+ * LOG_RATELIMIT_BURST records through per LOG_RATELIMIT_INTERVAL_MS and
+ * counts the rest; the count is logged as "suppressed N similar messages"
+ * ahead of the first record of a later interval. */
+#define LOG_RATELIMIT_BURST 10
+#define LOG_RATELIMIT_INTERVAL_MS 5000
+struct log_ratelimit {
+	long long start_ms;
+	unsigned int count;
+	unsigned int suppressed;
+};
+int __log_ratelimit(struct log_ratelimit *, int level, const char *filename, int line);
+#define log_warning_ratelimited(fmt, ...) do { static struct log_ratelimit __rl; \
+	if (__log_enabled(LOG_LEVEL_WARNING) && \
+		__log_ratelimit(&__rl, LOG_LEVEL_WARNING, __FILE__, __LINE__)) \
+		__log_warning(__FILE__, __LINE__, fmt, ##__VA_ARGS__); } while (0)
+#define log_error_ratelimited(fmt, ...) do { static struct log_ratelimit __rl; \
+	if (__log_enabled(LOG_LEVEL_ERROR) && \
+		__log_ratelimit(&__rl, LOG_LEVEL_ERROR, __FILE__, __LINE__)) \
+		__log_error(__FILE__, __LINE__, fmt, ##__VA_ARGS__); } while (0)
 /* ------------------------------------------------------------------------- */
 #ifndef NDEBUG
 void __log_debug(const char *filename, int line, const char *fmt, ...);
@@ -0,0 +1,432 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#define _GNU_SOURCE /* accept4 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "metrics.h"
+#include "logger.h"
+/* ------------------------------------------------------------------------- */
+/* how often the server thread checks the exit flag, metrics_stop() also
+ * wakes it by shutting the listeners down */
+#define METRICS_POLL_MS 500
+/* a client has this long to send its request */
+#define METRICS_RECV_TIMEOUT_MS 1000
+#define METRICS_REQUEST_MAX 2048
+/* larger latencies all land in the last bucket */
+#define METRICS_HIST_MAX_BITS 36
+/* microseconds as "seconds.micros" for %llu.%06llu */
+#define SECONDS(us) (unsigned long long)((us) / 1000000), (unsigned long long)((us) % 1000000)
+
+static const char *output_names[METRICS_OUTPUTS] = {
+	"udp", "rtp", "reliable", "resend", "fec", "relay"
+};
+static const char *stage_names[METRICS_STAGES] = {
+	"scan", "enqueue", "wait", "send"
+};
+static const char *latency_names[METRICS_LATENCIES] = {
+	"ingest", "queued", "start", "transmit", "total"
+};
+/* le bounds of the exported histogram, microseconds */
+static const uint64_t latency_bounds[] = {
+	1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+	1000000, 2500000, 5000000, 10000000, 30000000, 60000000
+};
+
+__thread struct metrics_block *__metrics_self;
+static struct metrics_block *blocks;
+/* shared by threads whose block could not be allocated, counts may be lost */
+static struct metrics_block fallback_block;
+static int fallback_registered;
+
+/* ------------------------------------------------------------------------- */
+static void push_block(struct metrics_block *b) {
+	struct metrics_block *head = __atomic_load_n(&blocks, __ATOMIC_RELAXED);
+	do
+		b->next = head;
+	while (!__atomic_compare_exchange_n(&blocks, &head, b, 1,
+										__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+__attribute__((noinline, cold))
+struct metrics_block *__metrics_register(void) {
+	struct metrics_block *b;
+	if (posix_memalign((void **)&b, 64, sizeof(*b)) == 0) {
+		memset(b, 0, sizeof(*b));
+		push_block(b);
+	} else {
+		b = &fallback_block;
+		if (!__atomic_exchange_n(&fallback_registered, 1, __ATOMIC_ACQ_REL))
+			push_block(b);
+	}
+	__metrics_self = b;
+	return b;
+}
+/* ------------------------------------------------------------------------- */
+static unsigned int hist_bucket(uint64_t v) {
+	unsigned int e;
+	if (v < (1u << METRICS_HIST_SUB_BITS)) return v;
+	e = 63 - __builtin_clzll(v);
+	if (e >= METRICS_HIST_MAX_BITS) return METRICS_HIST_BUCKETS - 1;
+	return ((e - METRICS_HIST_SUB_BITS + 1) << METRICS_HIST_SUB_BITS) +
+		   (v >> (e - METRICS_HIST_SUB_BITS)) - (1u << METRICS_HIST_SUB_BITS);
+}
+/* first value above bucket i */
+static uint64_t hist_upper(unsigned int i) {
+	unsigned int sub = 1u << METRICS_HIST_SUB_BITS, shift;
+	if (i < sub) return i + 1;
+	shift = (i >> METRICS_HIST_SUB_BITS) - 1;
+	return ((uint64_t)(sub + (i & (sub - 1))) << shift) + ((uint64_t)1 << shift);
+}
+void metrics_latency(enum metrics_latency lat, int64_t us) {
+	struct metrics_block *b = metrics_self();
+	struct metrics_histogram *h = b->latency;
+	if (us < 0) return;
+	if (!h) {
+		h = calloc(METRICS_LATENCIES, sizeof(*h));
+		if (!h) return;
+		__atomic_store_n(&b->latency, h, __ATOMIC_RELEASE);
+	}
+	h += lat;
+	__metrics_add(&h->count[hist_bucket(us)], 1);
+	__metrics_add(&h->sum, us);
+	if ((uint64_t)us > h->max) __atomic_store_n(&h->max, us, __ATOMIC_RELAXED);
+}
+static uint64_t load(const uint64_t *v) {
+	return __atomic_load_n(v, __ATOMIC_RELAXED);
+}
+/* sums one latency of all threads into out, returns the count */
+static uint64_t merge_latency(enum metrics_latency lat, struct metrics_histogram *out) {
+	struct metrics_block *b = __atomic_load_n(&blocks, __ATOMIC_ACQUIRE);
+	struct metrics_histogram *h;
+	uint64_t count = 0, v;
+	unsigned int i;
+	memset(out, 0, sizeof(*out));
+	for (; b; b = b->next) {
+		h = __atomic_load_n(&b->latency, __ATOMIC_ACQUIRE);
+		if (!h) continue;
+		h += lat;
+		for (i = 0; i < METRICS_HIST_BUCKETS; i++) out->count[i] += load(&h->count[i]);
+		out->sum += load(&h->sum);
+		v = load(&h->max);
+		if (v > out->max) out->max = v;
+	}
+	for (i = 0; i < METRICS_HIST_BUCKETS; i++) count += out->count[i];
+	return count;
+}
+/* highest value of the bucket holding the rank-th value, q in 1/100000 */
+static uint64_t percentile(const struct metrics_histogram *h, uint64_t count, uint64_t q) {
+	uint64_t rank = (count * q + 99999) / 100000, seen = 0, v;
+	unsigned int i;
+	if (!rank) rank = 1;
+	for (i = 0; i < METRICS_HIST_BUCKETS; i++) {
+		seen += h->count[i];
+		if (seen >= rank) break;
+	}
+	if (i == METRICS_HIST_BUCKETS) return h->max;
+	v = hist_upper(i) - 1;
+	return v < h->max ? v : h->max;
+}
+void metrics_latency_stats(enum metrics_latency lat, struct metrics_latency_stats *s) {
+	struct metrics_histogram h;
+	s->count = merge_latency(lat, &h);
+	s->sum = h.sum;
+	s->max = h.max;
+	s->p50 = percentile(&h, s->count, 50000);
+	s->p90 = percentile(&h, s->count, 90000);
+	s->p99 = percentile(&h, s->count, 99000);
+	s->p999 = percentile(&h, s->count, 99900);
+}
+const char *metrics_latency_name(enum metrics_latency lat) {
+	return latency_names[lat];
+}
+/* ------------------------------------------------------------------------- */
+void metrics_printf(struct metrics_buf *m, const char *fmt, ...) {
+	va_list ap;
+	int n;
+	char *p;
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(m->data + m->len, m->cap - m->len, fmt, ap);
+		va_end(ap);
+		if (n < 0) return;
+		if (m->len + n < m->cap) break;
+		p = realloc(m->data, m->cap * 2 + n + 1);
+		if (!p) return;
+		m->data = p;
+		m->cap = m->cap * 2 + n + 1;
+	}
+	m->len += n;
+}
+static void render_latency(struct metrics_buf *m) {
+	struct metrics_histogram h;
+	struct metrics_latency_stats s;
+	uint64_t count, cum;
+	unsigned int i, k, lat;
+
+	metrics_printf(m, "# HELP udpproxy_segment_latency_seconds Segment latency by stage, dummy segments excluded.\n"
+				   "# TYPE udpproxy_segment_latency_seconds histogram\n");
+	for (lat = 0; lat < METRICS_LATENCIES; lat++) {
+		count = merge_latency(lat, &h);
+		/* a bucket counts towards le once its highest value is <= le */
+		for (cum = 0, i = 0, k = 0; k < sizeof(latency_bounds) / sizeof(latency_bounds[0]); k++) {
+			for (; i < METRICS_HIST_BUCKETS && hist_upper(i) - 1 <= latency_bounds[k]; i++)
+				cum += h.count[i];
+			metrics_printf(m, "udpproxy_segment_latency_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n",
+						   latency_names[lat], latency_bounds[k] / 1e6, (unsigned long long)cum);
+		}
+		metrics_printf(m, "udpproxy_segment_latency_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n"
+					   "udpproxy_segment_latency_seconds_sum{stage=\"%s\"} %llu.%06llu\n"
+					   "udpproxy_segment_latency_seconds_count{stage=\"%s\"} %llu\n",
+					   latency_names[lat], (unsigned long long)count,
+					   latency_names[lat], SECONDS(h.sum),
+					   latency_names[lat], (unsigned long long)count);
+	}
+	/* from the full resolution histogram, quantile 1 is the maximum */
+	metrics_printf(m, "# HELP udpproxy_segment_latency_quantile_seconds Segment latency percentiles by stage.\n"
+				   "# TYPE udpproxy_segment_latency_quantile_seconds gauge\n");
+	for (lat = 0; lat < METRICS_LATENCIES; lat++) {
+		metrics_latency_stats(lat, &s);
+		metrics_printf(m, "udpproxy_segment_latency_quantile_seconds{stage=\"%s\",quantile=\"0.5\"} %llu.%06llu\n"
+					   "udpproxy_segment_latency_quantile_seconds{stage=\"%s\",quantile=\"0.9\"} %llu.%06llu\n"
+					   "udpproxy_segment_latency_quantile_seconds{stage=\"%s\",quantile=\"0.99\"} %llu.%06llu\n"
+					   "udpproxy_segment_latency_quantile_seconds{stage=\"%s\",quantile=\"0.999\"} %llu.%06llu\n"
+					   "udpproxy_segment_latency_quantile_seconds{stage=\"%s\",quantile=\"1\"} %llu.%06llu\n",
+					   latency_names[lat], SECONDS(s.p50), latency_names[lat], SECONDS(s.p90),
+					   latency_names[lat], SECONDS(s.p99), latency_names[lat], SECONDS(s.p999),
+					   latency_names[lat], SECONDS(s.max));
+	}
+}
+void metrics_render(struct metrics_buf *m, metrics_collect_cb cb, void *opaque) {
+	struct metrics_block *head = __atomic_load_n(&blocks, __ATOMIC_ACQUIRE), *b;
+	uint64_t sum, sum2;
+	int i, e;
+
+	metrics_printf(m, "# HELP udpproxy_sent_bytes_total Bytes sent, by output.\n"
+				   "# TYPE udpproxy_sent_bytes_total counter\n");
+	for (i = 0; i < METRICS_OUTPUTS; i++) {
+		for (sum = 0, b = head; b; b = b->next) sum += load(&b->bytes[i]);
+		metrics_printf(m, "udpproxy_sent_bytes_total{output=\"%s\"} %llu\n",
+					   output_names[i], (unsigned long long)sum);
+	}
+	metrics_printf(m, "# HELP udpproxy_sent_datagrams_total Datagrams sent, by output.\n"
+				   "# TYPE udpproxy_sent_datagrams_total counter\n");
+	for (i = 0; i < METRICS_OUTPUTS; i++) {
+		for (sum = 0, b = head; b; b = b->next) sum += load(&b->datagrams[i]);
+		metrics_printf(m, "udpproxy_sent_datagrams_total{output=\"%s\"} %llu\n",
+					   output_names[i], (unsigned long long)sum);
+	}
+	/* only the errno values that occurred */
+	metrics_printf(m, "# HELP udpproxy_send_errors_total Failed sends, by output and errno.\n"
+				   "# TYPE udpproxy_send_errors_total counter\n");
+	for (i = 0; i < METRICS_OUTPUTS; i++) {
+		for (e = 0; e < METRICS_ERRNO_MAX; e++) {
+			for (sum = 0, b = head; b; b = b->next) sum += load(&b->errors[i][e]);
+			if (sum)
+				metrics_printf(m, "udpproxy_send_errors_total{output=\"%s\",errno=\"%d\"} %llu\n",
+							   output_names[i], e, (unsigned long long)sum);
+		}
+	}
+	for (sum = 0, b = head; b; b = b->next) sum += load(&b->events[METRICS_SEGMENTS_SENT]);
+	metrics_printf(m, "# HELP udpproxy_segments_sent_total Segments sent, dummy included.\n"
+				   "# TYPE udpproxy_segments_sent_total counter\n"
+				   "udpproxy_segments_sent_total %llu\n", (unsigned long long)sum);
+	for (sum = 0, b = head; b; b = b->next) sum += load(&b->events[METRICS_DUMMY_INSERTED]);
+	metrics_printf(m, "# HELP udpproxy_dummy_inserted_total Dummy segments inserted.\n"
+				   "# TYPE udpproxy_dummy_inserted_total counter\n"
+				   "udpproxy_dummy_inserted_total %llu\n", (unsigned long long)sum);
+	for (sum = 0, b = head; b; b = b->next) sum += load(&b->events[METRICS_INOTIFY_EVENTS]);
+	metrics_printf(m, "# HELP udpproxy_inotify_events_total inotify events read.\n"
+				   "# TYPE udpproxy_inotify_events_total counter\n"
+				   "udpproxy_inotify_events_total %llu\n", (unsigned long long)sum);
+	for (sum = 0, b = head; b; b = b->next) sum += load(&b->events[METRICS_INOTIFY_OVERFLOWS]);
+	metrics_printf(m, "# HELP udpproxy_inotify_overflows_total inotify queue overflows.\n"
+				   "# TYPE udpproxy_inotify_overflows_total counter\n"
+				   "udpproxy_inotify_overflows_total %llu\n", (unsigned long long)sum);
+	metrics_printf(m, "# HELP udpproxy_stage_seconds Time spent per pipeline stage.\n"
+				   "# TYPE udpproxy_stage_seconds summary\n");
+	for (i = 0; i < METRICS_STAGES; i++) {
+		for (sum = sum2 = 0, b = head; b; b = b->next) {
+			sum += load(&b->stage_us[i]);
+			sum2 += load(&b->stage_count[i]);
+		}
+		metrics_printf(m, "udpproxy_stage_seconds_sum{stage=\"%s\"} %llu.%06llu\n"
+					   "udpproxy_stage_seconds_count{stage=\"%s\"} %llu\n",
+					   stage_names[i], SECONDS(sum), stage_names[i], (unsigned long long)sum2);
+	}
+	render_latency(m);
+	if (cb) cb(opaque, m);
+}
+/* ------------------------------------------------------------------------- */
+/* reads the request head and answers it; one request per connection */
+static void serve(struct metrics_server *s, int fd) {
+	char req[METRICS_REQUEST_MAX + 1], head[160];
+	struct metrics_buf body;
+	struct timeval tv;
+	size_t len = 0;
+	ssize_t n;
+	int status = 200, hlen;
+	const char *reason = "OK";
+
+	tv.tv_sec = METRICS_RECV_TIMEOUT_MS / 1000;
+	tv.tv_usec = (METRICS_RECV_TIMEOUT_MS % 1000) * 1000;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	while (len < METRICS_REQUEST_MAX) {
+		n = recv(fd, req + len, METRICS_REQUEST_MAX - len, 0);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return;
+		len += n;
+		req[len] = '\0';
+		if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) break;
+	}
+	req[len] = '\0';
+
+	body.cap = 16384;
+	body.len = 0;
+	body.data = malloc(body.cap);
+	if (!body.data) return;
+	body.data[0] = '\0';
+	if (strncmp(req, "GET ", 4)) {
+		status = 405;
+		reason = "Method Not Allowed";
+	} else if (strncmp(req + 4, "/metrics ", 9) && strncmp(req + 4, "/ ", 2)) {
+		status = 404;
+		reason = "Not Found";
+	} else {
+		metrics_render(&body, s->collect, s->opaque);
+	}
+	hlen = snprintf(head, sizeof(head), "HTTP/1.0 %d %s\r\n"
+					"Content-Type: text/plain; version=0.0.4\r\n"
+					"Content-Length: %zu\r\n"
+					"Connection: close\r\n\r\n", status, reason, body.len);
+	if (send(fd, head, hlen, MSG_NOSIGNAL) == hlen) {
+		for (len = 0; len < body.len; len += n) {
+			n = send(fd, body.data + len, body.len - len, MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR) n = 0;
+			else if (n <= 0) break;
+		}
+	}
+	free(body.data);
+}
+static void *metrics_loop(void *arg) {
+	struct metrics_server *s = arg;
+	struct pollfd pfd[2];
+	int nfds = 0, i, fd;
+
+	if (s->tcp_fd >= 0) {
+		pfd[nfds].fd = s->tcp_fd;
+		pfd[nfds++].events = POLLIN;
+	}
+	if (s->unix_fd >= 0) {
+		pfd[nfds].fd = s->unix_fd;
+		pfd[nfds++].events = POLLIN;
+	}
+	while (!__atomic_load_n(&s->exit, __ATOMIC_ACQUIRE)) {
+		if (poll(pfd, nfds, METRICS_POLL_MS) <= 0) continue;
+		for (i = 0; i < nfds; i++) {
+			if (!(pfd[i].revents & POLLIN)) continue;
+			fd = accept4(pfd[i].fd, NULL, NULL, SOCK_CLOEXEC);
+			if (fd < 0) continue;
+			serve(s, fd);
+			close(fd);
+		}
+	}
+	return NULL;
+}
+/* ------------------------------------------------------------------------- */
+static int listen_tcp(int port) {
+	struct sockaddr_in addr;
+	int fd, on = 1;
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) return -1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+		log_error("metrics: listen on 127.0.0.1:%d failed:%s", port, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+static int listen_unix(const char *path) {
+	struct sockaddr_un addr;
+	int fd;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		log_error("metrics: socket path %s too long", path);
+		return -1;
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	/* a socket left behind by a previous run */
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+		log_error("metrics: listen on %s failed:%s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+int metrics_start(struct metrics_server *s, int port, const char *path,
+				  metrics_collect_cb cb, void *opaque) {
+	memset(s, 0, sizeof(*s));
+	s->tcp_fd = s->unix_fd = -1;
+	s->collect = cb;
+	s->opaque = opaque;
+	if (port > 0) s->tcp_fd = listen_tcp(port);
+	if (path && path[0] && (s->unix_fd = listen_unix(path)) >= 0)
+		strcpy(s->path, path);
+	if (s->tcp_fd < 0 && s->unix_fd < 0) return -1;
+	if (pthread_create(&s->tid, NULL, metrics_loop, s) != 0) {
+		log_error("metrics: create thread failed");
+		metrics_stop(s);
+		return -1;
+	}
+	s->started = 1;
+	return 0;
+}
+void metrics_stop(struct metrics_server *s) {
+	if (s->started) {
+		__atomic_store_n(&s->exit, 1, __ATOMIC_RELEASE);
+		/* wakes the poll() on a listening socket */
+		if (s->tcp_fd >= 0) shutdown(s->tcp_fd, SHUT_RDWR);
+		if (s->unix_fd >= 0) shutdown(s->unix_fd, SHUT_RDWR);
+		pthread_join(s->tid, NULL);
+		s->started = 0;
+	}
+	if (s->tcp_fd >= 0) close(s->tcp_fd);
+	if (s->unix_fd >= 0) {
+		close(s->unix_fd);
+		unlink(s->path);
+	}
+	s->tcp_fd = s->unix_fd = -1;
+}
@@ -0,0 +1,181 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+*
+* This file is part of udpproxy.
+*
+* udpproxy is free software; you can redistribute it and/or
+        * modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+        * version 2.1 of the License, or (at your option) any later version.
+*
+* udpproxy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/* Live counters and a Prometheus text endpoint.
+ *
+ * Every thread that counts gets its own struct metrics_block on first
+ * use. The block is pushed onto a global list with one compare and swap
+ * and is never freed, so its totals outlive the thread. A block has a
+ * single writer, so an update is a plain add published with a relaxed
+ * store: no lock and no locked instruction on the send path. The scraper
+ * sums all blocks with relaxed loads and may see an update a little
+ * late, never a torn one.
+ *
+ * Segment latencies go into per-thread log-linear (HDR style) histograms:
+ * values below 32us are exact, above that every power of two is split
+ * into 32 linear buckets, so a reported percentile is within 1/32 of the
+ * true value up to 2^36us. The histograms of a thread are allocated the
+ * first time it records one.
+ *
+ * metrics_start() serves GET /metrics over HTTP on 127.0.0.1:port and/or
+ * a Unix socket (curl --unix-socket path http://localhost/metrics) from
+ * its own thread. The collect callback appends the gauges only the
+ * caller knows, such as queue depth. */
+enum metrics_output {
+	METRICS_OUT_UDP,              /* plain datagrams */
+	METRICS_OUT_RTP,
+	METRICS_OUT_RELIABLE,         /* udp_datapack, first transmission */
+	METRICS_OUT_RESEND,           /* udp_datapack, NACK retransmission */
+	METRICS_OUT_FEC,
+	METRICS_OUT_RELAY,
+	METRICS_OUTPUTS
+};
+
+enum metrics_event {
+	METRICS_SEGMENTS_SENT,
+	METRICS_DUMMY_INSERTED,
+	METRICS_INOTIFY_EVENTS,
+	METRICS_INOTIFY_OVERFLOWS,
+	METRICS_EVENTS
+};
+
+enum metrics_stage {
+	METRICS_STAGE_SCAN,           /* startup directory scan */
+	METRICS_STAGE_ENQUEUE,        /* queue insert, including waiting for room */
+	METRICS_STAGE_WAIT,           /* pacing wait before a segment */
+	METRICS_STAGE_SEND,           /* reading and sending one segment */
+	METRICS_STAGES
+};
+
+/* life of one segment, from the stamps in its file_infor */
+enum metrics_latency {
+	METRICS_LAT_INGEST,           /* file arrival to queue insert */
+	METRICS_LAT_QUEUED,           /* queue insert to dequeue by the send thread */
+	METRICS_LAT_START,            /* dequeue to first byte sent, pacing included */
+	METRICS_LAT_TRANSMIT,         /* first byte to last byte sent */
+	METRICS_LAT_TOTAL,            /* file arrival to last byte sent */
+	METRICS_LATENCIES
+};
+
+/* errno values from here up share the last slot */
+#define METRICS_ERRNO_MAX 136
+
+#define METRICS_HIST_SUB_BITS 5
+/* 32 exact buckets, then 32 per power of two up to 2^36us */
+#define METRICS_HIST_BUCKETS 1024
+
+struct metrics_histogram {
+	uint64_t count[METRICS_HIST_BUCKETS];
+	uint64_t sum;                 /* microseconds */
+	uint64_t max;
+};
+
+struct metrics_latency_stats {
+	uint64_t count;
+	uint64_t sum;                 /* all values in microseconds */
+	uint64_t max;
+	uint64_t p50;
+	uint64_t p90;
+	uint64_t p99;
+	uint64_t p999;
+};
+
+struct metrics_block {
+	struct metrics_block *next;
+	uint64_t bytes[METRICS_OUTPUTS];
+	uint64_t datagrams[METRICS_OUTPUTS];
+	uint64_t errors[METRICS_OUTPUTS][METRICS_ERRNO_MAX];
+	uint64_t events[METRICS_EVENTS];
+	uint64_t stage_us[METRICS_STAGES];
+	uint64_t stage_count[METRICS_STAGES];
+	struct metrics_histogram *latency;  /* [METRICS_LATENCIES], NULL until used */
+} __attribute__((aligned(64)));
+
+extern __thread struct metrics_block *__metrics_self;
+struct metrics_block *__metrics_register(void);
+
+static inline struct metrics_block *metrics_self(void) {
+	struct metrics_block *b = __metrics_self;
+	return __builtin_expect(b != NULL, 1) ? b : __metrics_register();
+}
+/* only the owning thread writes, the store just has to be untorn */
+static inline void __metrics_add(uint64_t *v, uint64_t n) {
+	__atomic_store_n(v, *v + n, __ATOMIC_RELAXED);
+}
+static inline void metrics_sent(enum metrics_output out, uint64_t bytes,
+								unsigned int datagrams) {
+	struct metrics_block *b = metrics_self();
+	__metrics_add(&b->bytes[out], bytes);
+	__metrics_add(&b->datagrams[out], datagrams);
+}
+static inline void metrics_send_error(enum metrics_output out, int err) {
+	if (err < 0 || err >= METRICS_ERRNO_MAX) err = METRICS_ERRNO_MAX - 1;
+	__metrics_add(&metrics_self()->errors[out][err], 1);
+}
+static inline void metrics_event(enum metrics_event ev, unsigned int n) {
+	__metrics_add(&metrics_self()->events[ev], n);
+}
+/* us: microseconds spent in the stage */
+static inline void metrics_stage(enum metrics_stage stage, int64_t us) {
+	struct metrics_block *b = metrics_self();
+	__metrics_add(&b->stage_us[stage], us > 0 ? us : 0);
+	__metrics_add(&b->stage_count[stage], 1);
+}
+
+/* us: duration of one segment in the stage, negative values are ignored */
+void metrics_latency(enum metrics_latency, int64_t us);
+/* merged over all threads; percentiles are bucket upper bounds */
+void metrics_latency_stats(enum metrics_latency, struct metrics_latency_stats *);
+const char *metrics_latency_name(enum metrics_latency);
+
+/* growing text buffer a scrape is rendered into */
+struct metrics_buf {
+	char *data;
+	size_t len;
+	size_t cap;
+};
+void metrics_printf(struct metrics_buf *, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+typedef void (*metrics_collect_cb)(void *opaque, struct metrics_buf *);
+
+struct metrics_server {
+	int tcp_fd;                   /* -1 if not listening */
+	int unix_fd;
+	char path[108];               /* sun_path of unix_fd, removed at stop */
+	int exit;
+	int started;
+	pthread_t tid;
+	metrics_collect_cb collect;
+	void *opaque;
+};
+
+/* renders the counters of all threads followed by the collect output */
+void metrics_render(struct metrics_buf *, metrics_collect_cb cb, void *opaque);
+/* port 0 or path NULL disables that listener, at least one must be set */
+int metrics_start(struct metrics_server *, int port, const char *path,
+				  metrics_collect_cb cb, void *opaque);
+void metrics_stop(struct metrics_server *);
+#endif
@@ -0,0 +1,377 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "nack.h"
+#include "crc32c.h"
+#include "logger.h"
+#include "metrics.h"
+/* ------------------------------------------------------------------------- */
+#define NACK_DEFAULT_WINDOW 8192
+#define NACK_HEARTBEAT_MS 200
+#define NACK_RECV_SIZE 2048
+
+/* ------------------------------------------------------------------------- */
+static int64_t monotonic_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+static void put32(unsigned char *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+static uint32_t get32(const unsigned char *p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+int udp_datapack_encode(const struct udp_datapack *pack, unsigned char *wire) {
+	wire[0] = pack->type;
+	put32(wire + 1, pack->label);
+	put32(wire + 5, pack->size);
+	put32(wire + 9, pack->check);
+	return UDP_HEAD_LEN;
+}
+int udp_datapack_decode(struct udp_datapack *pack, const unsigned char *wire, int len) {
+	if (len < UDP_HEAD_LEN) return -1;
+	pack->type = wire[0];
+	pack->label = get32(wire + 1);
+	pack->size = get32(wire + 5);
+	pack->check = get32(wire + 9);
+	if (pack->size < 0 || pack->size > len - UDP_HEAD_LEN || pack->size > UDP_DATA_MAX)
+		return -1;
+	memcpy(pack->data, wire + UDP_HEAD_LEN, pack->size);
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+static void send_control(struct nack_sender *s, char type, uint32_t label, uint32_t size,
+						 const struct sockaddr_in *to) {
+	struct udp_datapack pack;
+	unsigned char wire[UDP_HEAD_LEN];
+	memset(&pack, 0, sizeof(pack));
+	pack.type = type;
+	pack.label = label;
+	pack.size = size;
+	udp_datapack_encode(&pack, wire);
+	/* control packets carry no data, size is the range length */
+	sendto(s->fd, wire, sizeof(wire), 0, (const struct sockaddr *)to, sizeof(*to));
+}
+/* resend [seq, seq + count), report the part that already left the window */
+static void resend_range(struct nack_sender *s, uint32_t seq, uint32_t count,
+						 const struct sockaddr_in *from) {
+	unsigned char wire[UDP_HEAD_LEN + UDP_DATA_MAX];
+	struct nack_slot *slot;
+	uint32_t fail_seq = 0, fail_count = 0, len;
+	int64_t now = monotonic_now();
+
+	if (count > s->window) count = s->window;
+	for (; count; count--, seq++) {
+		len = 0;
+		pthread_mutex_lock(&s->lock);
+		slot = &s->slots[seq % s->window];
+		/* seq must be behind next_seq, serial number arithmetic */
+		if (slot->len && slot->seq == seq && (int32_t)(s->next_seq - seq) > 0) {
+			if (now - slot->resent >= NACK_MIN_RESEND_US) {
+				slot->resent = now;
+				len = slot->len;
+				memcpy(wire, slot->wire, len);
+				s->resent++;
+			}
+		} else if ((int32_t)(s->next_seq - seq) > 0) {
+			if (!fail_count) fail_seq = seq;
+			fail_count++;
+			s->expired++;
+		}
+		pthread_mutex_unlock(&s->lock);
+		if (!len) continue;
+		if (sendto(s->fd, wire, len, 0, (struct sockaddr *)&s->dst, sizeof(s->dst)) < 0)
+			metrics_send_error(METRICS_OUT_RESEND, errno);
+		else
+			metrics_sent(METRICS_OUT_RESEND, len, 1);
+	}
+	if (fail_count) send_control(s, ACK_FAIL, fail_seq, fail_count, from);
+}
+static void *nack_loop(void *arg) {
+	struct nack_sender *s = arg;
+	struct sockaddr_in from;
+	struct pollfd pfd;
+	socklen_t fromlen;
+	unsigned char buf[NACK_RECV_SIZE];
+	uint64_t heartbeat_sent = 0;
+	int n, i;
+
+	pfd.fd = s->fd;
+	pfd.events = POLLIN;
+	while (!s->exit) {
+		if (poll(&pfd, 1, NACK_HEARTBEAT_MS) <= 0) {
+			/* idle on the NACK side, announce the tail if data went out */
+			pthread_mutex_lock(&s->lock);
+			n = s->sent != heartbeat_sent;
+			heartbeat_sent = s->sent;
+			pthread_mutex_unlock(&s->lock);
+			if (n) send_control(s, ACK_TRUE, s->next_seq - 1, 0, &s->dst);
+			continue;
+		}
+		fromlen = sizeof(from);
+		n = recvfrom(s->fd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&from,
+					 &fromlen);
+		/* in a NACK size is a count, the header is all that has to be valid */
+		if (n < UDP_HEAD_LEN || buf[0] != REQ_FILE)
+			continue;
+		resend_range(s, get32(buf + 1), get32(buf + 5), &from);
+		for (i = 0; i + 8 <= n - UDP_HEAD_LEN; i += 8)
+			resend_range(s, get32(buf + UDP_HEAD_LEN + i), get32(buf + UDP_HEAD_LEN + i + 4),
+						 &from);
+	}
+	return NULL;
+}
+/* ------------------------------------------------------------------------- */
+int nack_start(struct nack_sender *s, int fd, const struct sockaddr_in *dst,
+			   unsigned int window) {
+	memset(s, 0, sizeof(*s));
+	s->fd = fd;
+	s->dst = *dst;
+	s->window = window ? window : NACK_DEFAULT_WINDOW;
+	s->slots = calloc(s->window, sizeof(*s->slots));
+	if (!s->slots) {
+		log_error("nack: out of memory for a window of %u", s->window);
+		return -1;
+	}
+	pthread_mutex_init(&s->lock, NULL);
+	if (pthread_create(&s->tid, NULL, nack_loop, s) != 0) {
+		pthread_mutex_destroy(&s->lock);
+		free(s->slots);
+		s->slots = NULL;
+		return -1;
+	}
+	send_control(s, ACK_RECONNECT, s->next_seq, 0, &s->dst);
+	log_info("nack: retransmit window of %u datagrams (%u KB)", s->window,
+			 (unsigned int)((uint64_t)s->window * sizeof(struct nack_slot) >> 10));
+	return 0;
+}
+void nack_send(struct nack_sender *s, const char *buf, int len) {
+	struct udp_datapack pack;
+	struct nack_slot *slot;
+	ssize_t ret;
+	int chunk;
+
+	memset(&pack, 0, sizeof(pack));
+	pack.type = FILE_DATE;
+	while (len > 0) {
+		chunk = len < UDP_DATA_MAX ? len : UDP_DATA_MAX;
+		pthread_mutex_lock(&s->lock);
+		pack.label = s->next_seq;
+		pack.size = chunk;
+		pack.check = crc32c(buf, chunk);
+		slot = &s->slots[s->next_seq % s->window];
+		slot->seq = s->next_seq++;
+		slot->resent = 0;
+		slot->len = udp_datapack_encode(&pack, slot->wire) + chunk;
+		memcpy(slot->wire + UDP_HEAD_LEN, buf, chunk);
+		s->sent++;
+		pthread_mutex_unlock(&s->lock);
+		/* only this thread writes slots, reading it unlocked is safe */
+		while ((ret = sendto(s->fd, slot->wire, slot->len, 0, (struct sockaddr *)&s->dst,
+							 sizeof(s->dst))) < 0 && errno == EINTR)
+			;
+		if (ret < 0)
+			metrics_send_error(METRICS_OUT_RELIABLE, errno);
+		else
+			metrics_sent(METRICS_OUT_RELIABLE, ret, 1);
+		if (s->sent_cb) s->sent_cb(s->sent_opaque, slot->seq, slot->wire, slot->len);
+		buf += chunk;
+		len -= chunk;
+	}
+}
+void nack_stop(struct nack_sender *s) {
+	if (!s->slots) return;
+	s->exit = 1;
+	pthread_join(s->tid, NULL);
+	log_info("nack: sent %llu, resent %llu, expired %llu",
+			 (unsigned long long)s->sent, (unsigned long long)s->resent,
+			 (unsigned long long)s->expired);
+	pthread_mutex_destroy(&s->lock);
+	free(s->slots);
+	s->slots = NULL;
+}
+/* ------------------------------------------------------------------------- */
+void nack_receiver_init(struct nack_receiver *r) {
+	memset(r, 0, sizeof(*r));
+}
+static void range_remove(struct nack_receiver *r, unsigned int i) {
+	memmove(&r->range[i], &r->range[i + 1], (r->ranges - i - 1) * sizeof(r->range[0]));
+	r->ranges--;
+}
+/* a new range at the tail, the oldest is given up when there is no room */
+static void range_add(struct nack_receiver *r, uint32_t seq, uint32_t count) {
+	struct nack_range *g;
+	if (r->ranges == NACK_RANGES) {
+		r->abandoned += r->range[0].count;
+		range_remove(r, 0);
+	}
+	g = &r->range[r->ranges++];
+	g->seq = seq;
+	g->count = count;
+	g->nacked = 0;
+	g->tries = 0;
+}
+/* take offsets [lo, hi) out of range i */
+static void range_cut(struct nack_receiver *r, unsigned int i, uint32_t lo, uint32_t hi) {
+	struct nack_range *g = &r->range[i];
+	if (lo == 0 && hi == g->count) {
+		range_remove(r, i);
+		return;
+	}
+	if (lo == 0) {
+		g->seq += hi;
+		g->count -= hi;
+		return;
+	}
+	if (hi == g->count) {
+		g->count = lo;
+		return;
+	}
+	/* a hole in the middle splits the range */
+	if (r->ranges == NACK_RANGES) {
+		if (i == 0) {
+			/* no room and it is the oldest: its head is given up */
+			r->abandoned += lo;
+			g->seq += hi;
+			g->count -= hi;
+			return;
+		}
+		r->abandoned += r->range[0].count;
+		range_remove(r, 0);
+		g = &r->range[--i];
+	}
+	memmove(&r->range[i + 2], &r->range[i + 1], (r->ranges - i - 1) * sizeof(*g));
+	r->ranges++;
+	r->range[i + 1] = *g;
+	r->range[i + 1].seq = g->seq + hi;
+	r->range[i + 1].count = g->count - hi;
+	g->count = lo;
+}
+int nack_receiver_data(struct nack_receiver *r, uint32_t seq, uint32_t *missing) {
+	unsigned int i;
+	int32_t diff;
+	*missing = 0;
+	if (!r->have_seq) {
+		r->have_seq = 1;
+		r->next_seq = seq;
+	}
+	diff = (int32_t)(seq - r->next_seq);
+	if (diff >= 0) {
+		if (diff > 0) range_add(r, r->next_seq, diff);
+		*missing = diff;
+		r->next_seq = seq + 1;
+		return NACK_NEW;
+	}
+	for (i = 0; i < r->ranges; ++i) {
+		if (seq - r->range[i].seq >= r->range[i].count) continue;
+		range_cut(r, i, seq - r->range[i].seq, seq - r->range[i].seq + 1);
+		r->recovered++;
+		return NACK_RECOVERED;
+	}
+	return NACK_DUPLICATE;
+}
+uint32_t nack_receiver_control(struct nack_receiver *r, int type, uint32_t label,
+							   uint32_t size) {
+	struct nack_range *g;
+	unsigned int i;
+	int64_t lo, hi;
+	int32_t diff;
+
+	switch (type) {
+	case ACK_TRUE:
+		/* joined late: whatever was sent before is not ours to ask for */
+		if (!r->have_seq) {
+			r->have_seq = 1;
+			r->next_seq = label + 1;
+			return 0;
+		}
+		diff = (int32_t)(label + 1 - r->next_seq);
+		if (diff <= 0) return 0;
+		range_add(r, r->next_seq, diff);
+		r->next_seq = label + 1;
+		return diff;
+	case ACK_FAIL:
+		/* newest first, a split or removal only moves the ranges after i */
+		for (i = r->ranges; i-- > 0;) {
+			g = &r->range[i];
+			lo = (int32_t)(label - g->seq);
+			hi = lo + size;
+			if (lo < 0) lo = 0;
+			if (hi > g->count) hi = g->count;
+			if (hi <= lo) continue;
+			r->expired += hi - lo;
+			range_cut(r, i, lo, hi);
+		}
+		return 0;
+	case ACK_RECONNECT:
+		r->ranges = 0;
+		r->have_seq = 1;
+		r->next_seq = label;
+		return 0;
+	}
+	return 0;
+}
+int nack_receiver_poll(struct nack_receiver *r, unsigned char *wire) {
+	struct udp_datapack pack;
+	struct nack_range *g;
+	int64_t now = monotonic_now();
+	unsigned int i = 0;
+	int n = 0;
+
+	memset(&pack, 0, sizeof(pack));
+	pack.type = REQ_FILE;
+	while (i < r->ranges) {
+		g = &r->range[i];
+		if (g->nacked && now - g->nacked < NACK_RETRY_US) {
+			++i;
+			continue;
+		}
+		if (g->tries == NACK_RETRIES) {
+			r->abandoned += g->count;
+			range_remove(r, i);
+			continue;
+		}
+		if (!g->tries) r->requested += g->count;
+		g->tries++;
+		g->nacked = now;
+		/* the first range goes in the header, the others follow it */
+		if (!n) {
+			pack.label = g->seq;
+			pack.size = g->count;
+		} else {
+			put32(wire + UDP_HEAD_LEN + 8 * (n - 1), g->seq);
+			put32(wire + UDP_HEAD_LEN + 8 * (n - 1) + 4, g->count);
+		}
+		++n;
+		++i;
+	}
+	if (!n) return 0;
+	return udp_datapack_encode(&pack, wire) + 8 * (n - 1);
+}
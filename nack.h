@@ -0,0 +1,149 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+*
+* This file is part of udpproxy.
+*
+* udpproxy is free software; you can redistribute it and/or
+        * modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+        * version 2.1 of the License, or (at your option) any later version.
+*
+* udpproxy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#ifndef __NACK_H__
+#define __NACK_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+/* Reliable mode: NACK based retransmission over the udp_datapack framing.
+ *
+ * Every datagram starts with a UDP_HEAD_LEN byte header, all fields big
+ * endian:
+ *
+ *   type(1) label(4) size(4) check(4) data(size)
+ *
+ *   FILE_DATE      sender -> receiver, label = sequence number, data = TS,
+ *                  check = CRC32C of data (crc32c.h)
+ *   REQ_FILE       receiver -> sender (NACK), label = first missing
+ *                  sequence, size = number of missing datagrams; data may
+ *                  hold more (sequence, count) pairs of 4 bytes each
+ *   ACK_FAIL       sender -> receiver, label/size = range that is no
+ *                  longer in the retransmit window, stop asking for it
+ *   ACK_TRUE       sender -> receiver heartbeat, label = last sequence
+ *                  sent, lets receivers detect loss at the tail
+ *   ACK_RECONNECT  sender -> receiver, label = first sequence of a new
+ *                  session; receivers drop their gap state
+ *
+ * Sequence numbers are 32 bit and wrap. The sender keeps the last
+ * window datagrams in memory and answers NACKs from any receiver, so it
+ * also works for multicast; one datagram is resent at most once per
+ * NACK_MIN_RESEND_US however many receivers ask for it.
+ *
+ * A receiver (struct nack_receiver) keeps the ranges it found missing
+ * and asks for them again every NACK_RETRY_US until they arrive, the
+ * sender answers ACK_FAIL for them or NACK_RETRIES requests went
+ * unanswered. A tail loss shows up with the next ACK_TRUE. */
+#define REQ_FILE		0
+#define ACK_TRUE		1
+#define ACK_FAIL		2
+#define ACK_RECONNECT   3
+#define FILE_DATE		4
+
+/* answer the same datagram at most this often */
+#define NACK_MIN_RESEND_US 20000
+#define NACK_RETRY_US	(2 * NACK_MIN_RESEND_US)
+#define NACK_RETRIES	5
+#define NACK_RANGES		64
+
+#define UDP_HEAD_LEN	13
+/* 7 TS packets, a datagram stays below a 1500 byte MTU */
+#define UDP_DATA_MAX	(7 * 188)
+
+struct udp_datapack {
+	char type;
+	long int label;
+	int size;
+	int check;
+	char data[UDP_DATA_MAX];
+};
+
+struct nack_slot {
+	uint32_t seq;
+	uint32_t len;                 /* wire length, 0 if empty */
+	int64_t resent;               /* monotonic time of the last resend */
+	unsigned char wire[UDP_HEAD_LEN + UDP_DATA_MAX];
+};
+
+struct nack_sender {
+	int fd;
+	struct sockaddr_in dst;
+	uint32_t next_seq;
+	unsigned int window;
+	struct nack_slot *slots;
+	int exit;
+	pthread_t tid;
+	pthread_mutex_t lock;         /* slots and next_seq */
+	uint64_t sent;
+	uint64_t resent;
+	uint64_t expired;
+	/* optional, called by nack_send() for every new datagram after it is
+	 * sent, e.g. to feed FEC; set before the first nack_send() */
+	void (*sent_cb)(void *opaque, uint32_t seq, const unsigned char *wire, int len);
+	void *sent_opaque;
+};
+
+/* fd is the output socket, NACKs arrive on it from the receivers */
+int nack_start(struct nack_sender *, int fd, const struct sockaddr_in *dst,
+			   unsigned int window);
+/* frames buf into FILE_DATE datagrams, sends and keeps them for resend */
+void nack_send(struct nack_sender *, const char *buf, int len);
+void nack_stop(struct nack_sender *);
+
+/* ------------------------------------------------------------------------- */
+struct nack_range {
+	uint32_t seq;
+	uint32_t count;
+	int64_t nacked;               /* monotonic time of the last request, 0 never */
+	int tries;
+};
+
+struct nack_receiver {
+	int have_seq;
+	uint32_t next_seq;
+	unsigned int ranges;          /* oldest first */
+	struct nack_range range[NACK_RANGES];
+	uint64_t requested;           /* datagrams asked for, first request only */
+	uint64_t recovered;
+	uint64_t expired;             /* reported by ACK_FAIL */
+	uint64_t abandoned;           /* out of retries or of ranges */
+};
+
+/* nack_receiver_data() results */
+#define NACK_NEW		0
+#define NACK_RECOVERED	1
+#define NACK_DUPLICATE	2
+
+void nack_receiver_init(struct nack_receiver *);
+/* FILE_DATE seq arrived; *missing is set to the number of datagrams
+ * found missing ahead of a NACK_NEW one */
+int nack_receiver_data(struct nack_receiver *, uint32_t seq, uint32_t *missing);
+/* ACK_TRUE, ACK_FAIL or ACK_RECONNECT from the sender; returns the
+ * number of datagrams a heartbeat found missing at the tail */
+uint32_t nack_receiver_control(struct nack_receiver *, int type, uint32_t label,
+							   uint32_t size);
+/* REQ_FILE for the ranges that are due into wire (UDP_HEAD_LEN + 8 *
+ * NACK_RANGES bytes); returns its length, 0 if nothing is due */
+int nack_receiver_poll(struct nack_receiver *, unsigned char *wire);
+
+int udp_datapack_encode(const struct udp_datapack *, unsigned char *wire);
+/* for FILE_DATE, returns -1 if wire is shorter than its header claims */
+int udp_datapack_decode(struct udp_datapack *, const unsigned char *wire, int len);
+#endif
@@ -0,0 +1,296 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+/* NACK drop and recover check.
+ *
+ *     udpproxy-nacktest [window] [port]
+ *
+ * A nack_sender with a retransmit window of window datagrams (default 64)
+ * sends to a nack_receiver on 127.0.0.1 port. The receiver drops every
+ * tenth datagram and a run of five on their first arrival and asks for
+ * them with nack_receiver_poll(); every retransmission has to fill its
+ * gap with the original bytes. Then
+ *   - two NACKs for one datagram within NACK_MIN_RESEND_US get a single
+ *     retransmission, a third one after that interval gets another;
+ *   - a gap left alone until the sender has moved a window on and a
+ *     fresh one, asked for in the same NACK, get an ACK_FAIL for the old
+ *     datagram and a retransmission of the fresh one. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "nack.h"
+#include "crc32c.h"
+#include "logger.h"
+/* ------------------------------------------------------------------------- */
+#define TEST_BATCH_DIV 2          /* half a window at a time */
+#define TEST_BATCH_MAX 32         /* well inside the socket receive buffer */
+#define TEST_BATCHES 8
+#define TEST_RUN_START 40
+#define TEST_RUN_LEN 5
+#define TEST_TIMEOUT_MS 2000
+
+struct test {
+	int fd;
+	struct sockaddr_in sender;
+	int have_sender;
+	struct nack_receiver rx;
+	unsigned int count;           /* sequences the test can send */
+	uint32_t sent;
+	unsigned char *drop;          /* drop the first arrival of seq */
+	unsigned char *got;
+	unsigned int dropped;
+	uint32_t watch;               /* arrivals of this seq are counted */
+	unsigned int watch_count;
+	unsigned int fails;
+	uint32_t fail_seq;
+	uint32_t fail_count;
+	int failed;
+};
+
+/* ------------------------------------------------------------------------- */
+static int64_t now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+static uint32_t get32(const unsigned char *p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+static int payload(uint32_t seq, char *buf) {
+	int i, len = 1 + seq * 37 % UDP_DATA_MAX;
+	for (i = 0; i < len; i++) buf[i] = (char)(seq * 31 + i);
+	return len;
+}
+static void on_datagram(struct test *t, const unsigned char *wire, int len) {
+	struct udp_datapack pack;
+	char expect[UDP_DATA_MAX];
+	uint32_t seq, missing;
+	int n;
+
+	/* in control packets size is a count, only the header is there */
+	if (len >= UDP_HEAD_LEN && wire[0] != FILE_DATE) {
+		if (wire[0] == ACK_FAIL) {
+			t->fails++;
+			t->fail_seq = get32(wire + 1);
+			t->fail_count = get32(wire + 5);
+		}
+		nack_receiver_control(&t->rx, wire[0], get32(wire + 1), get32(wire + 5));
+		return;
+	}
+	if (udp_datapack_decode(&pack, wire, len) < 0) {
+		fprintf(stderr, "datagram of %d bytes does not decode\n", len);
+		t->failed = 1;
+		return;
+	}
+	seq = pack.label;
+	if (seq >= t->count) {
+		fprintf(stderr, "seq %u was never sent\n", seq);
+		t->failed = 1;
+		return;
+	}
+	if (t->drop[seq]) {
+		t->drop[seq] = 0;
+		t->dropped++;
+		return;
+	}
+	n = payload(seq, expect);
+	if (pack.size != n || memcmp(pack.data, expect, n) ||
+		(uint32_t)pack.check != crc32c(pack.data, pack.size)) {
+		fprintf(stderr, "seq %u: payload differs from what was sent\n", seq);
+		t->failed = 1;
+		return;
+	}
+	if (seq == t->watch) t->watch_count++;
+	if (nack_receiver_data(&t->rx, seq, &missing) != NACK_DUPLICATE) t->got[seq]++;
+}
+/* receive for up to ms, asking for what is missing if nack is set;
+ * returns early once done(t) holds */
+static void pump(struct test *t, int ms, int nack, int (*done)(const struct test *)) {
+	unsigned char buf[UDP_HEAD_LEN + UDP_DATA_MAX], wire[UDP_HEAD_LEN + 8 * NACK_RANGES];
+	struct sockaddr_in from;
+	struct pollfd pfd = { t->fd, POLLIN, 0 };
+	socklen_t fromlen;
+	int64_t end = now_ms() + ms;
+	int n;
+
+	while (now_ms() < end && !(done && done(t))) {
+		if (poll(&pfd, 1, 5) > 0) {
+			fromlen = sizeof(from);
+			n = recvfrom(t->fd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromlen);
+			if (n <= 0) continue;
+			t->sender = from;
+			t->have_sender = 1;
+			on_datagram(t, buf, n);
+		}
+		if (nack && t->have_sender && (n = nack_receiver_poll(&t->rx, wire)) > 0)
+			sendto(t->fd, wire, n, 0, (struct sockaddr *)&t->sender, sizeof(t->sender));
+	}
+}
+static int caught_up(const struct test *t) {
+	return t->rx.have_seq && t->rx.next_seq == t->sent;
+}
+/* a loss at the tail only shows with the next heartbeat */
+static int all_received(const struct test *t) {
+	return t->rx.have_seq && t->rx.next_seq == t->sent && !t->rx.ranges;
+}
+static void send_seq(struct test *t, struct nack_sender *s) {
+	char buf[UDP_DATA_MAX];
+	nack_send(s, buf, payload(s->next_seq, buf));
+	t->sent = s->next_seq;
+}
+static void send_nack(struct test *t, uint32_t seq, uint32_t count) {
+	struct udp_datapack pack;
+	unsigned char wire[UDP_HEAD_LEN];
+	memset(&pack, 0, sizeof(pack));
+	pack.type = REQ_FILE;
+	pack.label = seq;
+	pack.size = count;
+	udp_datapack_encode(&pack, wire);
+	sendto(t->fd, wire, sizeof(wire), 0, (struct sockaddr *)&t->sender, sizeof(t->sender));
+}
+static uint64_t resent(struct nack_sender *s) {
+	uint64_t n;
+	pthread_mutex_lock(&s->lock);
+	n = s->resent;
+	pthread_mutex_unlock(&s->lock);
+	return n;
+}
+/* ------------------------------------------------------------------------- */
+int main(int argc, char *argv[]) {
+	static struct test t;
+	struct nack_sender s;
+	struct sockaddr_in addr;
+	unsigned int window = 64, batch, i, j, drops;
+	unsigned short port = 29100;
+	uint32_t old, fresh;
+	uint64_t r0;
+	int sfd, recover_ok, dedup_ok, fail_ok;
+
+	/* the tool reports on stdout, the process logger is never opened */
+	log_set_level(LOG_LEVEL_MAX);
+	if (argc > 1) window = atoi(argv[1]);
+	if (argc > 2) port = atoi(argv[2]);
+	if (window < 2 * TEST_RUN_LEN) {
+		fprintf(stderr, "window must be at least %d\n", 2 * TEST_RUN_LEN);
+		return 1;
+	}
+	batch = window / TEST_BATCH_DIV < TEST_BATCH_MAX ? window / TEST_BATCH_DIV : TEST_BATCH_MAX;
+	t.count = batch * TEST_BATCHES + window + 2;
+	t.drop = calloc(t.count, 1);
+	t.got = calloc(t.count, 1);
+	if (!t.drop || !t.got) return 1;
+	t.watch = (uint32_t)-1;
+	nack_receiver_init(&t.rx);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	t.fd = socket(AF_INET, SOCK_DGRAM, 0);
+	sfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (t.fd < 0 || sfd < 0 || bind(t.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		return 1;
+	}
+	if (nack_start(&s, sfd, &addr, window) < 0) {
+		fprintf(stderr, "nack_start failed\n");
+		return 1;
+	}
+
+	/* drop and recover a batch at a time, every gap is still in the window */
+	for (i = 0; i < batch * TEST_BATCHES; i++)
+		t.drop[i] = i % 10 == 3 || (i >= TEST_RUN_START && i < TEST_RUN_START + TEST_RUN_LEN);
+	for (i = 0, drops = 0; i < batch * TEST_BATCHES; i++) drops += t.drop[i];
+	for (i = 0; i < TEST_BATCHES; i++) {
+		for (j = 0; j < batch; j++) send_seq(&t, &s);
+		pump(&t, TEST_TIMEOUT_MS, 1, all_received);
+	}
+	recover_ok = t.dropped == drops && t.rx.recovered == drops && all_received(&t) &&
+				 !memchr(t.got, 0, t.sent) && !t.rx.expired && !t.rx.abandoned;
+	if (!recover_ok) {
+		fprintf(stderr, "dropped %u of %u, recovered %llu, expired %llu, abandoned %llu, "
+				"%u ranges open\n", t.dropped, drops, (unsigned long long)t.rx.recovered,
+				(unsigned long long)t.rx.expired, (unsigned long long)t.rx.abandoned,
+				t.rx.ranges);
+		t.failed = 1;
+	}
+
+	/* one retransmission per NACK_MIN_RESEND_US however often it is asked for */
+	usleep(NACK_MIN_RESEND_US);
+	t.watch = s.next_seq - 1;
+	t.watch_count = 0;
+	r0 = resent(&s);
+	send_nack(&t, t.watch, 1);
+	send_nack(&t, t.watch, 1);
+	pump(&t, NACK_MIN_RESEND_US / 2000, 0, NULL);
+	dedup_ok = t.watch_count == 1 && resent(&s) - r0 == 1;
+	if (!dedup_ok) {
+		fprintf(stderr, "two NACKs within %dus: seq %u resent %llu times, arrived %u times\n",
+				NACK_MIN_RESEND_US, t.watch, (unsigned long long)(resent(&s) - r0),
+				t.watch_count);
+		t.failed = 1;
+	}
+	usleep(NACK_MIN_RESEND_US);
+	send_nack(&t, t.watch, 1);
+	pump(&t, NACK_MIN_RESEND_US / 1000, 0, NULL);
+	if (t.watch_count != 2 || resent(&s) - r0 != 2) {
+		dedup_ok = 0;
+		fprintf(stderr, "NACK after %dus: seq %u resent %llu times, arrived %u times\n",
+				NACK_MIN_RESEND_US, t.watch, (unsigned long long)(resent(&s) - r0),
+				t.watch_count);
+		t.failed = 1;
+	}
+
+	/* a gap the window has moved past is answered with ACK_FAIL */
+	old = s.next_seq;
+	t.drop[old] = 1;
+	for (i = 0; i < window + 1; i++) {
+		send_seq(&t, &s);
+		if (i % batch == batch - 1) pump(&t, TEST_TIMEOUT_MS, 0, caught_up);
+	}
+	fresh = s.next_seq - 1;
+	t.drop[fresh] = 1;
+	send_seq(&t, &s);
+	pump(&t, 100, 0, NULL);
+	r0 = t.rx.recovered;
+	pump(&t, TEST_TIMEOUT_MS, 1, all_received);
+	fail_ok = t.fails == 1 && t.fail_seq == old && t.fail_count == 1 && t.rx.expired == 1 &&
+			  t.rx.recovered - r0 == 1 && t.got[fresh] && !t.rx.ranges && s.expired == 1;
+	if (!fail_ok) {
+		fprintf(stderr, "%u ACK_FAIL (seq %u count %u, want %u 1), expired %llu, "
+				"seq %u %s, %u ranges open\n", t.fails, t.fail_seq, t.fail_count, old,
+				(unsigned long long)t.rx.expired, fresh,
+				t.got[fresh] ? "recovered" : "not recovered", t.rx.ranges);
+		t.failed = 1;
+	}
+
+	printf("window %u: %u drops %s, resend dedup %s, ACK_FAIL %s\n", window, drops,
+		   recover_ok ? "recovered" : "NOT recovered", dedup_ok ? "ok" : "FAILED",
+		   fail_ok ? "ok" : "FAILED");
+	nack_stop(&s);
+	close(sfd);
+	close(t.fd);
+	free(t.drop);
+	free(t.got);
+	return t.failed;
+}
@@ -0,0 +1,147 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "playlist.h"
+#include "logger.h"
+/* ------------------------------------------------------------------------- */
+#define TAG_EXTINF "#EXTINF:"
+#define TAG_MEDIA_SEQUENCE "#EXT-X-MEDIA-SEQUENCE:"
+#define TAG_ENDLIST "#EXT-X-ENDLIST"
+/* #EXT-X-MEDIA-SEQUENCE must appear before the first segment, FFmpeg
+ * writes it within the first few lines */
+#define HEADER_READ_LEN 1024
+
+/* ------------------------------------------------------------------------- */
+static int64_t parse_int(const char *p) {
+	int64_t v = 0;
+	while (*p >= '0' && *p <= '9') v = v * 10 + (*p++ - '0');
+	return v;
+}
+/* "6.006000," -> 6006000 microseconds, without going through a double */
+static int64_t parse_duration(const char *p) {
+	int64_t us = 0, scale = 100000;
+	while (*p >= '0' && *p <= '9') us = us * 10 + (*p++ - '0');
+	us *= 1000000;
+	if (*p == '.') {
+		for (++p; *p >= '0' && *p <= '9'; ++p) {
+			us += (*p - '0') * scale;
+			scale /= 10;
+		}
+	}
+	return us;
+}
+static int64_t header_media_sequence(int fd, off_t size) {
+	char buf[HEADER_READ_LEN + 1];
+	ssize_t n = pread(fd, buf, size < HEADER_READ_LEN ? size : HEADER_READ_LEN, 0);
+	char *p;
+	if (n <= 0) return 0;
+	buf[n] = '\0';
+	p = strstr(buf, TAG_MEDIA_SEQUENCE);
+	return p ? parse_int(p + sizeof(TAG_MEDIA_SEQUENCE) - 1) : 0;
+}
+/* ------------------------------------------------------------------------- */
+int playlist_init(struct playlist *pl, const char *path) {
+	memset(pl, 0, sizeof(*pl));
+	pl->path = strdup(path);
+	if (!pl->path) return -1;
+	pl->media_sequence = -1;
+	pl->cursor_duration = -1;
+	return 0;
+}
+int playlist_update(struct playlist *pl, playlist_cb cb, void *opaque) {
+	struct stat st;
+	int fd, count = 0;
+	off_t start;
+	ssize_t n;
+	int64_t seq;
+	char *buf, *line, *eol, *end;
+
+	fd = open(pl->path, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			log_error("open playlist %s failed:%s", pl->path, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	seq = header_media_sequence(fd, st.st_size);
+	if (seq == pl->media_sequence && st.st_size >= pl->parsed_offset) {
+		/* same window, only parse what was appended */
+		start = pl->parsed_offset;
+	} else {
+		start = 0;
+		pl->parsed_offset = 0;
+		pl->media_sequence = seq;
+		pl->cursor_sequence = seq;
+		pl->cursor_duration = -1;
+		pl->ended = 0;
+	}
+	if (st.st_size == start) {
+		close(fd);
+		return 0;
+	}
+	buf = malloc(st.st_size - start + 1);
+	if (!buf) {
+		close(fd);
+		return -1;
+	}
+	n = pread(fd, buf, st.st_size - start, start);
+	close(fd);
+	if (n <= 0) {
+		free(buf);
+		return n < 0 ? -1 : 0;
+	}
+	buf[n] = '\0';
+	end = buf + n;
+
+	/* only complete lines are consumed, a partial last line is read again */
+	for (line = buf; line < end && (eol = memchr(line, '\n', end - line)); line = eol + 1) {
+		*eol = '\0';
+		if (eol > line && eol[-1] == '\r') eol[-1] = '\0';
+		if (!strncmp(line, TAG_EXTINF, sizeof(TAG_EXTINF) - 1)) {
+			pl->cursor_duration = parse_duration(line + sizeof(TAG_EXTINF) - 1);
+		} else if (!strncmp(line, TAG_ENDLIST, sizeof(TAG_ENDLIST) - 1)) {
+			pl->ended = 1;
+		} else if (line[0] && line[0] != '#') {
+			if (pl->cursor_sequence >= pl->next_sequence) {
+				cb(opaque, pl->cursor_sequence,
+				   pl->cursor_duration > 0 ? pl->cursor_duration : 0, line);
+				pl->next_sequence = pl->cursor_sequence + 1;
+				count++;
+			}
+			pl->cursor_sequence++;
+			pl->cursor_duration = -1;
+		}
+		pl->parsed_offset = start + (eol + 1 - buf);
+	}
+	free(buf);
+	return count;
+}
+void playlist_destroy(struct playlist *pl) {
+	free(pl->path);
+	pl->path = NULL;
+}
@@ -0,0 +1,52 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+*
+* This file is part of udpproxy.
+*
+* udpproxy is free software; you can redistribute it and/or
+        * modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+        * version 2.1 of the License, or (at your option) any later version.
+*
+* udpproxy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#ifndef __PLAYLIST_H__
+#define __PLAYLIST_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Incremental reader for the HLS media playlist FFmpeg keeps rewriting.
+ *
+ * playlist_update() reports every segment it has not reported before,
+ * in order, with its media sequence number and #EXTINF duration in
+ * microseconds. As long as #EXT-X-MEDIA-SEQUENCE is unchanged the new
+ * playlist is an extension of the old one, so only the bytes after the
+ * last complete line already parsed are read; when the window slides
+ * the playlist is parsed again and entries already reported are
+ * skipped by sequence number. next_sequence may be set after
+ * playlist_init() to resume after a restart. */
+typedef void (*playlist_cb)(void *opaque, int64_t sequence,
+							int64_t duration, const char *uri);
+
+struct playlist {
+	char *path;
+	int64_t media_sequence;   /* #EXT-X-MEDIA-SEQUENCE of the last parse */
+	int64_t next_sequence;    /* first sequence number not reported yet */
+	int64_t cursor_sequence;  /* sequence of the next URI at parsed_offset */
+	int64_t cursor_duration;  /* pending #EXTINF at parsed_offset, -1 if none */
+	off_t parsed_offset;      /* end of the last complete line parsed */
+	int ended;                /* #EXT-X-ENDLIST seen */
+};
+
+int playlist_init(struct playlist *, const char *path);
+/* returns the number of new segments reported, -1 on error */
+int playlist_update(struct playlist *, playlist_cb cb, void *opaque);
+void playlist_destroy(struct playlist *);
+#endif
@@ -0,0 +1,154 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "queue.h"
+#include "logger.h"
+/* ------------------------------------------------------------------------- */
+static int64_t monotonic_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+/* ------------------------------------------------------------------------- */
+void queue_init(struct file_queue *q) {
+	INIT_LIST_HEAD(&q->head);
+	q->file_count = 0;
+	q->queue_bytes = 0;
+	q->queued_timestamp = -1;
+	memset(q->name_table, 0, sizeof(q->name_table));
+}
+
+/*按时间戳顺序插入，返回0表示已插入，-1表示已存在相同时间戳*/
+int add_file_after(struct file_queue *q, struct file_infor *position) {
+	if (!position) return -1;
+	struct list_head *pos,*n;
+	struct file_infor *file_item = NULL;
+	list_for_each_prev_safe(pos, n, &q->head){
+		file_item = list_entry(pos, struct file_infor, list);
+        //如果列表已经存在，不插入直接退出；dummy与真实文件时间戳相同时真实文件排在后面
+		if (file_item->timestamp == position->timestamp &&
+            file_item->dummy_flag == position->dummy_flag)
+            return -1;
+        else if (file_item->timestamp == position->timestamp && file_item->dummy_flag)
+            break;
+        //找到第一个比当前待插入项时间戳小的后面插入
+		else if (file_item->timestamp < position->timestamp)
+            break;
+	}
+    //pos停在插入点前驱，遍历结束时为链表头
+    list_add(&(position->list), pos);
+    position->queue_time = monotonic_us();
+    q->file_count++;
+    q->queue_bytes += position->queued_len;
+    if (!position->dummy_flag && position->timestamp > q->queued_timestamp) 
+        q->queued_timestamp = position->timestamp;
+    log_debug("add %s into list,file_infor=%p,filename=%s,timestamp=%lld,filecount=%d",
+              position->dummy_flag ? "dummy file" : "file",position, position->file_path,
+              (long long)position->timestamp,q->file_count);
+    return 0;
+}
+
+/*向待发文件列表中添加新项*/
+void add_file_tail(struct file_queue *q, struct file_infor *new_info) {
+    if (new_info)  {
+        list_add_tail(&(new_info->list), &q->head);
+    }
+}
+
+void remove_list_file(struct file_queue *q, struct file_infor *del_info) {
+    if (del_info) {
+        if (del_info->file_fd >= 0) close(del_info->file_fd);
+        name_table_remove(q, del_info->name_hash);
+        q->queue_bytes -= del_info->queued_len;
+        free(del_info->data);
+
+        if (del_info->file_path) {
+            free(del_info->file_path);
+            del_info->file_path = NULL;
+        }
+        list_del(&del_info->list);
+
+        free(del_info);
+        del_info = NULL;
+    }
+    q->file_count--;
+}
+
+/*取得文件列表中末尾项*/
+struct file_infor* get_list_tail(struct file_queue *q) {
+    struct list_head *pos,*n;
+    struct file_infor *file_item = NULL;
+    list_for_each_prev_safe(pos, n, &q->head) {
+        file_item = list_entry(pos, struct file_infor, list);
+		if (file_item) return file_item;
+	}
+
+    return NULL;
+}
+/* ------------------------------------------------------------------------- */
+/*FNV-1a 64位哈希，0保留为空槽标记*/
+uint64_t name_hash(const char *name, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    while (len--) {
+        h ^= (unsigned char)*name++;
+        h *= 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+struct name_slot *name_table_find(struct file_queue *q, uint64_t h) {
+    int i = h & (NAME_TABLE_SIZE - 1);
+    while (q->name_table[i].hash) {
+        if (q->name_table[i].hash == h) return &q->name_table[i];
+        i = (i + 1) & (NAME_TABLE_SIZE - 1);
+    }
+    return NULL;
+}
+
+void name_table_insert(struct file_queue *q, uint64_t h, struct file_infor *info) {
+    int i = h & (NAME_TABLE_SIZE - 1);
+    while (q->name_table[i].hash && q->name_table[i].hash != h)
+        i = (i + 1) & (NAME_TABLE_SIZE - 1);
+    q->name_table[i].hash = h;
+    q->name_table[i].info = info;
+}
+
+/*删除后把后续簇元素前移，避免墓碑*/
+void name_table_remove(struct file_queue *q, uint64_t h) {
+    struct name_slot *slot = name_table_find(q, h);
+    int i, j, k;
+    if (!slot) return;
+    i = j = slot - q->name_table;
+    for (;;) {
+        q->name_table[i].hash = 0;
+        q->name_table[i].info = NULL;
+        for (;;) {
+            j = (j + 1) & (NAME_TABLE_SIZE - 1);
+            if (!q->name_table[j].hash) return;
+            k = q->name_table[j].hash & (NAME_TABLE_SIZE - 1);
+            if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) continue;
+            break;
+        }
+        q->name_table[i] = q->name_table[j];
+        i = j;
+    }
+}
@@ -0,0 +1,92 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+*
+* This file is part of udpproxy.
+*
+* udpproxy is free software; you can redistribute it and/or
+        * modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+        * version 2.1 of the License, or (at your option) any later version.
+*
+* udpproxy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#ifndef __QUEUE_H__
+#define __QUEUE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "list.h"
+
+/* Send queue: the segments waiting to be sent, ordered by timestamp,
+ * and an open addressing table of their file name hashes used to merge
+ * repeated inotify events for the same file.
+ *
+ * Nothing here locks; the caller holds its queue mutex (file_list_mutex
+ * in udp.c). Queued file_infor items belong to the queue and are freed
+ * by remove_list_file(). */
+#define MAX_UDP_FILE_COUNT 512
+/* power of two, larger than MAX_UDP_FILE_COUNT so probes stay short */
+#define NAME_TABLE_SIZE 2048
+
+/*传输的文件信息*/
+struct  file_infor {
+    int   file_fd;
+    char *file_path; //文件名
+    unsigned long  file_len;   //文件长度
+    int64_t  timestamp;  //文件开始时间戳信息
+    off_t  seek_flag;
+    int      timeout;    /*超时计时*/
+    int      dummy_flag;
+    uint64_t name_hash;  //文件名哈希，用于inotify事件合并
+    int      growing;    //tail模式下文件仍在写入，由file_list_mutex保护
+    int64_t  duration;   //playlist模式下#EXTINF给出的时长(微秒)，0表示未知
+    int64_t  sequence;   //playlist模式下的媒体序号，写入检查点
+    char    *data;       //stream模式下内存中的分片，NULL表示从文件发送
+    int64_t  send_start; //开始发送的单调时钟，用于时长未知时推算RTP时间戳
+    uint32_t crc;        //segment_crc打开时已发送数据的CRC32C
+    unsigned long queued_len; //入队时已知的长度，计入queue_bytes
+    //各阶段的单调时钟(微秒)，计入延迟直方图；arrive_time为0表示启动扫描发现的文件
+    int64_t  arrive_time;     //inotify事件、播放列表更新或stream切片完成
+    int64_t  queue_time;      //插入发送队列
+    int64_t  dequeue_time;    //发送线程取出
+    int64_t  first_byte_time; //第一个数据块发出前，0表示没有发送
+    int64_t  last_byte_time;  //最后一个数据块发出后
+    struct list_head list;
+};
+
+struct name_slot {
+	uint64_t hash;                /* 0 marks an empty slot */
+	struct file_infor *info;
+};
+
+struct file_queue {
+	struct list_head head;
+	int file_count;
+	uint64_t queue_bytes;         /* sum of queued_len */
+	int64_t queued_timestamp;     /* newest non dummy timestamp queued, -1 if none */
+	struct name_slot name_table[NAME_TABLE_SIZE];
+};
+
+void queue_init(struct file_queue *);
+/* inserts in timestamp order; a dummy and a real file with the same
+ * timestamp are both kept, the real one after the dummy. Returns 0, or
+ * -1 if an entry with the same timestamp and kind is already queued */
+int add_file_after(struct file_queue *, struct file_infor *);
+void add_file_tail(struct file_queue *, struct file_infor *);
+/* unlinks and frees the item, its fd, data and name table entry */
+void remove_list_file(struct file_queue *, struct file_infor *);
+struct file_infor *get_list_tail(struct file_queue *);
+
+/* FNV-1a 64 of the name, never 0 */
+uint64_t name_hash(const char *name, size_t len);
+struct name_slot *name_table_find(struct file_queue *, uint64_t hash);
+void name_table_insert(struct file_queue *, uint64_t hash, struct file_infor *info);
+void name_table_remove(struct file_queue *, uint64_t hash);
+#endif
@@ -0,0 +1,247 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+/* Microbenchmark for the send queue.
+ *
+ *     udpproxy-queuebench [-c] [max depth]
+ *
+ * Times the queue code udp.c really runs (queue.c) - add_file_after() in
+ * order, out of order and for duplicates, get_list_tail(),
+ * remove_list_file() from the head and the name table used to merge
+ * inotify events - at depths from MAX_UDP_FILE_COUNT up to max depth
+ * (default 1M). Reports ns/op and, when perf_event_open() is permitted,
+ * cache misses/op; -c prints CSV.
+ *
+ * Build with NDEBUG so the log_debug() in add_file_after() does not
+ * dominate. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "queue.h"
+/* ------------------------------------------------------------------------- */
+#define QB_DEFAULT_MAX_DEPTH (1 << 20)
+/* node visits one measurement may cost; bounds the O(depth) operations */
+#define QB_VISIT_BUDGET (1LL << 26)
+#define QB_MIN_OPS 16
+#define QB_MAX_OPS 4096
+
+static int qb_perf_fd = -1;
+static int qb_csv;
+static struct file_queue qb_queue;
+
+static int64_t qb_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+static void qb_perf_open(void) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	qb_perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+static void qb_perf_start(void) {
+	if (qb_perf_fd < 0) return;
+	ioctl(qb_perf_fd, PERF_EVENT_IOC_RESET, 0);
+	ioctl(qb_perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+static int64_t qb_perf_stop(void) {
+	uint64_t count;
+	if (qb_perf_fd < 0) return -1;
+	ioctl(qb_perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+	if (read(qb_perf_fd, &count, sizeof(count)) != sizeof(count)) return -1;
+	return count;
+}
+static void qb_report(const char *op, long depth, long ops, int64_t ns, int64_t misses) {
+	if (qb_csv) {
+		if (misses >= 0)
+			printf("%s,%ld,%ld,%.1f,%.2f\n", op, depth, ops, (double)ns / ops,
+				   (double)misses / ops);
+		else
+			printf("%s,%ld,%ld,%.1f,\n", op, depth, ops, (double)ns / ops);
+	} else {
+		if (misses >= 0)
+			printf("%-16s %8ld %6ld %12.1f %10.2f\n", op, depth, ops, (double)ns / ops,
+				   (double)misses / ops);
+		else
+			printf("%-16s %8ld %6ld %12.1f %10s\n", op, depth, ops, (double)ns / ops, "-");
+	}
+	fflush(stdout);
+}
+static long qb_ops(long depth) {
+	long ops = QB_VISIT_BUDGET / (depth ? depth : 1);
+	return ops < QB_MIN_OPS ? QB_MIN_OPS : ops > QB_MAX_OPS ? QB_MAX_OPS : ops;
+}
+/* same allocations queue_file_locked() makes */
+static struct file_infor *qb_item(int64_t timestamp) {
+	char path[64];
+	struct file_infor *item = calloc(1, sizeof(*item));
+	snprintf(path, sizeof(path), "/work/%lld.ts", (long long)timestamp);
+	item->file_path = strdup(path);
+	item->file_fd = -1;
+	item->timestamp = timestamp;
+	return item;
+}
+static uint64_t qb_rand(void) {
+	static uint64_t x = 88172645463325252ULL;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return x;
+}
+/* ------------------------------------------------------------------------- */
+static void qb_run(long depth) {
+	struct file_infor **items = malloc(depth * sizeof(*items));
+	struct file_infor **extra, probe;
+	long i, ops = qb_ops(depth);
+	/* random inserts stay in the queue, keep them from changing the depth */
+	long grow = ops < depth / 8 ? ops : depth / 8;
+	int64_t t, misses;
+	volatile uintptr_t sink = 0;
+
+	extra = malloc(ops * sizeof(*extra));
+	for (i = 0; i < depth; i++) items[i] = qb_item(i * 2);
+
+	/* in order: every insert lands right before the list head */
+	qb_perf_start();
+	t = qb_now_ns();
+	for (i = 0; i < depth; i++) add_file_after(&qb_queue, items[i]);
+	t = qb_now_ns() - t;
+	misses = qb_perf_stop();
+	qb_report("insert_in_order", depth, depth, t, misses);
+
+	/* out of order: odd timestamps between the queued even ones */
+	for (i = 0; i < grow; i++) extra[i] = qb_item((qb_rand() % depth) * 2 + 1);
+	qb_perf_start();
+	t = qb_now_ns();
+	for (i = 0; i < grow; i++)
+		if (add_file_after(&qb_queue, extra[i]) < 0) extra[i]->timestamp = -1;
+	t = qb_now_ns() - t;
+	misses = qb_perf_stop();
+	qb_report("insert_random", depth, grow, t, misses);
+	for (i = 0; i < grow; i++) {
+		if (extra[i]->timestamp >= 0) {
+			remove_list_file(&qb_queue, extra[i]);
+		} else {
+			free(extra[i]->file_path);
+			free(extra[i]);
+		}
+	}
+
+	/* duplicates: the walk ends on an equal timestamp and is refused */
+	memset(&probe, 0, sizeof(probe));
+	qb_perf_start();
+	t = qb_now_ns();
+	for (i = 0; i < ops; i++) {
+		probe.timestamp = (qb_rand() % depth) * 2;
+		sink += add_file_after(&qb_queue, &probe);
+	}
+	t = qb_now_ns() - t;
+	misses = qb_perf_stop();
+	qb_report("insert_duplicate", depth, ops, t, misses);
+
+	qb_perf_start();
+	t = qb_now_ns();
+	for (i = 0; i < QB_MAX_OPS; i++) sink += (uintptr_t)get_list_tail(&qb_queue);
+	t = qb_now_ns() - t;
+	misses = qb_perf_stop();
+	qb_report("tail", depth, QB_MAX_OPS, t, misses);
+
+	qb_perf_start();
+	t = qb_now_ns();
+	while (!list_empty(&qb_queue.head))
+		remove_list_file(&qb_queue, list_entry(qb_queue.head.next, struct file_infor, list));
+	t = qb_now_ns() - t;
+	misses = qb_perf_stop();
+	qb_report("pop", depth, depth, t, misses);
+
+	free(extra);
+	free(items);
+}
+/* the merge table is sized for MAX_UDP_FILE_COUNT queued files */
+static void qb_run_name_table(long depth) {
+	uint64_t *hashes = malloc(depth * sizeof(*hashes));
+	char name[64];
+	long i;
+	int64_t t, misses;
+	volatile uintptr_t sink = 0;
+
+	for (i = 0; i < depth; i++) {
+		snprintf(name, sizeof(name), "%ld.ts", 1500000000L + i);
+		hashes[i] = name_hash(name, strlen(name));
+	}
+	qb_perf_start();
+	t = qb_now_ns();
+	for (i = 0; i < depth; i++) name_table_insert(&qb_queue, hashes[i], NULL);
+	t = qb_now_ns() - t;
+	misses = qb_perf_stop();
+	qb_report("name_insert", depth, depth, t, misses);
+
+	qb_perf_start();
+	t = qb_now_ns();
+	for (i = 0; i < QB_MAX_OPS; i++)
+		sink += (uintptr_t)name_table_find(&qb_queue, hashes[qb_rand() % depth]);
+	t = qb_now_ns() - t;
+	misses = qb_perf_stop();
+	qb_report("name_find", depth, QB_MAX_OPS, t, misses);
+
+	qb_perf_start();
+	t = qb_now_ns();
+	for (i = 0; i < depth; i++) name_table_remove(&qb_queue, hashes[i]);
+	t = qb_now_ns() - t;
+	misses = qb_perf_stop();
+	qb_report("name_remove", depth, depth, t, misses);
+	free(hashes);
+}
+/* ------------------------------------------------------------------------- */
+int main(int argc, char *argv[]) {
+	long depth, max_depth = QB_DEFAULT_MAX_DEPTH;
+	int c;
+
+	while ((c = getopt(argc, argv, "c")) != -1) {
+		if (c == 'c') qb_csv = 1;
+	}
+	if (optind < argc) max_depth = atol(argv[optind]);
+	if (max_depth < MAX_UDP_FILE_COUNT) max_depth = MAX_UDP_FILE_COUNT;
+
+	/* also faults the name table in before it is timed */
+	queue_init(&qb_queue);
+	qb_perf_open();
+	if (qb_csv)
+		printf("op,depth,ops,ns_per_op,cache_misses_per_op\n");
+	else
+		printf("%-16s %8s %6s %12s %10s\n", "op", "depth", "ops", "ns/op", "misses/op");
+
+	for (depth = MAX_UDP_FILE_COUNT; depth <= max_depth; depth *= 8)
+		qb_run(depth);
+	if (depth / 8 != max_depth) qb_run(max_depth);
+	for (depth = MAX_UDP_FILE_COUNT / 4; depth < NAME_TABLE_SIZE; depth *= 2)
+		qb_run_name_table(depth);
+	if (qb_perf_fd >= 0) close(qb_perf_fd);
+	return 0;
+}
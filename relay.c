@@ -0,0 +1,359 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#define _GNU_SOURCE /* recvmmsg, sendmmsg */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "relay.h"
+#include "logger.h"
+#include "metrics.h"
+/* ------------------------------------------------------------------------- */
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+/* datagrams moved per recvmmsg()/sendmmsg() call */
+#define RELAY_BATCH 64
+/* one datagram, comfortably above 7 * 188 TS payloads */
+#define RELAY_SLOT_SIZE 2048
+/* GRO can coalesce up to 64KB into one read */
+#define RELAY_GRO_SLOT_SIZE 65536
+#define RELAY_DEFAULT_SLOTS 1024
+/* each GRO slot may hold ~40 datagrams, keep the ring around 8MB */
+#define RELAY_DEFAULT_GRO_SLOTS 128
+/* ring_slots from the configuration is rounded up to a power of 2 */
+#define RELAY_MAX_SLOTS (1U << 20)
+#define RELAY_RCVBUF (4 * 1024 * 1024)
+/* bounds the time the receiver needs to notice relay_stop() */
+#define RELAY_RECV_TIMEOUT_SEC 1
+/* the kernel reports UDP_GRO as an int but takes UDP_SEGMENT as a u16 */
+#define RELAY_GRO_CMSG_SPACE CMSG_SPACE(sizeof(int))
+#define RELAY_GSO_CMSG_SPACE CMSG_SPACE(sizeof(uint16_t))
+/* control buffers aligned for CMSG_FIRSTHDR() */
+union relay_gro_cmsg {
+	struct cmsghdr align;
+	char buf[RELAY_GRO_CMSG_SPACE];
+};
+union relay_gso_cmsg {
+	struct cmsghdr align;
+	char buf[RELAY_GSO_CMSG_SPACE];
+};
+
+/* ------------------------------------------------------------------------- */
+static int64_t monotonic_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+static int open_input(const struct relay_config *cfg) {
+	struct sockaddr_in addr;
+	struct ip_mreq mreq;
+	struct timeval tv;
+	int fd, on = 1, rcvbuf = RELAY_RCVBUF;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		log_error("relay: socket failed:%s", strerror(errno));
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(cfg->port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (cfg->ip && inet_pton(AF_INET, cfg->ip, &addr.sin_addr) != 1) {
+		log_error("relay: invalid address %s", cfg->ip);
+		close(fd);
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	tv.tv_sec = RELAY_RECV_TIMEOUT_SEC;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		log_error("relay: bind %s:%d failed:%s", cfg->ip ? cfg->ip : "*",
+				  cfg->port, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if (IN_MULTICAST(ntohl(addr.sin_addr.s_addr))) {
+		mreq.imr_multiaddr = addr.sin_addr;
+		mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+		if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+			log_error("relay: join %s failed:%s", cfg->ip, strerror(errno));
+	}
+	return fd;
+}
+/* contiguous run of slots starting at index, never wrapping */
+static unsigned int contiguous(const struct relay *r, unsigned int index,
+							   unsigned int count) {
+	unsigned int until_wrap = r->ring_slots - (index & r->mask);
+	if (count > until_wrap) count = until_wrap;
+	return count > RELAY_BATCH ? RELAY_BATCH : count;
+}
+/* ------------------------------------------------------------------------- */
+static void *relay_receiver(void *arg) {
+	struct relay *r = arg;
+	struct mmsghdr msgs[RELAY_BATCH];
+	struct iovec iov[RELAY_BATCH];
+	union relay_gro_cmsg control[RELAY_BATCH];
+	struct cmsghdr *cmsg;
+	unsigned int head, room, i, slot;
+	int n;
+
+	while (1) {
+		pthread_mutex_lock(&r->lock);
+		while (!r->exit && r->head - r->tail == r->ring_slots)
+			pthread_cond_wait(&r->cond, &r->lock);
+		if (r->exit) {
+			pthread_mutex_unlock(&r->lock);
+			break;
+		}
+		head = r->head;
+		room = contiguous(r, head, r->ring_slots - (head - r->tail));
+		pthread_mutex_unlock(&r->lock);
+
+		memset(msgs, 0, sizeof(msgs[0]) * room);
+		for (i = 0; i < room; i++) {
+			slot = (head + i) & r->mask;
+			iov[i].iov_base = r->buf + (size_t)slot * r->slot_size;
+			iov[i].iov_len = r->slot_size;
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = control[i].buf;
+			msgs[i].msg_hdr.msg_controllen = RELAY_GRO_CMSG_SPACE;
+		}
+		/* block for the first datagram, then take whatever is queued */
+		n = recvmmsg(r->fd, msgs, room, MSG_WAITFORONE, NULL);
+		if (n <= 0) {
+			if (n < 0 && errno != EAGAIN && errno != EINTR)
+				log_error_ratelimited("relay: recvmmsg failed:%s", strerror(errno));
+			continue;
+		}
+		for (i = 0; i < (unsigned int)n; i++) {
+			slot = (head + i) & r->mask;
+			r->slots[slot].len = msgs[i].msg_len;
+			r->slots[slot].gso_size = 0;
+			for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg;
+				 cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+				if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+					int gso_size;
+					memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+					if (gso_size > 0 && (unsigned int)gso_size < msgs[i].msg_len)
+						r->slots[slot].gso_size = gso_size;
+				}
+			}
+		}
+		pthread_mutex_lock(&r->lock);
+		r->head += n;
+		pthread_cond_broadcast(&r->cond);
+		pthread_mutex_unlock(&r->lock);
+	}
+	return NULL;
+}
+static void forward(struct relay *r, unsigned int tail, unsigned int count) {
+	struct mmsghdr msgs[RELAY_BATCH];
+	struct iovec iov[RELAY_BATCH];
+	union relay_gso_cmsg control[RELAY_BATCH];
+	struct cmsghdr *cmsg;
+	unsigned int i, slot, sent = 0, datagrams;
+	uint64_t bytes;
+	int n;
+
+	memset(msgs, 0, sizeof(msgs[0]) * count);
+	for (i = 0; i < count; i++) {
+		slot = (tail + i) & r->mask;
+		iov[i].iov_base = r->buf + (size_t)slot * r->slot_size;
+		iov[i].iov_len = r->slots[slot].len;
+		msgs[i].msg_hdr.msg_name = &r->dst;
+		msgs[i].msg_hdr.msg_namelen = sizeof(r->dst);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		/* coalesced by GRO, let the kernel split it again on output */
+		if (r->slots[slot].gso_size) {
+			uint16_t gso_size = r->slots[slot].gso_size;
+			msgs[i].msg_hdr.msg_control = control[i].buf;
+			msgs[i].msg_hdr.msg_controllen = RELAY_GSO_CMSG_SPACE;
+			cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+			cmsg->cmsg_level = SOL_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(gso_size));
+			memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+		}
+		r->bytes += r->slots[slot].len;
+	}
+	while (sent < count) {
+		n = sendmmsg(r->out_fd, msgs + sent, count - sent, 0);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			metrics_send_error(METRICS_OUT_RELAY, errno);
+			log_error_ratelimited("relay: sendmmsg failed:%s, dropped %u datagrams",
+					  strerror(errno), count - sent);
+			break;
+		}
+		/* a GSO send leaves as len / gso_size datagrams */
+		for (bytes = datagrams = 0, i = sent; i < sent + n; i++) {
+			slot = (tail + i) & r->mask;
+			bytes += msgs[i].msg_len;
+			datagrams += r->slots[slot].gso_size ? (r->slots[slot].len +
+				r->slots[slot].gso_size - 1) / r->slots[slot].gso_size : 1;
+		}
+		metrics_sent(METRICS_OUT_RELAY, bytes, datagrams);
+		sent += n;
+	}
+	r->packets += count;
+}
+static void *relay_sender(void *arg) {
+	struct relay *r = arg;
+	struct timespec outtime;
+	unsigned int tail, count;
+	int64_t last_input = monotonic_now(), deadline;
+	int idle = 0;
+
+	pthread_mutex_lock(&r->lock);
+	while (!r->exit) {
+		if (r->head == r->tail) {
+			if (r->idle_timeout <= 0 || !r->idle_cb) {
+				pthread_cond_wait(&r->cond, &r->lock);
+				continue;
+			}
+			deadline = last_input + r->idle_timeout;
+			outtime.tv_sec = deadline / 1000000;
+			outtime.tv_nsec = (deadline % 1000000) * 1000;
+			if (pthread_cond_timedwait(&r->cond, &r->lock, &outtime) == ETIMEDOUT &&
+				r->head == r->tail && !r->exit) {
+				pthread_mutex_unlock(&r->lock);
+				if (!idle)
+					log_info("relay: no input for %lldms, sending dummy data",
+							 (long long)(r->idle_timeout / 1000));
+				idle = 1;
+				r->idle_cb(r->opaque);
+				last_input = monotonic_now();
+				pthread_mutex_lock(&r->lock);
+			}
+			continue;
+		}
+		tail = r->tail;
+		count = contiguous(r, tail, r->head - tail);
+		pthread_mutex_unlock(&r->lock);
+
+		if (idle) {
+			log_info("relay: input resumed");
+			idle = 0;
+		}
+		forward(r, tail, count);
+		last_input = monotonic_now();
+
+		pthread_mutex_lock(&r->lock);
+		r->tail += count;
+		pthread_cond_broadcast(&r->cond);
+	}
+	pthread_mutex_unlock(&r->lock);
+	return NULL;
+}
+/* ------------------------------------------------------------------------- */
+int relay_start(struct relay *r, const struct relay_config *cfg, int out_fd,
+				const struct sockaddr_in *dst, relay_idle_cb cb, void *opaque) {
+	pthread_condattr_t attr;
+	int on = 1;
+
+	memset(r, 0, sizeof(*r));
+	r->out_fd = out_fd;
+	r->dst = *dst;
+	r->idle_timeout = cfg->idle_timeout;
+	r->idle_cb = cb;
+	r->opaque = opaque;
+	r->slot_size = RELAY_SLOT_SIZE;
+
+	r->fd = open_input(cfg);
+	if (r->fd < 0) return -1;
+	if (cfg->gro) {
+		if (setsockopt(r->fd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0)
+			r->slot_size = RELAY_GRO_SLOT_SIZE;
+		else
+			log_error("relay: UDP GRO not supported:%s", strerror(errno));
+	}
+	r->ring_slots = cfg->ring_slots ? cfg->ring_slots :
+		r->slot_size == RELAY_GRO_SLOT_SIZE ? RELAY_DEFAULT_GRO_SLOTS : RELAY_DEFAULT_SLOTS;
+	/* head and tail wrap at 2^32, a power of 2 keeps their slots in step */
+	if (r->ring_slots > RELAY_MAX_SLOTS) r->ring_slots = RELAY_MAX_SLOTS;
+	while (r->ring_slots & (r->ring_slots - 1))
+		r->ring_slots += r->ring_slots & -r->ring_slots;
+	r->mask = r->ring_slots - 1;
+	r->slots = calloc(r->ring_slots, sizeof(*r->slots));
+	r->buf = malloc((size_t)r->ring_slots * r->slot_size);
+	if (!r->slots || !r->buf) {
+		log_error("relay: out of memory for %u slots", r->ring_slots);
+		goto fail;
+	}
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&r->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	if (pthread_create(&r->send_tid, NULL, relay_sender, r) != 0)
+		goto fail_sync;
+	if (pthread_create(&r->recv_tid, NULL, relay_receiver, r) != 0) {
+		relay_stop(r);
+		pthread_join(r->send_tid, NULL);
+		goto fail_sync;
+	}
+	log_info("relay: listening on %s:%d, %u slots of %u bytes",
+			 cfg->ip ? cfg->ip : "*", cfg->port, r->ring_slots, r->slot_size);
+	return 0;
+
+fail_sync:
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->cond);
+fail:
+	free(r->slots);
+	free(r->buf);
+	close(r->fd);
+	r->fd = -1;
+	return -1;
+}
+void relay_stop(struct relay *r) {
+	pthread_mutex_lock(&r->lock);
+	r->exit = 1;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+}
+void relay_wait(struct relay *r) {
+	if (r->fd < 0) return;
+	pthread_join(r->recv_tid, NULL);
+	pthread_join(r->send_tid, NULL);
+	log_info("relay: forwarded %llu datagrams, %llu bytes",
+			 (unsigned long long)r->packets, (unsigned long long)r->bytes);
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->cond);
+	free(r->slots);
+	free(r->buf);
+	close(r->fd);
+	r->fd = -1;
+}
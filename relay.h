@@ -0,0 +1,82 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+*
+* This file is part of udpproxy.
+*
+* udpproxy is free software; you can redistribute it and/or
+        * modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+        * version 2.1 of the License, or (at your option) any later version.
+*
+* udpproxy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#ifndef __RELAY_H__
+#define __RELAY_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+/* Live UDP relay.
+ *
+ * A receiver thread reads datagrams with recvmmsg() into a ring of
+ * fixed size slots and a sender thread forwards them with sendmmsg()
+ * to the output address, so a slow output never stalls the socket
+ * read. With gro set, UDP GRO is enabled on the input socket; a slot
+ * then holds several coalesced datagrams and is forwarded as one GSO
+ * send with the same segment size.
+ *
+ * When no input arrives for idle_timeout microseconds the sender calls
+ * idle_cb, once per idle_timeout, until input resumes (0 disables). */
+typedef void (*relay_idle_cb)(void *opaque);
+
+struct relay_config {
+	const char *ip;               /* local or multicast address, NULL for any */
+	int port;
+	int gro;
+	unsigned int ring_slots;      /* 0 for the default, rounded up to a power of 2 */
+	int64_t idle_timeout;
+};
+
+struct relay_slot {
+	unsigned int len;
+	unsigned int gso_size;        /* 0 if the slot holds one datagram */
+};
+
+struct relay {
+	int fd;                       /* input socket */
+	int out_fd;
+	struct sockaddr_in dst;
+	int64_t idle_timeout;
+	relay_idle_cb idle_cb;
+	void *opaque;
+	int exit;
+	pthread_t recv_tid;
+	pthread_t send_tid;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	/* ring, head is advanced by the receiver, tail by the sender */
+	struct relay_slot *slots;
+	char *buf;
+	unsigned int slot_size;
+	unsigned int ring_slots;
+	unsigned int mask;            /* ring_slots - 1 */
+	unsigned int head;
+	unsigned int tail;
+	uint64_t packets;
+	uint64_t bytes;
+};
+
+int relay_start(struct relay *, const struct relay_config *, int out_fd,
+				const struct sockaddr_in *dst, relay_idle_cb cb, void *opaque);
+/* asks both threads to exit, may be called from any thread */
+void relay_stop(struct relay *);
+/* joins the threads after relay_stop() and releases the relay */
+void relay_wait(struct relay *);
+#endif
@@ -0,0 +1,202 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "retention.h"
+#include "logger.h"
+/* ------------------------------------------------------------------------- */
+/* the worker runs at least this often even without new segments */
+#define RETENTION_IDLE_WAIT_SEC 1
+struct retention_item {
+	struct list_head list;
+	int64_t timestamp;
+	uint64_t size;
+	int discard;
+	char name[];
+};
+
+/* ------------------------------------------------------------------------- */
+int retention_policy_enabled(const struct retention_policy *p) {
+	return p->keep_segments || p->keep_duration > 0 || p->keep_bytes ||
+		   (p->archive_dir && p->archive_dir[0]);
+}
+static void evict(struct retention *r, struct retention_item *item) {
+	int ret;
+	if (!item->discard && r->archive_fd >= 0) {
+		ret = renameat(r->dir_fd, item->name, r->archive_fd, item->name);
+		if (ret < 0)
+			log_error("retention: archive %s failed:%s", item->name, strerror(errno));
+	} else {
+		ret = unlinkat(r->dir_fd, item->name, 0);
+		if (ret < 0 && errno != ENOENT)
+			log_error("retention: unlink %s failed:%s", item->name, strerror(errno));
+	}
+	free(item);
+}
+/* move the pending items into the retained list and collect the ones that
+ * fall outside the policy into victims; runs without the lock held */
+static void apply_policy(struct retention *r, struct list_head *batch,
+						 struct list_head *victims) {
+	struct list_head *pos, *n;
+	struct retention_item *item, *newest;
+	struct stat st;
+	const struct retention_policy *p = &r->policy;
+	int only_archive = !p->keep_segments && p->keep_duration <= 0 && !p->keep_bytes;
+
+	list_for_each_safe(pos, n, batch) {
+		item = list_entry(pos, struct retention_item, list);
+		list_del(pos);
+		if (item->discard || only_archive) {
+			list_add_tail(pos, victims);
+			continue;
+		}
+		if (!item->size && p->keep_bytes &&
+			fstatat(r->dir_fd, item->name, &st, 0) == 0)
+			item->size = st.st_size;
+		list_add_tail(pos, &r->retained);
+		r->retained_count++;
+		r->retained_bytes += item->size;
+	}
+	if (list_empty(&r->retained)) return;
+
+	newest = list_entry(r->retained.prev, struct retention_item, list);
+	list_for_each_safe(pos, n, &r->retained) {
+		item = list_entry(pos, struct retention_item, list);
+		if (!((p->keep_segments && r->retained_count > p->keep_segments) ||
+			  (p->keep_duration > 0 &&
+			   item->timestamp < newest->timestamp - p->keep_duration) ||
+			  (p->keep_bytes && r->retained_bytes > p->keep_bytes)))
+			break;
+		list_del(pos);
+		r->retained_count--;
+		r->retained_bytes -= item->size;
+		list_add_tail(pos, victims);
+	}
+}
+static void *retention_worker(void *arg) {
+	struct retention *r = arg;
+	struct list_head batch, victims, *pos, *n;
+	struct timespec outtime;
+	int exiting = 0, evicted;
+
+	/* cleanup must never compete with the send path */
+	setpriority(PRIO_PROCESS, 0, 10);
+	while (!exiting) {
+		INIT_LIST_HEAD(&batch);
+		INIT_LIST_HEAD(&victims);
+		pthread_mutex_lock(&r->lock);
+		if (list_empty(&r->pending) && !r->exit) {
+			clock_gettime(CLOCK_REALTIME, &outtime);
+			outtime.tv_sec += RETENTION_IDLE_WAIT_SEC;
+			pthread_cond_timedwait(&r->cond, &r->lock, &outtime);
+		}
+		exiting = r->exit;
+		list_splice_init(&r->pending, &batch);
+		pthread_mutex_unlock(&r->lock);
+
+		apply_policy(r, &batch, &victims);
+		evicted = 0;
+		list_for_each_safe(pos, n, &victims) {
+			evict(r, list_entry(pos, struct retention_item, list));
+			evicted++;
+		}
+		if (evicted)
+			log_debug("retention: evicted %d segments, retained %u segments/%llu bytes",
+					  evicted, r->retained_count,
+					  (unsigned long long)r->retained_bytes);
+	}
+	return NULL;
+}
+/* ------------------------------------------------------------------------- */
+int retention_start(struct retention *r, const char *work_dir,
+					const struct retention_policy *policy) {
+	memset(r, 0, sizeof(*r));
+	r->policy = *policy;
+	r->archive_fd = -1;
+	INIT_LIST_HEAD(&r->pending);
+	INIT_LIST_HEAD(&r->retained);
+	r->dir_fd = open(work_dir, O_RDONLY | O_DIRECTORY);
+	if (r->dir_fd < 0) {
+		log_error("retention: open %s failed:%s", work_dir, strerror(errno));
+		return -1;
+	}
+	if (policy->archive_dir && policy->archive_dir[0]) {
+		mkdir(policy->archive_dir, 0755);
+		r->archive_fd = open(policy->archive_dir, O_RDONLY | O_DIRECTORY);
+		if (r->archive_fd < 0) {
+			log_error("retention: open archive %s failed:%s",
+					  policy->archive_dir, strerror(errno));
+			close(r->dir_fd);
+			r->dir_fd = -1;
+			return -1;
+		}
+	}
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->cond, NULL);
+	if (pthread_create(&r->tid, NULL, retention_worker, r) != 0) {
+		pthread_mutex_destroy(&r->lock);
+		pthread_cond_destroy(&r->cond);
+		if (r->archive_fd >= 0) close(r->archive_fd);
+		close(r->dir_fd);
+		r->dir_fd = -1;
+		return -1;
+	}
+	return 0;
+}
+void retention_add(struct retention *r, const char *name, int64_t timestamp,
+				   uint64_t size, int discard) {
+	size_t len = strlen(name);
+	struct retention_item *item = malloc(sizeof(*item) + len + 1);
+	if (!item) return;
+	memcpy(item->name, name, len + 1);
+	item->timestamp = timestamp;
+	item->size = size;
+	item->discard = discard;
+	pthread_mutex_lock(&r->lock);
+	list_add_tail(&item->list, &r->pending);
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+}
+void retention_stop(struct retention *r) {
+	struct list_head *pos, *n;
+	if (r->dir_fd < 0) return;
+	pthread_mutex_lock(&r->lock);
+	r->exit = 1;
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+	pthread_join(r->tid, NULL);
+	/* segments still within the policy stay on disk */
+	list_for_each_safe(pos, n, &r->retained) {
+		list_del(pos);
+		free(list_entry(pos, struct retention_item, list));
+	}
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->cond);
+	if (r->archive_fd >= 0) close(r->archive_fd);
+	close(r->dir_fd);
+	r->dir_fd = -1;
+}
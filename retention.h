@@ -0,0 +1,67 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+*
+* This file is part of udpproxy.
+*
+* udpproxy is free software; you can redistribute it and/or
+        * modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+        * version 2.1 of the License, or (at your option) any later version.
+*
+* udpproxy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#ifndef __RETENTION_H__
+#define __RETENTION_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include "list.h"
+
+/* Background cleanup of segments that have already been sent.
+ *
+ * The sender hands every finished segment to retention_add(), which only
+ * appends to a pending list; a worker thread applies the policy and does
+ * the unlinkat()/renameat() calls in batches, so the send path never
+ * waits on directory metadata I/O.
+ *
+ * A sent segment is evicted as soon as any configured limit is exceeded
+ * (0 disables a limit). Evicted segments are moved into archive_dir when
+ * it is set, otherwise unlinked. With only archive_dir set every segment
+ * is moved right after it is sent. */
+struct retention_policy {
+	unsigned int keep_segments;   /* keep the newest N segments */
+	int64_t keep_duration;        /* keep segments newer than newest - N (timestamp units) */
+	uint64_t keep_bytes;          /* keep at most N bytes of segments */
+	const char *archive_dir;      /* move instead of unlink */
+};
+
+struct retention {
+	struct retention_policy policy;
+	int dir_fd;
+	int archive_fd;
+	int exit;
+	pthread_t tid;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct list_head pending;     /* handed over by the sender, protected by lock */
+	struct list_head retained;    /* owned by the worker, oldest first */
+	unsigned int retained_count;
+	uint64_t retained_bytes;
+};
+
+/* returns 1 if the policy needs a worker at all */
+int retention_policy_enabled(const struct retention_policy *);
+int retention_start(struct retention *, const char *work_dir,
+					const struct retention_policy *);
+/* name is relative to work_dir; size 0 means unknown (stat'ed by the
+ * worker if keep_bytes is set); discard removes it unconditionally */
+void retention_add(struct retention *, const char *name, int64_t timestamp,
+				   uint64_t size, int discard);
+void retention_stop(struct retention *);
+#endif
@@ -0,0 +1,109 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#define _GNU_SOURCE /* sendmmsg */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "rtp.h"
+#include "logger.h"
+#include "metrics.h"
+/* ------------------------------------------------------------------------- */
+static uint32_t random_ssrc(void) {
+	uint32_t v = 0;
+	int fd = open("/dev/urandom", O_RDONLY);
+	if (fd < 0 || read(fd, &v, sizeof(v)) != sizeof(v))
+		v = (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16);
+	if (fd >= 0) close(fd);
+	return v;
+}
+/* ------------------------------------------------------------------------- */
+int rtp_init(struct rtp_sender *r, int fd, const struct sockaddr_in *dst, uint32_t ssrc) {
+	int i;
+	memset(r, 0, sizeof(*r));
+	r->fd = fd;
+	r->dst = *dst;
+	r->ssrc = ssrc ? ssrc : random_ssrc();
+	r->seq = (uint16_t)random_ssrc();
+	for (i = 0; i < RTP_BATCH; i++) {
+		unsigned char *h = r->hdr[i];
+		h[0] = 0x80;
+		h[1] = RTP_PT_MP2T;
+		h[8] = r->ssrc >> 24;
+		h[9] = r->ssrc >> 16;
+		h[10] = r->ssrc >> 8;
+		h[11] = r->ssrc;
+		r->iov[i][0].iov_base = h;
+		r->iov[i][0].iov_len = RTP_HEADER_LEN;
+	}
+	log_info("rtp: ssrc=%08x, first seq=%u", r->ssrc, r->seq);
+	return 0;
+}
+void rtp_send(struct rtp_sender *r, const char *buf, int len, uint32_t ts) {
+	struct mmsghdr msgs[RTP_BATCH];
+	int n, i, k, chunk, sent;
+	uint64_t bytes;
+	unsigned char *h;
+
+	while (len > 0) {
+		memset(msgs, 0, sizeof(msgs));
+		for (n = 0; n < RTP_BATCH && len > 0; n++) {
+			chunk = len < RTP_PAYLOAD_MAX ? len : RTP_PAYLOAD_MAX;
+			h = r->hdr[n];
+			h[2] = r->seq >> 8;
+			h[3] = r->seq;
+			h[4] = ts >> 24;
+			h[5] = ts >> 16;
+			h[6] = ts >> 8;
+			h[7] = ts;
+			r->iov[n][1].iov_base = (void *)buf;
+			r->iov[n][1].iov_len = chunk;
+			msgs[n].msg_hdr.msg_name = &r->dst;
+			msgs[n].msg_hdr.msg_namelen = sizeof(r->dst);
+			msgs[n].msg_hdr.msg_iov = r->iov[n];
+			msgs[n].msg_hdr.msg_iovlen = 2;
+			r->seq++;
+			buf += chunk;
+			len -= chunk;
+		}
+		for (sent = 0; sent < n;) {
+			i = sendmmsg(r->fd, msgs + sent, n - sent, 0);
+			if (i < 0) {
+				if (errno == EINTR) continue;
+				metrics_send_error(METRICS_OUT_RTP, errno);
+				log_error_ratelimited("rtp: sendmmsg failed:%s, dropped %d datagrams",
+						  strerror(errno), n - sent);
+				break;
+			}
+			for (bytes = 0, k = sent; k < sent + i; k++) bytes += msgs[k].msg_len;
+			metrics_sent(METRICS_OUT_RTP, bytes, i);
+			sent += i;
+		}
+		r->packets += n;
+		if (r->sent_cb) {
+			for (i = 0; i < n; i++)
+				r->sent_cb(r->sent_opaque, (r->hdr[i][2] << 8) | r->hdr[i][3], RTP_PT_MP2T,
+						   ts, r->iov[i][1].iov_base, r->iov[i][1].iov_len);
+		}
+	}
+}
@@ -0,0 +1,60 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+*
+* This file is part of udpproxy.
+*
+* udpproxy is free software; you can redistribute it and/or
+        * modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+        * version 2.1 of the License, or (at your option) any later version.
+*
+* udpproxy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#ifndef __RTP_H__
+#define __RTP_H__
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+/* RFC 2250 RTP encapsulation of MPEG-TS.
+ *
+ * rtp_send() cuts a buffer into datagrams of up to 7 TS packets and
+ * sends them with one sendmmsg() per RTP_BATCH datagrams. Every datagram
+ * is a two element iovec: a 12 byte header from a table preallocated
+ * at init, whose constant fields (V=2, PT=33, SSRC) are written once,
+ * and the payload pointing straight into the caller's buffer. Per packet
+ * only the sequence number and timestamp are stored, nothing is
+ * allocated or copied. */
+#define RTP_HEADER_LEN 12
+#define RTP_PT_MP2T 33
+#define RTP_TS_PER_PACKET 7
+#define RTP_PAYLOAD_MAX (RTP_TS_PER_PACKET * 188)
+#define RTP_BATCH 32
+
+typedef void (*rtp_sent_cb)(void *opaque, uint16_t seq, uint8_t pt, uint32_t ts,
+							const unsigned char *payload, unsigned int len);
+
+struct rtp_sender {
+	int fd;
+	struct sockaddr_in dst;
+	uint32_t ssrc;
+	uint16_t seq;
+	unsigned char hdr[RTP_BATCH][RTP_HEADER_LEN];
+	struct iovec iov[RTP_BATCH][2];
+	rtp_sent_cb sent_cb;          /* optional, e.g. FEC */
+	void *sent_opaque;
+	uint64_t packets;
+};
+
+/* ssrc 0 picks a random one */
+int rtp_init(struct rtp_sender *, int fd, const struct sockaddr_in *dst, uint32_t ssrc);
+/* ts is the 90kHz media clock of the first byte of buf */
+void rtp_send(struct rtp_sender *, const char *buf, int len, uint32_t ts);
+#endif
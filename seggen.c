@@ -0,0 +1,172 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+/* Synthetic segment generator for benchmarks.
+ *
+ *     udpproxy-seggen -o dir [-b bit/s] [-s segment ms] [-n count] [-x speed]
+ *
+ * Writes MPEG-TS segments of the given bitrate and duration into dir,
+ * named "<ms>.ts" after their media time (file_template = %ms.ts). Each
+ * segment is written under a hidden name and renamed into place, so
+ * udpproxy sees it complete. Segments carry PCR on PID 0x100, a
+ * continuity-correct payload PID 0x101 and a bench timestamp packet
+ * (bench.h). speed 1 produces media in real time, 0 as fast as
+ * possible. One line "seq name bytes completed_us" is printed per
+ * segment. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "bench.h"
+/* ------------------------------------------------------------------------- */
+#define TS_LEN 188
+#define PCR_PID 0x100
+#define DATA_PID 0x101
+#define PCR_INTERVAL_MS 40
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+	stop = 1;
+}
+static int64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+static void ts_header(unsigned char *p, int pid, int afc, unsigned int *cc) {
+	p[0] = 0x47;
+	p[1] = pid >> 8;
+	p[2] = pid & 0xff;
+	p[3] = (afc << 4) | (*cc & 0x0f);
+	if (afc & 1) (*cc)++;
+}
+/* adaptation field with PCR, the rest of the packet is stuffing */
+static void pcr_packet(unsigned char *p, int64_t pcr_27m, unsigned int *cc) {
+	int64_t base = (pcr_27m / 300) & ((1LL << 33) - 1);
+	int ext = pcr_27m % 300;
+	ts_header(p, PCR_PID, 2, cc);
+	p[4] = TS_LEN - 5;
+	p[5] = 0x10;
+	p[6] = base >> 25;
+	p[7] = base >> 17;
+	p[8] = base >> 9;
+	p[9] = base >> 1;
+	p[10] = ((base & 1) << 7) | 0x7e | (ext >> 8);
+	p[11] = ext & 0xff;
+	memset(p + 12, 0xff, TS_LEN - 12);
+}
+static int write_full(int fd, const unsigned char *buf, size_t n) {
+	ssize_t w;
+	while (n > 0) {
+		w = write(fd, buf, n);
+		if (w < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		buf += w;
+		n -= w;
+	}
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+int main(int argc, char *argv[]) {
+	const char *dir = NULL;
+	double bitrate = 20e6, speed = 1;
+	int64_t segment_ms = 1000, count = 0, seq, start_us, media_ms, packets, i, pcr_every;
+	unsigned int pcr_cc = 0, data_cc = 0, stamp_cc = 0;
+	unsigned char *buf, *p;
+	char tmp[1024], path[1024];
+	int fd, c;
+
+	while ((c = getopt(argc, argv, "o:b:s:n:x:")) != -1) {
+		switch (c) {
+		case 'o': dir = optarg; break;
+		case 'b': bitrate = atof(optarg); break;
+		case 's': segment_ms = atoll(optarg); break;
+		case 'n': count = atoll(optarg); break;
+		case 'x': speed = atof(optarg); break;
+		default: dir = NULL; break;
+		}
+	}
+	if (!dir || bitrate <= 0 || segment_ms <= 0) {
+		fprintf(stderr, "usage: %s -o dir [-b bit/s] [-s segment ms] [-n count] "
+				"[-x speed]\n", argv[0]);
+		return 1;
+	}
+	packets = (int64_t)(bitrate * segment_ms / 1000 / 8 / TS_LEN);
+	if (packets < 2) packets = 2;
+	pcr_every = (int64_t)(bitrate * PCR_INTERVAL_MS / 1000 / 8 / TS_LEN);
+	if (pcr_every < 1) pcr_every = 1;
+	buf = malloc(packets * TS_LEN);
+	if (!buf) return 1;
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	start_us = now_us();
+	media_ms = start_us / 1000;
+	for (seq = 0; !stop && (!count || seq < count); seq++, media_ms += segment_ms) {
+		/* packet 0 is the stamp, filled in once the segment is complete */
+		for (i = 1, p = buf + TS_LEN; i < packets; i++, p += TS_LEN) {
+			if (i % pcr_every == 1 || pcr_every == 1) {
+				pcr_packet(p, (media_ms * 1000 + (i * segment_ms * 1000) / packets) * 27,
+						   &pcr_cc);
+			} else {
+				ts_header(p, DATA_PID, 1, &data_cc);
+				memset(p + 4, (int)(seq + i) & 0xff, TS_LEN - 4);
+			}
+		}
+		if (speed > 0) {
+			int64_t due = start_us + (int64_t)((seq + 1) * segment_ms * 1000 / speed);
+			int64_t wait = due - now_us();
+			if (wait > 0) usleep(wait);
+		}
+		snprintf(tmp, sizeof(tmp), "%s/.%lld.ts", dir, (long long)media_ms);
+		snprintf(path, sizeof(path), "%s/%lld.ts", dir, (long long)media_ms);
+		fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			fprintf(stderr, "open %s failed:%s\n", tmp, strerror(errno));
+			return 1;
+		}
+		ts_header(buf, BENCH_PID, 1, &stamp_cc);
+		memset(buf + 4, 0xff, TS_LEN - 4);
+		/* the stamp is the time the segment becomes visible, so the body
+		 * is written first and the stamp packet last */
+		if (lseek(fd, TS_LEN, SEEK_SET) < 0 ||
+			write_full(fd, buf + TS_LEN, (packets - 1) * TS_LEN) < 0) {
+			fprintf(stderr, "write %s failed:%s\n", tmp, strerror(errno));
+			return 1;
+		}
+		bench_stamp_put(buf + 4, (uint32_t)seq, now_us());
+		if (pwrite(fd, buf, TS_LEN, 0) != TS_LEN || close(fd) < 0) {
+			fprintf(stderr, "write %s failed:%s\n", tmp, strerror(errno));
+			return 1;
+		}
+		rename(tmp, path);
+		printf("%lld %lld.ts %lld %lld\n", (long long)seq, (long long)media_ms,
+			   (long long)(packets * TS_LEN), (long long)now_us());
+		fflush(stdout);
+	}
+	free(buf);
+	return 0;
+}
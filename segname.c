@@ -0,0 +1,76 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#include <stdio.h>
+#include <string.h>
+#include "segname.h"
+/* ------------------------------------------------------------------------- */
+static const struct {
+	const char *name;
+	int64_t scale;            /* 0: taken from seq_duration */
+} fields[] = {
+	{ "%epoch_us", 1 },
+	{ "%sec", 1000000 },
+	{ "%seq", 0 },
+	{ "%ms", 1000 },
+};
+
+/* ------------------------------------------------------------------------- */
+int segname_compile(struct segname *sn, const char *tmpl, int64_t seq_duration) {
+	const char *field = strchr(tmpl, '%'), *rest;
+	unsigned int i, len;
+	memset(sn, 0, sizeof(*sn));
+	if (!field) return -1;
+	for (i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i) {
+		len = strlen(fields[i].name);
+		if (!strncmp(field, fields[i].name, len)) break;
+	}
+	if (i == sizeof(fields) / sizeof(fields[0])) return -1;
+	sn->scale = fields[i].scale ? fields[i].scale : seq_duration;
+	if (sn->scale <= 0) return -1;
+
+	rest = field + len;
+	sn->prefix_len = field - tmpl;
+	sn->suffix_len = strlen(rest);
+	if (sn->prefix_len >= SEGNAME_LITERAL_LEN ||
+		sn->suffix_len >= SEGNAME_LITERAL_LEN || strchr(rest, '%'))
+		return -1;
+	memcpy(sn->prefix, tmpl, sn->prefix_len);
+	if (!strcmp(rest, "*")) {
+		sn->any_suffix = 1;
+		sn->suffix_len = 0;
+	} else {
+		memcpy(sn->suffix, rest, sn->suffix_len);
+	}
+	return 0;
+}
+int segname_match(const struct segname *sn, const char *name, size_t len,
+				  int64_t *timestamp) {
+	const char *p = name + sn->prefix_len, *end = name + len;
+	int64_t v = 0;
+	if (len < sn->prefix_len + sn->suffix_len + 1 ||
+		memcmp(name, sn->prefix, sn->prefix_len))
+		return -1;
+	if (*p < '0' || *p > '9') return -1;
+	while (p < end && *p >= '0' && *p <= '9') v = v * 10 + (*p++ - '0');
+	if (!sn->any_suffix &&
+		((size_t)(end - p) != sn->suffix_len || memcmp(p, sn->suffix, sn->suffix_len)))
+		return -1;
+	*timestamp = v * sn->scale;
+	return 0;
+}
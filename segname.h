@@ -0,0 +1,53 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+*
+* This file is part of udpproxy.
+*
+* udpproxy is free software; you can redistribute it and/or
+        * modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+        * version 2.1 of the License, or (at your option) any later version.
+*
+* udpproxy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#ifndef __SEGNAME_H__
+#define __SEGNAME_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Segment file name templates.
+ *
+ * A template is a literal prefix, exactly one field and a literal
+ * suffix; a suffix of "*" accepts anything after the field. Fields:
+ *   %sec       whole seconds (the historical "<n>.ts" naming)
+ *   %ms        milliseconds
+ *   %epoch_us  microseconds
+ *   %seq       sequence number, multiplied by a fixed segment duration
+ * e.g. "%ms.ts", "seg_%seq.ts", "%epoch_us.ts", "%sec*".
+ * Templates are compiled once; matching is a single pass over the name
+ * and yields the segment start time in microseconds. */
+#define SEGNAME_DEFAULT "%sec*"
+#define SEGNAME_LITERAL_LEN 64
+
+struct segname {
+	char prefix[SEGNAME_LITERAL_LEN];
+	char suffix[SEGNAME_LITERAL_LEN];
+	unsigned int prefix_len;
+	unsigned int suffix_len;
+	int any_suffix;
+	int64_t scale;            /* microseconds per field unit */
+};
+
+/* seq_duration is the duration of one %seq step in microseconds */
+int segname_compile(struct segname *, const char *tmpl, int64_t seq_duration);
+/* returns 0 and stores the timestamp if name[0..len) matches */
+int segname_match(const struct segname *, const char *name, size_t len,
+				  int64_t *timestamp);
+#endif
@@ -0,0 +1,76 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+/* Reference producer for the udpproxy shared-memory ring (see shmring.h).
+ *
+ * Copies MPEG-TS from stdin into the ring udpproxy created for
+ * "stream_input = shm:<name>", 7 packets per slot:
+ *
+ *     ffmpeg ... -f mpegts - | udpproxy-shmfeed <name>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "shmring.h"
+/* ------------------------------------------------------------------------- */
+#define FEED_CHUNK (7 * 188)
+#define FEED_ATTACH_RETRY_US 200000
+
+static ssize_t read_full(int fd, char *buf, size_t n) {
+	size_t got = 0;
+	ssize_t r;
+	while (got < n) {
+		r = read(fd, buf + got, n - got);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) break;
+		got += r;
+	}
+	return got;
+}
+int main(int argc, char *argv[]) {
+	struct shmring ring;
+	char buf[FEED_CHUNK];
+	unsigned long long slots = 0, bytes = 0;
+	ssize_t n;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <shm name> < input.ts\n", argv[0]);
+		return 1;
+	}
+	/* udpproxy creates the ring, wait for it */
+	while (shmring_attach(&ring, argv[1]) < 0) {
+		if (errno != ENOENT && errno != EPROTO) {
+			fprintf(stderr, "attach %s failed:%s\n", argv[1], strerror(errno));
+			return 1;
+		}
+		usleep(FEED_ATTACH_RETRY_US);
+	}
+	while ((n = read_full(STDIN_FILENO, buf, sizeof(buf))) > 0) {
+		if (shmring_write(&ring, buf, n, -1) < 0) {
+			fprintf(stderr, "write failed:%s\n", strerror(errno));
+			break;
+		}
+		slots++;
+		bytes += n;
+	}
+	fprintf(stderr, "%llu slots, %llu bytes\n", slots, bytes);
+	shmring_close(&ring);
+	return 0;
+}
@@ -0,0 +1,196 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "shmring.h"
+/* ------------------------------------------------------------------------- */
+#define SHM_DIR "/dev/shm/"
+
+/* ------------------------------------------------------------------------- */
+static void futex_wait(uint32_t *addr, uint32_t val, int timeout_ms) {
+	struct timespec ts, *tp = NULL;
+	if (timeout_ms >= 0) {
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+		tp = &ts;
+	}
+	syscall(SYS_futex, addr, FUTEX_WAIT, val, tp, NULL, 0);
+}
+static void futex_wake(uint32_t *addr) {
+	syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+static int shm_path(char *path, size_t size, const char *name) {
+	while (*name == '/') name++;
+	if (!*name || strchr(name, '/')) {
+		errno = EINVAL;
+		return -1;
+	}
+	snprintf(path, size, SHM_DIR "%s", name);
+	return 0;
+}
+static int map(struct shmring *r, int fd, size_t size) {
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) return -1;
+	r->fd = fd;
+	r->map_size = size;
+	r->hdr = p;
+	r->slots = (char *)p + SHMRING_HEADER_SIZE;
+	return 0;
+}
+static int64_t monotonic_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+/* sleep on futex until seq moves away from seen, -1 on timeout.
+ * A wake does not mean seq moved: the futex bump of an earlier publish
+ * can land after val was read, so sleep again until the deadline. */
+static int wait_for(uint32_t *futex, uint32_t *waiting, const uint64_t *seq,
+					uint64_t seen, int timeout_ms) {
+	int64_t deadline = timeout_ms >= 0 ? monotonic_ms() + timeout_ms : -1;
+	int left = -1;
+	uint32_t val;
+
+	for (;;) {
+		val = __atomic_load_n(futex, __ATOMIC_ACQUIRE);
+		if (__atomic_load_n(seq, __ATOMIC_ACQUIRE) != seen) return 0;
+		if (deadline >= 0 && (left = deadline - monotonic_ms()) <= 0) return -1;
+		__atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+		/* recheck after announcing, the other side may have missed the flag */
+		if (__atomic_load_n(seq, __ATOMIC_SEQ_CST) == seen)
+			futex_wait(futex, val, left);
+		__atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+	}
+}
+static void publish(uint64_t *seq, uint64_t value, uint32_t *futex, uint32_t *waiting) {
+	__atomic_store_n(seq, value, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(futex, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST))
+		futex_wake(futex);
+}
+/* ------------------------------------------------------------------------- */
+int shmring_create(struct shmring *r, const char *name, uint32_t slot_count,
+				   uint32_t slot_size) {
+	char path[PATH_MAX];
+	struct shmring_header *h;
+	size_t size;
+	int fd;
+
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+	if (!slot_count) slot_count = SHMRING_DEFAULT_SLOT_COUNT;
+	if (!slot_size) slot_size = SHMRING_DEFAULT_SLOT_SIZE;
+	slot_size = (slot_size + 7) & ~7u;
+	if (shm_path(path, sizeof(path), name) < 0) return -1;
+	fd = open(path, O_RDWR | O_CREAT, 0666);
+	if (fd < 0) return -1;
+	size = SHMRING_HEADER_SIZE + (size_t)slot_count * slot_size;
+	if (ftruncate(fd, size) < 0 || map(r, fd, size) < 0) {
+		close(fd);
+		return -1;
+	}
+	h = r->hdr;
+	if (h->magic == SHMRING_MAGIC && h->version == SHMRING_VERSION &&
+		h->slot_count == slot_count && h->slot_size == slot_size) {
+		/* producer may already be attached, skip what it left behind */
+		publish(&h->read_seq, __atomic_load_n(&h->write_seq, __ATOMIC_ACQUIRE),
+				&h->space_futex, &h->producer_waiting);
+		return 0;
+	}
+	memset(h, 0, sizeof(*h));
+	h->slot_count = slot_count;
+	h->slot_size = slot_size;
+	h->version = SHMRING_VERSION;
+	__atomic_store_n(&h->magic, SHMRING_MAGIC, __ATOMIC_RELEASE);
+	return 0;
+}
+int shmring_attach(struct shmring *r, const char *name) {
+	char path[PATH_MAX];
+	struct shmring_header h;
+	int fd;
+
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+	if (shm_path(path, sizeof(path), name) < 0) return -1;
+	fd = open(path, O_RDWR);
+	if (fd < 0) return -1;
+	if (pread(fd, &h, sizeof(h), 0) != sizeof(h) || h.magic != SHMRING_MAGIC ||
+		h.version != SHMRING_VERSION) {
+		close(fd);
+		errno = EPROTO;
+		return -1;
+	}
+	if (map(r, fd, SHMRING_HEADER_SIZE + (size_t)h.slot_count * h.slot_size) < 0) {
+		close(fd);
+		return -1;
+	}
+	return 0;
+}
+int shmring_write(struct shmring *r, const char *data, size_t len, int timeout_ms) {
+	struct shmring_header *h = r->hdr;
+	uint64_t w = h->write_seq, rd;
+	char *slot;
+
+	while ((rd = __atomic_load_n(&h->read_seq, __ATOMIC_ACQUIRE)) + h->slot_count == w) {
+		if (wait_for(&h->space_futex, &h->producer_waiting, &h->read_seq, rd,
+					 timeout_ms) < 0) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+	}
+	if (len > h->slot_size - sizeof(uint32_t)) len = h->slot_size - sizeof(uint32_t);
+	slot = r->slots + (size_t)(w % h->slot_count) * h->slot_size;
+	*(uint32_t *)slot = len;
+	memcpy(slot + sizeof(uint32_t), data, len);
+	publish(&h->write_seq, w + 1, &h->data_futex, &h->consumer_waiting);
+	return len;
+}
+int shmring_read(struct shmring *r, char *buf, int timeout_ms) {
+	struct shmring_header *h = r->hdr;
+	uint64_t rd = h->read_seq;
+	uint32_t len;
+	char *slot;
+
+	if (__atomic_load_n(&h->write_seq, __ATOMIC_ACQUIRE) == rd &&
+		wait_for(&h->data_futex, &h->consumer_waiting, &h->write_seq, rd,
+				 timeout_ms) < 0)
+		return 0;
+	slot = r->slots + (size_t)(rd % h->slot_count) * h->slot_size;
+	len = *(uint32_t *)slot;
+	if (len > h->slot_size - sizeof(uint32_t)) len = h->slot_size - sizeof(uint32_t);
+	memcpy(buf, slot + sizeof(uint32_t), len);
+	publish(&h->read_seq, rd + 1, &h->space_futex, &h->producer_waiting);
+	return len;
+}
+void shmring_close(struct shmring *r) {
+	if (r->hdr) munmap(r->hdr, r->map_size);
+	if (r->fd >= 0) close(r->fd);
+	r->hdr = NULL;
+	r->fd = -1;
+}
@@ -0,0 +1,84 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+*
+* This file is part of udpproxy.
+*
+* udpproxy is free software; you can redistribute it and/or
+        * modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+        * version 2.1 of the License, or (at your option) any later version.
+*
+* udpproxy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#ifndef __SHMRING_H__
+#define __SHMRING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Single producer, single consumer ring of TS packets in shared memory.
+ *
+ * The ring lives in /dev/shm/<name> and is laid out as
+ *
+ *   struct shmring_header        one 4KB page
+ *   slot[0 .. slot_count)        slot_size bytes each:
+ *                                uint32_t length, then length bytes of TS
+ *
+ * write_seq and read_seq only ever increase; slot i of a sequence number
+ * is seq % slot_count. The producer fills the slot at write_seq and then
+ * publishes it with a release store of write_seq + 1, the consumer does
+ * the same with read_seq once a slot has been copied out. Neither side
+ * spins: data_futex is bumped after each publish and woken only if the
+ * consumer set consumer_waiting, space_futex likewise for a producer
+ * waiting on a full ring, so no syscall is made while the other side
+ * keeps up.
+ *
+ * The consumer creates the ring (shmring_create) and drops anything left
+ * unread from a previous run; producers attach (shmring_attach). */
+#define SHMRING_MAGIC 0x55445052u     /* "UDPR" */
+#define SHMRING_VERSION 1
+#define SHMRING_HEADER_SIZE 4096
+/* 7 TS packets, the usual UDP payload */
+#define SHMRING_DEFAULT_SLOT_SIZE (4 + 7 * 188)
+#define SHMRING_DEFAULT_SLOT_COUNT 4096
+
+struct shmring_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slot_size;
+	uint32_t slot_count;
+	/* producer side, own cache line */
+	uint64_t write_seq __attribute__((aligned(64)));
+	uint32_t data_futex;
+	uint32_t producer_waiting;
+	/* consumer side */
+	uint64_t read_seq __attribute__((aligned(64)));
+	uint32_t space_futex;
+	uint32_t consumer_waiting;
+};
+
+struct shmring {
+	struct shmring_header *hdr;
+	char *slots;
+	size_t map_size;
+	int fd;
+};
+
+/* return 0 on success, -1 with errno set */
+int shmring_create(struct shmring *, const char *name, uint32_t slot_count,
+				   uint32_t slot_size);
+int shmring_attach(struct shmring *, const char *name);
+/* producer: copies up to slot_size - 4 bytes into the next slot, waiting
+ * up to timeout_ms for space (-1 forever); returns -1/ETIMEDOUT if full */
+int shmring_write(struct shmring *, const char *data, size_t len, int timeout_ms);
+/* consumer: copies the next slot into buf (at least slot_size - 4 bytes),
+ * waiting up to timeout_ms; returns the length, 0 on timeout */
+int shmring_read(struct shmring *, char *buf, int timeout_ms);
+void shmring_close(struct shmring *);
+#endif
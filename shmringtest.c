@@ -0,0 +1,196 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+/* Shared memory ring round trip check.
+ *
+ *     udpproxy-shmringtest [packets]
+ *
+ * Pushes packets of varying length through a small ring from a producer
+ * thread and checks that the consumer sees every one in order with its
+ * content intact. Before that, a blocked consumer (empty ring) and a
+ * blocked producer (full ring) must be woken by the other side well
+ * before their timeout, which fails if a futex wake is lost. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "shmring.h"
+/* ------------------------------------------------------------------------- */
+#define TEST_SLOTS 8
+#define TEST_PAYLOAD (SHMRING_DEFAULT_SLOT_SIZE - 4)
+/* the side that is woken sleeps with this timeout, the waker acts after DELAY */
+#define WAKE_TIMEOUT_MS 3000
+#define WAKE_DELAY_MS 100
+
+static struct shmring producer, consumer;
+static unsigned long packets = 200000;
+
+static double now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+static void sleep_ms(int ms) {
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+	nanosleep(&ts, NULL);
+}
+/* packet i: 8 byte sequence number, then a pattern derived from it */
+static size_t make_packet(char *buf, unsigned long i) {
+	size_t len = 8 + (i * 7919) % (TEST_PAYLOAD - 8 + 1), j;
+	uint64_t seq = i;
+	memcpy(buf, &seq, sizeof(seq));
+	for (j = 8; j < len; j++) buf[j] = (char)(i * 31 + j);
+	return len;
+}
+static int check_packet(const char *buf, int len, unsigned long i) {
+	char expect[TEST_PAYLOAD];
+	size_t n = make_packet(expect, i);
+	if ((size_t)len != n || memcmp(buf, expect, n)) {
+		uint64_t seq = 0;
+		if (len >= 8) memcpy(&seq, buf, sizeof(seq));
+		fprintf(stderr, "packet %lu: got seq %llu len %d, expected len %zu\n",
+				i, (unsigned long long)seq, len, n);
+		return -1;
+	}
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+static void *delayed_write(void *arg) {
+	char buf[TEST_PAYLOAD];
+	(void)arg;
+	sleep_ms(WAKE_DELAY_MS);
+	shmring_write(&producer, buf, make_packet(buf, 0), -1);
+	return NULL;
+}
+static void *delayed_read(void *arg) {
+	char buf[TEST_PAYLOAD];
+	(void)arg;
+	sleep_ms(WAKE_DELAY_MS);
+	shmring_read(&consumer, buf, -1);
+	return NULL;
+}
+/* a consumer sleeping on an empty ring and a producer sleeping on a full
+ * one are both woken as soon as the other side publishes */
+static int test_wake(void) {
+	char buf[TEST_PAYLOAD];
+	pthread_t tid;
+	double t;
+	int i, len;
+
+	pthread_create(&tid, NULL, delayed_write, NULL);
+	t = now_ms();
+	len = shmring_read(&consumer, buf, WAKE_TIMEOUT_MS);
+	t = now_ms() - t;
+	pthread_join(tid, NULL);
+	if (len <= 0 || check_packet(buf, len, 0) < 0 || t > WAKE_TIMEOUT_MS / 2) {
+		fprintf(stderr, "empty ring: consumer woken after %.1f ms, len %d\n", t, len);
+		return -1;
+	}
+	printf("empty ring: consumer woken after %.1f ms\n", t);
+
+	for (i = 0; i < TEST_SLOTS; i++)
+		shmring_write(&producer, buf, make_packet(buf, i), 0);
+	if (shmring_write(&producer, buf, make_packet(buf, i), 0) >= 0 || errno != ETIMEDOUT) {
+		fprintf(stderr, "full ring: write did not time out\n");
+		return -1;
+	}
+	pthread_create(&tid, NULL, delayed_read, NULL);
+	t = now_ms();
+	len = shmring_write(&producer, buf, make_packet(buf, i), WAKE_TIMEOUT_MS);
+	t = now_ms() - t;
+	pthread_join(tid, NULL);
+	if (len <= 0 || t > WAKE_TIMEOUT_MS / 2) {
+		fprintf(stderr, "full ring: producer woken after %.1f ms, len %d\n", t, len);
+		return -1;
+	}
+	printf("full ring: producer woken after %.1f ms\n", t);
+
+	/* drain, the ring must be empty again afterwards */
+	for (i = 1; i <= TEST_SLOTS; i++) {
+		len = shmring_read(&consumer, buf, 0);
+		if (check_packet(buf, len, i) < 0) return -1;
+	}
+	if (shmring_read(&consumer, buf, 0) != 0) {
+		fprintf(stderr, "ring not empty after drain\n");
+		return -1;
+	}
+	return 0;
+}
+/* ------------------------------------------------------------------------- */
+static void *produce(void *arg) {
+	char buf[TEST_PAYLOAD];
+	unsigned long i;
+	(void)arg;
+	for (i = 0; i < packets; i++) {
+		/* a timeout also ends the thread if the consumer gave up */
+		if (shmring_write(&producer, buf, make_packet(buf, i), WAKE_TIMEOUT_MS) < 0) {
+			fprintf(stderr, "packet %lu: ", i);
+			perror("shmring_write");
+			break;
+		}
+		/* pause now and then so the consumer also drains the ring empty */
+		if (i % 10007 == 0) sleep_ms(1);
+	}
+	return NULL;
+}
+static int test_stream(void) {
+	char buf[TEST_PAYLOAD];
+	unsigned long i;
+	pthread_t tid;
+	double t = now_ms();
+	int len;
+
+	pthread_create(&tid, NULL, produce, NULL);
+	for (i = 0; i < packets; i++) {
+		len = shmring_read(&consumer, buf, WAKE_TIMEOUT_MS);
+		if (len <= 0) {
+			fprintf(stderr, "packet %lu: read timed out\n", i);
+			break;
+		}
+		if (check_packet(buf, len, i) < 0) break;
+		/* and stall now and then so the producer fills it */
+		if (i % 9973 == 0) sleep_ms(1);
+	}
+	pthread_join(tid, NULL);
+	if (i < packets) return -1;
+	t = now_ms() - t;
+	printf("%lu packets in order and intact, %.0f packets/s\n", packets, packets / t * 1e3);
+	return 0;
+}
+int main(int argc, char *argv[]) {
+	char name[64];
+	int ret;
+
+	if (argc > 1) packets = strtoul(argv[1], NULL, 0);
+	snprintf(name, sizeof(name), "udpproxy-shmringtest.%d", (int)getpid());
+	if (shmring_create(&consumer, name, TEST_SLOTS, 0) < 0 ||
+		shmring_attach(&producer, name) < 0) {
+		perror("shmring");
+		return 1;
+	}
+	ret = test_wake() < 0 || test_stream() < 0;
+	shmring_close(&producer);
+	shmring_close(&consumer);
+	snprintf(name, sizeof(name), "/dev/shm/udpproxy-shmringtest.%d", (int)getpid());
+	unlink(name);
+	printf("%s\n", ret ? "FAILED" : "OK");
+	return ret;
+}
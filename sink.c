@@ -0,0 +1,545 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+/* udpproxy-sink: receiver and analyzer for what udpproxy puts on the wire.
+ *
+ *     udpproxy-sink -p port [-b bind address] [-i interval] [-d duration] [-j] [-n]
+ *
+ * Reads with recvmmsg() and kernel receive timestamps and prints, every
+ * interval seconds, datagrams/s, Mbit/s, TS continuity counter errors,
+ * PCR jitter and, when the output is RTP or udp_datapack framed, lost
+ * and reordered datagrams. The framing is detected on the first datagram
+ * (a leading udp_datapack control packet also counts). At exit
+ * (duration elapsed or SIGINT) a summary with the inter-arrival
+ * histogram is printed. Segments made by udpproxy-seggen also give the
+ * segment to wire latency (bench.h). With -j every report is one JSON
+ * object per line, the summary last. With -n the sink acts as a reliable
+ * mode receiver and sends REQ_FILE NACKs for the udp_datapack datagrams
+ * it misses (nack.h); retransmissions count as recovered, not lost. */
+#define _GNU_SOURCE /* recvmmsg */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "crc32c.h"
+#include "nack.h"
+#include "logger.h"
+#include "bench.h"
+/* ------------------------------------------------------------------------- */
+#define SINK_BATCH 64
+#define SINK_DGRAM_MAX 65536
+#define SINK_RCVBUF (8 * 1024 * 1024)
+#define TS_LEN 188
+#define TS_PIDS 8192
+/* inter-arrival histogram: bucket i counts gaps in [2^(i-1), 2^i) microseconds */
+#define HIST_BUCKETS 24
+
+enum framing { FRAMING_UNKNOWN = -1, FRAMING_PLAIN, FRAMING_RTP, FRAMING_DATAPACK };
+static const char *framing_name[] = { "plain", "rtp", "udp_datapack" };
+
+struct counters {
+	uint64_t datagrams;
+	uint64_t bytes;
+	uint64_t ts_packets;
+	uint64_t cc_errors;
+	uint64_t lost;
+	uint64_t reordered;
+	uint64_t duplicates;
+	uint64_t crc_errors;
+	uint64_t recovered;          /* retransmissions that filled a gap */
+	uint64_t control;            /* udp_datapack NACK/heartbeat packets */
+	uint64_t segments;           /* bench stamps seen */
+	int64_t pcr_jitter_min;      /* microseconds, arrival - PCR drift */
+	int64_t pcr_jitter_max;
+	int64_t gap_max;
+};
+
+struct sink {
+	struct counters total;
+	struct counters interval;
+	uint64_t hist[HIST_BUCKETS];
+	enum framing framing;
+	int64_t last_arrival;
+	/* sequence tracking, 32 bit; RTP is extended from 16 bit */
+	int have_seq;
+	uint32_t next_seq;
+	/* TS; plain and udp_datapack payloads are not packet aligned */
+	unsigned char carry[TS_LEN];
+	int carry_len;
+	signed char cc[TS_PIDS];     /* -1 unknown */
+	int pcr_pid;
+	int64_t pcr_base_arrival;
+	int64_t pcr_base;            /* 27MHz, first PCR seen */
+	int64_t pcr_last;
+	/* -n: NACKs go to the sender of the udp_datapack datagrams */
+	int nack;
+	int fd;
+	struct sockaddr_in peer;
+	struct nack_receiver rx;
+	/* segment to wire latency of every bench stamp, microseconds */
+	int64_t *latency;
+	size_t latency_count;
+	size_t latency_cap;
+};
+
+static volatile sig_atomic_t stop;
+
+/* ------------------------------------------------------------------------- */
+static void on_signal(int sig) {
+	stop = 1;
+}
+static int64_t ts_us(const struct timespec *ts) {
+	return (int64_t)ts->tv_sec * 1000000 + ts->tv_nsec / 1000;
+}
+static int64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts_us(&ts);
+}
+static uint32_t get32(const unsigned char *p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+static void reset_counters(struct counters *c) {
+	memset(c, 0, sizeof(*c));
+	c->pcr_jitter_min = INT64_MAX;
+	c->pcr_jitter_max = INT64_MIN;
+}
+/* ------------------------------------------------------------------------- */
+static void count(struct sink *s, size_t field, uint64_t v) {
+	*(uint64_t *)((char *)&s->total + field) += v;
+	*(uint64_t *)((char *)&s->interval + field) += v;
+}
+#define COUNT(s, field, v) count(s, offsetof(struct counters, field), v)
+
+/* a datagram counted as lost arrived after all */
+static void uncount_lost(struct sink *s) {
+	if (s->total.lost) {
+		s->total.lost--;
+		if (s->interval.lost) s->interval.lost--;
+	}
+}
+
+/* returns 0 for a datagram that is late or duplicated */
+static int track_seq(struct sink *s, uint32_t seq, int bits) {
+	uint32_t mask = bits == 32 ? 0xffffffffu : (1u << bits) - 1;
+	int32_t diff;
+	if (!s->have_seq) {
+		s->have_seq = 1;
+		s->next_seq = seq;
+	}
+	diff = (int32_t)((seq - s->next_seq) & mask);
+	if (bits < 32 && diff >= (int32_t)(mask >> 1)) diff -= mask + 1;
+	if (diff == 0) {
+		s->next_seq = (seq + 1) & mask;
+	} else if (diff > 0) {
+		COUNT(s, lost, diff);
+		s->carry_len = 0;
+		s->next_seq = (seq + 1) & mask;
+	} else if (diff == -1) {
+		COUNT(s, duplicates, 1);
+	} else {
+		/* late arrival of something counted as lost */
+		COUNT(s, reordered, 1);
+		uncount_lost(s);
+	}
+	return diff >= 0;
+}
+static void track_pcr(struct sink *s, const unsigned char *p, int pid, int64_t arrival) {
+	int64_t pcr, drift;
+	if (!(p[3] & 0x20) || p[4] < 7 || !(p[5] & 0x10)) return;
+	if (s->pcr_pid < 0) s->pcr_pid = pid;
+	if (pid != s->pcr_pid) return;
+	pcr = (((int64_t)p[6] << 25) | ((int64_t)p[7] << 17) | ((int64_t)p[8] << 9) |
+		   ((int64_t)p[9] << 1) | (p[10] >> 7)) * 300 + (((p[10] & 1) << 8) | p[11]);
+	/* restart the reference on wrap or discontinuity */
+	if (s->pcr_base < 0 || pcr < s->pcr_last || pcr - s->pcr_last > 27000000LL * 10) {
+		s->pcr_base = pcr;
+		s->pcr_base_arrival = arrival;
+	}
+	s->pcr_last = pcr;
+	drift = (arrival - s->pcr_base_arrival) - (pcr - s->pcr_base) / 27;
+	if (drift < s->interval.pcr_jitter_min) s->interval.pcr_jitter_min = drift;
+	if (drift > s->interval.pcr_jitter_max) s->interval.pcr_jitter_max = drift;
+	if (drift < s->total.pcr_jitter_min) s->total.pcr_jitter_min = drift;
+	if (drift > s->total.pcr_jitter_max) s->total.pcr_jitter_max = drift;
+}
+static void track_stamp(struct sink *s, const unsigned char *p, int64_t arrival) {
+	uint32_t seq;
+	int64_t us, *grown;
+	if ((p[3] & 0x30) != 0x10 || bench_stamp_get(p + 4, &seq, &us) < 0) return;
+	COUNT(s, segments, 1);
+	if (s->latency_count == s->latency_cap) {
+		grown = realloc(s->latency, (s->latency_cap ? s->latency_cap * 2 : 1024) *
+							sizeof(*grown));
+		if (!grown) return;
+		s->latency = grown;
+		s->latency_cap = s->latency_cap ? s->latency_cap * 2 : 1024;
+	}
+	s->latency[s->latency_count++] = arrival - us;
+}
+static void track_packet(struct sink *s, const unsigned char *p, int64_t arrival) {
+	int pid = ((p[1] & 0x1f) << 8) | p[2], cc = p[3] & 0x0f;
+
+	COUNT(s, ts_packets, 1);
+	if (pid == BENCH_PID) track_stamp(s, p, arrival);
+	track_pcr(s, p, pid, arrival);
+	/* null packets and packets without payload do not advance CC */
+	if (pid == 0x1fff || !(p[3] & 0x10)) return;
+	if (s->cc[pid] >= 0 && cc != ((s->cc[pid] + 1) & 0x0f) && cc != s->cc[pid])
+		COUNT(s, cc_errors, 1);
+	s->cc[pid] = cc;
+}
+/* packets may straddle datagrams; the remainder is carried over and
+ * the stream is resynchronized on 0x47 after a loss */
+static void track_ts(struct sink *s, const unsigned char *p, int len, int64_t arrival) {
+	int n;
+	if (s->carry_len) {
+		n = TS_LEN - s->carry_len < len ? TS_LEN - s->carry_len : len;
+		memcpy(s->carry + s->carry_len, p, n);
+		s->carry_len += n;
+		p += n;
+		len -= n;
+		if (s->carry_len < TS_LEN) return;
+		if (s->carry[0] == 0x47) track_packet(s, s->carry, arrival);
+		s->carry_len = 0;
+	}
+	while (len > 0) {
+		if (p[0] != 0x47) {
+			p++;
+			len--;
+			continue;
+		}
+		if (len < TS_LEN) {
+			memcpy(s->carry, p, len);
+			s->carry_len = len;
+			return;
+		}
+		track_packet(s, p, arrival);
+		p += TS_LEN;
+		len -= TS_LEN;
+	}
+}
+static int datapack_valid(const unsigned char *p, int len) {
+	uint32_t size = get32(p + 5);
+	return size <= (uint32_t)(len - UDP_HEAD_LEN) &&
+		   crc32c(p + UDP_HEAD_LEN, size) == get32(p + 9);
+}
+static int rtp_header_len(const unsigned char *p, int len) {
+	int hdr = 12 + (p[0] & 0x0f) * 4;
+	if ((p[0] & 0xc0) != 0x80 || len < hdr + TS_LEN) return -1;
+	return hdr;
+}
+/* plain output is cut at send_buf_size rather than at 188, so only
+ * framings that are unlikely to occur by chance are recognized */
+static enum framing detect_framing(const unsigned char *p, int len) {
+	int hdr;
+	if (p[0] == 0x47) return FRAMING_PLAIN;
+	hdr = rtp_header_len(p, len);
+	if (hdr > 0 && p[hdr] == 0x47 && (len - hdr) % TS_LEN == 0) return FRAMING_RTP;
+	if (len == UDP_HEAD_LEN && p[0] < FILE_DATE) return FRAMING_DATAPACK;
+	if (len > UDP_HEAD_LEN && p[0] == FILE_DATE && datapack_valid(p, len))
+		return FRAMING_DATAPACK;
+	return FRAMING_PLAIN;
+}
+/* reliable mode receiver, the sequence is tracked by s->rx */
+static void track_datapack(struct sink *s, const unsigned char *p, int64_t arrival) {
+	uint32_t missing;
+	switch (nack_receiver_data(&s->rx, get32(p + 1), &missing)) {
+	case NACK_NEW:
+		if (missing) {
+			COUNT(s, lost, missing);
+			s->carry_len = 0;
+		}
+		track_ts(s, p + UDP_HEAD_LEN, get32(p + 5), arrival);
+		break;
+	case NACK_RECOVERED:
+		COUNT(s, recovered, 1);
+		uncount_lost(s);
+		break;
+	default:
+		COUNT(s, duplicates, 1);
+		break;
+	}
+}
+static void send_nack(struct sink *s) {
+	unsigned char wire[UDP_HEAD_LEN + 8 * NACK_RANGES];
+	int len = nack_receiver_poll(&s->rx, wire);
+	if (len > 0)
+		sendto(s->fd, wire, len, 0, (struct sockaddr *)&s->peer, sizeof(s->peer));
+}
+static void datagram(struct sink *s, const unsigned char *p, int len, int64_t arrival,
+					 const struct sockaddr_in *from) {
+	uint32_t missing;
+	int64_t gap;
+	int b = 0, hdr;
+
+	COUNT(s, datagrams, 1);
+	COUNT(s, bytes, len);
+	if (s->last_arrival) {
+		gap = arrival - s->last_arrival;
+		if (gap < 0) gap = 0;
+		if (gap > s->interval.gap_max) s->interval.gap_max = gap;
+		if (gap > s->total.gap_max) s->total.gap_max = gap;
+		while (b < HIST_BUCKETS - 1 && gap >= (1LL << b)) b++;
+		s->hist[b]++;
+	}
+	s->last_arrival = arrival;
+
+	if (s->framing == FRAMING_UNKNOWN) s->framing = detect_framing(p, len);
+	switch (s->framing) {
+	case FRAMING_RTP:
+		hdr = rtp_header_len(p, len);
+		if (hdr < 0) break;
+		if (track_seq(s, (p[2] << 8) | p[3], 16))
+			track_ts(s, p + hdr, len - hdr, arrival);
+		break;
+	case FRAMING_DATAPACK:
+		if (len < UDP_HEAD_LEN) break;
+		s->peer = *from;
+		if (p[0] != FILE_DATE) {
+			COUNT(s, control, 1);
+			if (!s->nack) break;
+			/* a heartbeat reveals a loss at the tail */
+			missing = nack_receiver_control(&s->rx, p[0], get32(p + 1), get32(p + 5));
+			if (missing) {
+				COUNT(s, lost, missing);
+				s->carry_len = 0;
+			}
+		} else if (!datapack_valid(p, len)) {
+			COUNT(s, crc_errors, 1);
+		} else if (s->nack) {
+			track_datapack(s, p, arrival);
+		} else if (track_seq(s, get32(p + 1), 32)) {
+			/* retransmissions answer NACKs from another receiver */
+			track_ts(s, p + UDP_HEAD_LEN, get32(p + 5), arrival);
+		}
+		break;
+	default:
+		track_ts(s, p, len, arrival);
+		break;
+	}
+}
+/* ------------------------------------------------------------------------- */
+static void report(struct sink *s, double elapsed, double secs, int json) {
+	struct counters *c = &s->interval;
+	if (json) {
+		printf("{\"t\":%.3f,\"dgram_s\":%.0f,\"mbps\":%.3f,\"cc_errors\":%llu,"
+			   "\"lost\":%llu,\"segments\":%llu}\n",
+			   elapsed, c->datagrams / secs, c->bytes * 8 / secs / 1e6,
+			   (unsigned long long)c->cc_errors, (unsigned long long)c->lost,
+			   (unsigned long long)s->total.segments);
+		fflush(stdout);
+		reset_counters(c);
+		return;
+	}
+	printf("%8.0f dgram/s %9.3f Mbit/s  ts %llu cc_err %llu  lost %llu reord %llu dup %llu"
+		   "  crc_err %llu  gap_max %.3fms",
+		   c->datagrams / secs, c->bytes * 8 / secs / 1e6,
+		   (unsigned long long)c->ts_packets, (unsigned long long)c->cc_errors,
+		   (unsigned long long)c->lost, (unsigned long long)c->reordered,
+		   (unsigned long long)c->duplicates, (unsigned long long)c->crc_errors,
+		   c->gap_max / 1000.0);
+	if (c->pcr_jitter_max >= c->pcr_jitter_min)
+		printf("  pcr_jitter %.3fms", (c->pcr_jitter_max - c->pcr_jitter_min) / 1000.0);
+	printf("\n");
+	fflush(stdout);
+	reset_counters(c);
+}
+static int cmp_int64(const void *a, const void *b) {
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+	return x < y ? -1 : x > y;
+}
+static double latency_ms(const struct sink *s, double pct) {
+	size_t i;
+	if (!s->latency_count) return 0;
+	i = (size_t)(pct / 100 * (s->latency_count - 1) + 0.5);
+	return s->latency[i] / 1000.0;
+}
+static void summary(struct sink *s, double secs, int json) {
+	struct counters *c = &s->total;
+	double pcr_jitter = c->pcr_jitter_max >= c->pcr_jitter_min ?
+						(c->pcr_jitter_max - c->pcr_jitter_min) / 1000.0 : 0;
+	int i, f = s->framing == FRAMING_UNKNOWN ? FRAMING_PLAIN : s->framing;
+
+	qsort(s->latency, s->latency_count, sizeof(*s->latency), cmp_int64);
+	if (json) {
+		printf("{\"seconds\":%.3f,\"framing\":\"%s\",\"datagrams\":%llu,\"bytes\":%llu,"
+			   "\"mbps\":%.3f,\"ts_packets\":%llu,\"cc_errors\":%llu,\"lost\":%llu,"
+			   "\"reordered\":%llu,\"duplicates\":%llu,\"crc_errors\":%llu,"
+			   "\"recovered\":%llu,\"nack_requested\":%llu,\"nack_expired\":%llu,"
+			   "\"nack_abandoned\":%llu,\"gap_max_ms\":%.3f,\"pcr_jitter_ms\":%.3f,\"gap_histogram_us\":[",
+			   secs, framing_name[f], (unsigned long long)c->datagrams,
+			   (unsigned long long)c->bytes, secs > 0 ? c->bytes * 8 / secs / 1e6 : 0,
+			   (unsigned long long)c->ts_packets, (unsigned long long)c->cc_errors,
+			   (unsigned long long)c->lost, (unsigned long long)c->reordered,
+			   (unsigned long long)c->duplicates, (unsigned long long)c->crc_errors,
+			   (unsigned long long)c->recovered, (unsigned long long)s->rx.requested,
+			   (unsigned long long)s->rx.expired, (unsigned long long)s->rx.abandoned,
+			   c->gap_max / 1000.0, pcr_jitter);
+		for (i = 0; i < HIST_BUCKETS; i++)
+			printf("%s%llu", i ? "," : "", (unsigned long long)s->hist[i]);
+		printf("],\"segments\":%llu,\"latency_p50_ms\":%.3f,\"latency_p90_ms\":%.3f,"
+			   "\"latency_p99_ms\":%.3f,\"latency_max_ms\":%.3f}\n",
+			   (unsigned long long)c->segments, latency_ms(s, 50), latency_ms(s, 90),
+			   latency_ms(s, 99), latency_ms(s, 100));
+		return;
+	}
+	printf("--- %.1fs, framing %s: %llu datagrams, %llu bytes, %.3f Mbit/s\n",
+		   secs, framing_name[f], (unsigned long long)c->datagrams,
+		   (unsigned long long)c->bytes, secs > 0 ? c->bytes * 8 / secs / 1e6 : 0);
+	printf("ts packets %llu, cc errors %llu, lost %llu, reordered %llu, duplicates %llu, "
+		   "crc errors %llu, control %llu\n",
+		   (unsigned long long)c->ts_packets, (unsigned long long)c->cc_errors,
+		   (unsigned long long)c->lost, (unsigned long long)c->reordered,
+		   (unsigned long long)c->duplicates, (unsigned long long)c->crc_errors,
+		   (unsigned long long)c->control);
+	if (s->nack)
+		printf("nack: requested %llu, recovered %llu, expired %llu, abandoned %llu, "
+			   "%u ranges open\n", (unsigned long long)s->rx.requested,
+			   (unsigned long long)c->recovered, (unsigned long long)s->rx.expired,
+			   (unsigned long long)s->rx.abandoned, s->rx.ranges);
+	printf("max gap %.3fms, pcr jitter %.3fms\n", c->gap_max / 1000.0, pcr_jitter);
+	if (s->latency_count)
+		printf("%llu segments, latency p50 %.3fms p90 %.3fms p99 %.3fms max %.3fms\n",
+			   (unsigned long long)c->segments, latency_ms(s, 50), latency_ms(s, 90),
+			   latency_ms(s, 99), latency_ms(s, 100));
+	printf("inter-arrival histogram:\n");
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		if (!s->hist[i]) continue;
+		printf("  %9lldus - %9lldus %llu\n", i ? 1LL << (i - 1) : 0LL, 1LL << i,
+			   (unsigned long long)s->hist[i]);
+	}
+}
+/* ------------------------------------------------------------------------- */
+int main(int argc, char *argv[]) {
+	static struct sink s;
+	struct sockaddr_in addr;
+	struct mmsghdr msgs[SINK_BATCH];
+	struct iovec iov[SINK_BATCH];
+	char control[SINK_BATCH][CMSG_SPACE(sizeof(struct timespec))];
+	struct sockaddr_in from[SINK_BATCH];
+	struct cmsghdr *cmsg;
+	struct timeval tv = { 0, 200000 };
+	struct timespec stamp;
+	unsigned char *buf;
+	const char *bind_ip = NULL;
+	double interval = 1, duration = 0;
+	int64_t start = 0, last_report = 0, arrival, now;
+	int fd, port = 0, json = 0, on = 1, rcvbuf = SINK_RCVBUF, c, i, n;
+
+	/* nack.c logs through the process logger, which is never opened */
+	log_set_level(LOG_LEVEL_MAX);
+	while ((c = getopt(argc, argv, "p:b:i:d:jn")) != -1) {
+		switch (c) {
+		case 'p': port = atoi(optarg); break;
+		case 'b': bind_ip = optarg; break;
+		case 'i': interval = atof(optarg); break;
+		case 'd': duration = atof(optarg); break;
+		case 'j': json = 1; break;
+		case 'n': s.nack = 1; break;
+		default: port = 0; break;
+		}
+	}
+	if (port <= 0) {
+		fprintf(stderr, "usage: %s -p port [-b bind address] [-i interval] "
+				"[-d duration] [-j] [-n]\n", argv[0]);
+		return 1;
+	}
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind_ip && inet_pton(AF_INET, bind_ip, &addr.sin_addr) != 1) {
+		fprintf(stderr, "invalid address %s\n", bind_ip);
+		return 1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+	/* wake up for NACK retries while the stream stalls */
+	if (s.nack) tv.tv_usec = NACK_MIN_RESEND_US;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		return 1;
+	}
+	buf = malloc((size_t)SINK_BATCH * SINK_DGRAM_MAX);
+	if (!buf) return 1;
+	memset(s.cc, -1, sizeof(s.cc));
+	s.fd = fd;
+	nack_receiver_init(&s.rx);
+	s.framing = FRAMING_UNKNOWN;
+	s.pcr_pid = -1;
+	s.pcr_base = -1;
+	reset_counters(&s.total);
+	reset_counters(&s.interval);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	while (!stop) {
+		for (i = 0; i < SINK_BATCH; i++) {
+			iov[i].iov_base = buf + (size_t)i * SINK_DGRAM_MAX;
+			iov[i].iov_len = SINK_DGRAM_MAX;
+			memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = &from[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+			msgs[i].msg_hdr.msg_control = control[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+		}
+		n = recvmmsg(fd, msgs, SINK_BATCH, MSG_WAITFORONE, NULL);
+		now = now_us();
+		for (i = 0; i < n; i++) {
+			arrival = now;
+			for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg;
+				 cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+				if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+					memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+					arrival = ts_us(&stamp);
+				}
+			}
+			if (!start) start = last_report = arrival;
+			datagram(&s, iov[i].iov_base, msgs[i].msg_len, arrival, &from[i]);
+		}
+		/* one NACK for all the gaps this batch found, retries included */
+		if (s.nack && s.rx.ranges) send_nack(&s);
+		if (!start) continue;
+		if (interval > 0 && now - last_report >= interval * 1e6) {
+			report(&s, (now - start) / 1e6, (now - last_report) / 1e6, json);
+			last_report = now;
+		}
+		if (duration > 0 && now - start >= duration * 1e6) break;
+	}
+	/* throughput over the time data was actually flowing */
+	summary(&s, start ? (s.last_arrival - start) / 1e6 : 0, json);
+	free(s.latency);
+	free(buf);
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,146 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+ *
+ * This file is part of udpproxy.
+ *
+ * udpproxy is free software; you can redistribute it and/or
+         * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+         * version 2.1 of the License, or (at your option) any later version.
+ *
+ * udpproxy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "tsslice.h"
+#include "logger.h"
+/* ------------------------------------------------------------------------- */
+#define TS_SYNC_BYTE 0x47
+/* 33 bit PCR base, 90kHz */
+#define PCR_WRAP (1LL << 33)
+/* a PCR step this far from the nominal slice duration is a discontinuity */
+#define PCR_MAX_GAP_FACTOR 10
+#define SLICE_MIN_CAP (64 * TS_PACKET_LEN)
+
+/* ------------------------------------------------------------------------- */
+/* returns the PCR base of the packet or -1; stores the PID */
+static int64_t packet_pcr(const unsigned char *p, int *pid) {
+	*pid = ((p[1] & 0x1f) << 8) | p[2];
+	if (!(p[3] & 0x20) || p[4] < 7 || !(p[5] & 0x10))
+		return -1;
+	return ((int64_t)p[6] << 25) | ((int64_t)p[7] << 17) | ((int64_t)p[8] << 9) |
+		   ((int64_t)p[9] << 1) | (p[10] >> 7);
+}
+static void emit(struct ts_slicer *s, int64_t duration) {
+	size_t next_cap = s->len > SLICE_MIN_CAP ? s->len : SLICE_MIN_CAP;
+	if (s->len) {
+		s->cb(s->opaque, s->buf, s->len, duration);
+		/* the next slice is likely about as large, allocate once */
+		s->buf = malloc(next_cap);
+		s->cap = s->buf ? next_cap : 0;
+	}
+	s->len = 0;
+}
+static int append(struct ts_slicer *s, const unsigned char *p) {
+	if (s->len + TS_PACKET_LEN > s->cap) {
+		size_t cap = s->cap ? s->cap * 2 : SLICE_MIN_CAP;
+		char *buf = realloc(s->buf, cap);
+		if (!buf) return -1;
+		s->buf = buf;
+		s->cap = cap;
+	}
+	memcpy(s->buf + s->len, p, TS_PACKET_LEN);
+	s->len += TS_PACKET_LEN;
+	return 0;
+}
+static int packet(struct ts_slicer *s, const unsigned char *p) {
+	int pid;
+	int64_t pcr = packet_pcr(p, &pid), duration;
+
+	if (pcr >= 0 && s->pcr_pid < 0) s->pcr_pid = pid;
+	if (pcr >= 0 && pid == s->pcr_pid) {
+		if (s->start_pcr < 0) {
+			s->start_pcr = pcr;
+		} else {
+			duration = ((pcr - s->start_pcr + PCR_WRAP) % PCR_WRAP) * 100 / 9;
+			if (duration > s->slice_duration * PCR_MAX_GAP_FACTOR ||
+				((pcr - s->last_pcr + PCR_WRAP) % PCR_WRAP) * 100 / 9 >
+				s->slice_duration * PCR_MAX_GAP_FACTOR) {
+				log_info("tsslice: PCR discontinuity %lld -> %lld",
+						 (long long)s->last_pcr, (long long)pcr);
+				emit(s, s->slice_duration);
+				s->start_pcr = pcr;
+			} else if (duration >= s->slice_duration) {
+				emit(s, duration);
+				s->start_pcr = pcr;
+			}
+		}
+		s->last_pcr = pcr;
+	}
+	return append(s, p);
+}
+/* ------------------------------------------------------------------------- */
+int ts_slicer_init(struct ts_slicer *s, int64_t slice_duration, ts_slice_cb cb,
+				   void *opaque) {
+	memset(s, 0, sizeof(*s));
+	s->slice_duration = slice_duration;
+	s->cb = cb;
+	s->opaque = opaque;
+	s->pcr_pid = -1;
+	s->start_pcr = -1;
+	s->synced = 1;
+	return 0;
+}
+int ts_slicer_feed(struct ts_slicer *s, const char *data, size_t len) {
+	const unsigned char *p = (const unsigned char *)data, *end = p + len;
+	size_t n;
+
+	/* complete a packet split across two reads */
+	if (s->partial_len) {
+		n = TS_PACKET_LEN - s->partial_len;
+		if (n > len) n = len;
+		memcpy(s->partial + s->partial_len, p, n);
+		s->partial_len += n;
+		p += n;
+		if (s->partial_len < TS_PACKET_LEN) return 0;
+		s->partial_len = 0;
+		if (packet(s, s->partial) < 0) return -1;
+	}
+	while (p < end) {
+		if (*p != TS_SYNC_BYTE) {
+			if (s->synced) log_error_ratelimited("tsslice: lost sync, skipping to next 0x47");
+			s->synced = 0;
+			p++;
+			continue;
+		}
+		s->synced = 1;
+		if (end - p < TS_PACKET_LEN) {
+			s->partial_len = end - p;
+			memcpy(s->partial, p, s->partial_len);
+			break;
+		}
+		if (packet(s, p) < 0) return -1;
+		p += TS_PACKET_LEN;
+	}
+	return 0;
+}
+void ts_slicer_flush(struct ts_slicer *s) {
+	int64_t duration = s->slice_duration;
+	if (s->start_pcr >= 0 && s->last_pcr != s->start_pcr)
+		duration = ((s->last_pcr - s->start_pcr + PCR_WRAP) % PCR_WRAP) * 100 / 9;
+	emit(s, duration);
+	s->partial_len = 0;
+	s->pcr_pid = -1;
+	s->start_pcr = -1;
+}
+void ts_slicer_destroy(struct ts_slicer *s) {
+	free(s->buf);
+	s->buf = NULL;
+	s->len = s->cap = 0;
+}
@@ -0,0 +1,61 @@
+/* Copyright (c) 2015-2019 rlandjon <rlandjon@gmail.com>
+*
+* This file is part of udpproxy.
+*
+* udpproxy is free software; you can redistribute it and/or
+        * modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+        * version 2.1 of the License, or (at your option) any later version.
+*
+* udpproxy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+        * Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with ijkPlayer; if not, write to the Free Software
+        * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+#ifndef __TSSLICE_H__
+#define __TSSLICE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Cuts a continuous MPEG-TS byte stream into time slices in memory.
+ *
+ * The PCR of the first PID that carries one is used as the clock; a
+ * slice is closed right before the first PCR packet at least
+ * slice_duration after the PCR that opened it, so slices always start
+ * on a PCR and hold whole 188 byte packets. Input may be fed in chunks
+ * of any size; sync is recovered on the next 0x47 if it is lost.
+ *
+ * The callback takes ownership of data (free() it). duration is the PCR
+ * distance to the next slice in microseconds; across a PCR discontinuity,
+ * or for a slice without a PCR, the nominal slice_duration is reported. */
+#define TS_PACKET_LEN 188
+
+typedef void (*ts_slice_cb)(void *opaque, char *data, size_t len, int64_t duration);
+
+struct ts_slicer {
+	int64_t slice_duration;       /* microseconds */
+	ts_slice_cb cb;
+	void *opaque;
+	int pcr_pid;                  /* -1 until the first PCR */
+	int64_t start_pcr;            /* 90kHz PCR base opening the slice, -1 if none */
+	int64_t last_pcr;
+	char *buf;
+	size_t len;
+	size_t cap;
+	unsigned char partial[TS_PACKET_LEN];
+	size_t partial_len;
+	int synced;
+};
+
+int ts_slicer_init(struct ts_slicer *, int64_t slice_duration, ts_slice_cb cb, void *opaque);
+/* returns -1 if out of memory */
+int ts_slicer_feed(struct ts_slicer *, const char *data, size_t len);
+/* emits the pending slice, e.g. at end of input, and forgets the PCR pid */
+void ts_slicer_flush(struct ts_slicer *);
+void ts_slicer_destroy(struct ts_slicer *);
+#endif
@@ -21,6 +21,7 @@
 #include <sys/socket.h>
 #include <string.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <fcntl.h>
 #include <time.h>
 #include <sys/stat.h>
@@ -33,21 +34,33 @@
 #include <dirent.h>
 #include <getopt.h>
 #include <errno.h>
+#include <stdint.h>
+#include <sys/syscall.h>
 #include <sys/inotify.h>
+#include <signal.h>
+#include <poll.h>
 
 #include "string.h"
 
 #include "list.h"
 #include "logger.h"
+#include "logarchive.h"
 #include "config.h"
-
-/*udp_datapack->type*/
-#define REQ_FILE		0
-#define ACK_TRUE		1
-#define ACK_FAIL		2
-#define ACK_RECONNECT   3
-#define FILE_DATE		4
-
+#include "checkpoint.h"
+#include "retention.h"
+#include "playlist.h"
+#include "segname.h"
+#include "relay.h"
+#include "tsslice.h"
+#include "shmring.h"
+#include "nack.h"
+#include "fec.h"
+#include "rtp.h"
+#include "crc32c.h"
+#include "metrics.h"
+#include "queue.h"
+
+/*udp_datapack及包类型定义见nack.h*/
 
 /*udp_req->flag*/
 #define CLINET_EMPTY			0
@@ -58,62 +71,100 @@
 #define CLINET_LINK_ACK_FAIL    5
 
 /*send_ack flag.*/
-#define MAX       1024
-#define MAX_UDP_FILE_COUNT 512
-#define UDP_HEAD_LEN	13
 #define TIMEVAL      45
 #define UDP_PACKET_SIZE 4096
+//启动扫描时每次getdents64读取的缓冲区大小
+#define SCAN_DIR_BUF_SIZE (1024 * 1024)
 //微秒时间精度
 #define TIME_SCALE  (1000000)
+#define TS_PACKET_SIZE 188
+//tail模式下等待文件增长的超时时间(微秒)，防止丢失inotify事件
+#define TAIL_POLL_INTERVAL 100000
+//按时长排期发送时，落后超过该值(微秒)就重新对齐时钟，避免突发补发
+#define PACE_MAX_LATE 1000000
+/*stream模式每次从管道读取的大小*/
+#define STREAM_READ_SIZE (TS_PACKET_LEN * 512)
+/*stream_input以此开头时从共享内存环读取*/
+#define STREAM_SHM_PREFIX "shm:"
+/*共享内存环空闲时检查退出标志的间隔(毫秒)*/
+#define STREAM_SHM_POLL_MS 100
+//阻塞在管道、inotify或发送时刻上的线程至少按这个间隔检查退出标志
+#define EXIT_POLL_MS 100
 
 
-/*udp包格式定义*/
-struct udp_datapack {
-    char type;          /*数据包类型*/
-    long int label;     /*文件包号、请求包文件位置信息*/
-    int size;           /*包大小*/
-    int check;          /*CRC*/
-    char data[MAX];
-};
-
-/*传输的文件信息*/
-struct  file_infor {
-    int   file_fd;
-    char *file_path; //文件名
-    unsigned long  file_len;   //文件长度
-    int64_t  timestamp;  //文件开始时间戳信息
-    off_t  seek_flag;
-    int      timeout;    /*超时计时*/
-    int      dummy_flag;
-    struct list_head list;
-};
-
 struct Context {
     char *work_dir;
     char *log_dir;
+    int   log_async; //1: 日志由后台线程批量写入，调用线程只格式化
+    int   log_queue; //异步日志队列的记录数，0为默认
+    int   log_binary; //1: 二进制日志，只记录格式ID和原始参数，用udpproxy-logcat查看
+    int   log_level;  //低于此级别的日志在格式化前丢弃，SIGUSR1/SIGUSR2运行时调整
+    struct log_archive_policy log_archive_policy; //轮转后日志的压缩和保留策略
     char *dummy_file_path;
     int sock_fd;
-    int file_count; //当前保存的文件计数
     int send_buf_size; //默认分配1024大小保存单个文件
     char *send_buf;
     pthread_mutex_t file_list_mutex;
     pthread_cond_t  file_list_cond;
     pthread_mutex_t wait_mutex;
     pthread_cond_t  wait_cond;
+    pthread_cond_t  tail_cond; //正在写入的文件有新数据或者写入完成
 
     char *ip_addr;
     int   port;
     int64_t   start_wait_interval; //内部以微秒管理，开始等待start_wait_interval秒开始发送UDP数据
     int   send_dummy_interval;//等待send_dummy_interval秒 还没有从FTP收到数据，开始发送dummy数据
     int  exit;
+    int  tail_mode; //文件创建后即开始发送已写入的完整TS包
     int64_t sent_timestamp;
+    int64_t inflight_timestamp; //正在发送(锁外)的文件时间戳，早于它的文件不能再插到队首
+    char *checkpoint_path; //发送进度检查点文件，重启后从断点继续发送
+    int   checkpoint_sync_interval; //检查点刷盘间隔(毫秒)
+    struct checkpoint checkpoint;
+    struct checkpoint_pos checkpoint_pos;
+    char *playlist_name; //work_dir下的m3u8文件名，设置后按播放列表入队
+    struct playlist playlist;
+    char *file_template; //分片文件名模板，见segname.h
+    int64_t segment_duration; //%seq模板每个序号对应的时长(微秒)
+    struct segname segname;
+    int64_t playlist_clock; //按#EXTINF累加的媒体时间(微秒)
+    int64_t release_base;   //排期发送的单调时钟基准，-1表示未开始
+    char *stream_input; //stream模式输入，"-"为标准输入，否则为命名管道
+    int64_t stream_slice_duration; //stream模式按PCR切片的时长(微秒)
+    int64_t stream_clock; //已入队分片累加的媒体时间(微秒)
+    int   reliable;    //1: 按udp_datapack封装发送，根据接收端NACK重传
+    int   nack_window; //重传窗口保留的数据包个数
+    struct nack_sender nack;
+    int   fec_columns; //FEC矩阵列数L，0表示关闭
+    int   fec_rows;    //FEC矩阵行数D
+    int   fec_row_parity; //1: 同时发送行校验包(2D FEC)
+    int   fec_enabled;
+    struct fec_encoder fec;
+    int   segment_crc; //1: 计算每个分片已发送数据的CRC32C并记录日志
+    int   rtp;      //1: RTP封装输出(RFC 2250)
+    unsigned int rtp_ssrc; //0表示随机
+    struct rtp_sender rtp_sender;
+    char *relay_ip;   //relay模式输入地址，组播地址会自动加入组
+    int   relay_port; //设置后转发实时UDP输入，不再发送work_dir中的文件
+    int   relay_gro;
+    int   relay_ring_slots;
+    struct relay relay;
+    struct retention_policy retention_policy; //已发送文件的保留策略
+    struct retention retention;
+    int   retention_enabled;
+    int   metrics_port;   //在127.0.0.1上提供Prometheus格式的/metrics，0表示关闭
+    char *metrics_socket; //同样的内容也可以通过Unix socket获取
+    struct metrics_server metrics;
     int64_t stream_start_timestamp;
     int64_t system_start_timestamp;
-    struct list_head head;
+    struct file_queue queue; //待发文件队列和文件名表，由file_list_mutex保护
 };
 
 struct Context g_ctx;
 
+/*SIGINT/SIGTERM在所有线程中屏蔽，由主线程sigwait处理*/
+static sigset_t exit_signals;
+
 struct option long_options[] =
 {
     { "ip", 1, NULL, 'i' },
@@ -127,16 +178,6 @@ static char *const short_options = "i:p:tw";
 /*互斥锁保护待发文件信息改变*/
 
 
-/*crc校验*/
-int crc_check(struct udp_datapack check_buff) {
-    return 0;
-}
-
-/*crc校验判断*/
-int crc_test(struct udp_datapack check_buff) {
-    return 0;
-}
-
 static  int64_t get_current_time(void)
 {
     struct timeval tv;
@@ -144,11 +185,17 @@ static  int64_t get_current_time(void)
     return (int64_t)tv.tv_sec * TIME_SCALE + tv.tv_usec;
 }
 
+static int64_t get_monotonic_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * TIME_SCALE + ts.tv_nsec / 1000;
+}
+
 
 /*待发文件列表初始化*/
 void udp_init() {
-    INIT_LIST_HEAD(&g_ctx.head);
-    g_ctx.file_count = 0;
+    queue_init(&g_ctx.queue);
     g_ctx.send_buf_size = UDP_PACKET_SIZE;
     g_ctx.send_buf = calloc(g_ctx.send_buf_size, sizeof(char));
     if ((g_ctx.sock_fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
@@ -157,12 +204,15 @@ void udp_init() {
     }
     g_ctx.start_wait_interval = 0;
     g_ctx.exit = 0;
-    g_ctx.sent_timestamp = 0LL;
+    g_ctx.sent_timestamp = -1LL; //-1表示还没有发送过，时间戳0是合法值
+    g_ctx.inflight_timestamp = -1LL;
     pthread_mutex_init(&g_ctx.file_list_mutex, NULL);
     pthread_cond_init(&g_ctx.file_list_cond, NULL);
 
     pthread_mutex_init(&g_ctx.wait_mutex,NULL);
     pthread_cond_init(&g_ctx.wait_cond,NULL);
+    pthread_cond_init(&g_ctx.tail_cond,NULL);
+    g_ctx.tail_mode = 0;
 
     g_ctx.system_start_timestamp = get_current_time();
     g_ctx.stream_start_timestamp = -1;
@@ -173,45 +223,78 @@ void udp_init() {
     g_ctx.log_dir = NULL;
     g_ctx.dummy_file_path = NULL;
     g_ctx.send_dummy_interval = 1800;
+    g_ctx.checkpoint_path = NULL;
+    g_ctx.checkpoint_sync_interval = 1000;
+    g_ctx.checkpoint.map = NULL;
+    g_ctx.checkpoint_pos.sent_timestamp = -1;
+    g_ctx.checkpoint_pos.cur_timestamp = -1;
+    g_ctx.checkpoint_pos.cur_offset = 0;
+    g_ctx.checkpoint_pos.next_sequence = -1;
+    g_ctx.checkpoint_pos.next_clock = 0;
+    memset(&g_ctx.retention_policy, 0, sizeof(g_ctx.retention_policy));
+    g_ctx.retention.dir_fd = -1;
+    g_ctx.retention_enabled = 0;
+    g_ctx.metrics_port = 0;
+    g_ctx.metrics_socket = NULL;
+    g_ctx.metrics.tcp_fd = g_ctx.metrics.unix_fd = -1;
+    g_ctx.metrics.started = 0;
+    g_ctx.playlist_name = NULL;
+    g_ctx.file_template = NULL;
+    g_ctx.segment_duration = 0;
+    segname_compile(&g_ctx.segname, SEGNAME_DEFAULT, 0);
+    g_ctx.playlist_clock = 0;
+    g_ctx.release_base = -1;
+    g_ctx.stream_input = NULL;
+    g_ctx.stream_slice_duration = TIME_SCALE;
+    g_ctx.stream_clock = 0;
+    g_ctx.reliable = 0;
+    g_ctx.nack_window = 0;
+    g_ctx.nack.slots = NULL;
+    g_ctx.fec_columns = 0;
+    g_ctx.fec_rows = 0;
+    g_ctx.fec_row_parity = 0;
+    g_ctx.fec_enabled = 0;
+    g_ctx.fec.col = NULL;
+    g_ctx.segment_crc = 0;
+    g_ctx.log_async = 0;
+    g_ctx.log_queue = 0;
+    g_ctx.log_binary = 0;
+    g_ctx.log_level = LOG_LEVEL_DEBUG;
+    memset(&g_ctx.log_archive_policy, 0, sizeof(g_ctx.log_archive_policy));
+    g_ctx.rtp = 0;
+    g_ctx.rtp_ssrc = 0;
+    g_ctx.relay_ip = NULL;
+    g_ctx.relay_port = 0;
+    g_ctx.relay_gro = 0;
+    g_ctx.relay_ring_slots = 0;
+    g_ctx.relay.fd = -1;
 
 }
 
-void remove_list_file(struct file_infor *del_info) {
-    if (del_info) {
-        close(del_info->file_fd);
-
-        if (del_info->file_path) {
-            free(del_info->file_path);
-            del_info->file_path = NULL;
-        }
-        list_del(&del_info->list);
-
-        free(del_info);
-        del_info = NULL;
-    }
-    g_ctx.file_count--;
-}
-
 
 void udp_destroy() {
     struct list_head *pos,*n;
     struct file_infor *file_item = NULL;
-    list_for_each_safe(pos, n, &g_ctx.head) {
+    metrics_stop(&g_ctx.metrics);
+    list_for_each_safe(pos, n, &g_ctx.queue.head) {
 
         file_item = list_entry(pos, struct file_infor, list);
 
-        printf("to= %s from= %lld\n", file_item->file_path, file_item->timestamp);
+        log_debug("drop queued %s,timestamp=%lld", file_item->file_path,
+                  (long long)file_item->timestamp);
 
-        remove_list_file(file_item);
+        remove_list_file(&g_ctx.queue, file_item);
     }
 
-    list_empty(&g_ctx.head);
+    list_empty(&g_ctx.queue.head);
 
     if (g_ctx.send_buf) {
         free(g_ctx.send_buf);
         g_ctx.send_buf = NULL;
     }
 
+    nack_stop(&g_ctx.nack);
+    fec_destroy(&g_ctx.fec);
     if (g_ctx.sock_fd != -1) close(g_ctx.sock_fd);
 
     if (g_ctx.work_dir) {
@@ -222,148 +305,469 @@ void udp_destroy() {
         free(g_ctx.ip_addr);
         g_ctx.ip_addr = NULL;
     }
-    g_ctx.file_count = 0;
+    checkpoint_close(&g_ctx.checkpoint);
+    if (g_ctx.file_template) {
+        free(g_ctx.file_template);
+        g_ctx.file_template = NULL;
+    }
+    if (g_ctx.playlist_name) {
+        playlist_destroy(&g_ctx.playlist);
+        free(g_ctx.playlist_name);
+        g_ctx.playlist_name = NULL;
+    }
+    retention_stop(&g_ctx.retention);
+    if (g_ctx.stream_input) {
+        free(g_ctx.stream_input);
+        g_ctx.stream_input = NULL;
+    }
+    if (g_ctx.relay_ip) {
+        free(g_ctx.relay_ip);
+        g_ctx.relay_ip = NULL;
+    }
+    if (g_ctx.retention_policy.archive_dir) {
+        free((char *)g_ctx.retention_policy.archive_dir);
+        g_ctx.retention_policy.archive_dir = NULL;
+    }
+    if (g_ctx.checkpoint_path) {
+        free(g_ctx.checkpoint_path);
+        g_ctx.checkpoint_path = NULL;
+    }
+    if (g_ctx.metrics_socket) {
+        free(g_ctx.metrics_socket);
+        g_ctx.metrics_socket = NULL;
+    }
+    g_ctx.queue.file_count = 0;
     pthread_mutex_destroy(&g_ctx.file_list_mutex);
     pthread_cond_destroy(&g_ctx.file_list_cond);
-}
-
-/*向待发文件列表中添加新项*/
-void add_file_tail(struct file_infor *new_info) {
-    if (new_info)  {
-        list_add_tail(&(new_info->list), &g_ctx.head);
-    }
-}
-
-void add_file_after(struct file_infor *position) {
-	if (!position) return;
-	struct list_head *pos,*n;
-	struct file_infor *file_item = NULL;
-	list_for_each_prev_safe(pos, n, &g_ctx.head){
-		file_item = list_entry(pos, struct file_infor, list);
-        //如果列表已经存在，不插入直接退出
-		if (file_item && file_item->timestamp == position->timestamp)
-            return;
-        //找到第一个比当前待插入项时间戳小的后面插入
-		else if (file_item && 
-            file_item->timestamp < position->timestamp) {
-            list_add(&(position->list),&(file_item->list));
-            g_ctx.file_count++;
-            pthread_cond_signal(&g_ctx.wait_cond);
-			log_debug("add %s into list,file_infor=%p,filename=%s,timestamp=%lld,filecount=%d",
-					  position->dummy_flag ? "dummy file" : "file",position, position->file_path, 
-					  position->timestamp,g_ctx.file_count); 
-            return;
-		} 
-	}
-	if (!file_item) {
-        add_file_tail(position);
-        g_ctx.file_count++;
-        log_debug("add %s into list,file_infor=%p,filename=%s,timestamp=%lld,filecount=%d",
-					  position->dummy_flag ? "dummy file" : "file",position, position->file_path, 
-				  position->timestamp,g_ctx.file_count); 
-    }
+    pthread_cond_destroy(&g_ctx.tail_cond);
 }
 
 
-/*取得文件列表中末尾项*/
-struct file_infor* get_list_tail() {
-    struct list_head *pos,*n;
-    struct file_infor *file_item = NULL;
-    list_for_each_prev_safe(pos, n, &g_ctx.head) {
-        file_item = list_entry(pos, struct file_infor, list);
-		if (file_item) return file_item;
-	}
 
-    return NULL;
+int strtoi(const char *s) {
+	if (!s) return 0;
+	int64_t num = 0;
+    for (; *s >= '0' && *s <= '9'; s++) 
+        num = num * 10 + (*s - '0');
+    return num;
 }
 
+/*解析文件名，返回0表示需要入队；allow_tmp时接受正在写入的.tmp文件*/
+static int parse_file_name(const char *filename, int64_t *timestamp, int *dummy_flag,
+                           int allow_tmp) {
+	if (!filename) return -1;
+    size_t len = strlen(filename);
 
-int custom_filter(const struct dirent *pDir) {
-    if ((pDir->d_type != DT_DIR)
-        && strcmp(pDir->d_name, ".")
-        && strcmp(pDir->d_name, "..")) {
-        return 1;
+	if (len > 4 && !memcmp(filename + len - 4, ".tmp", 4)) {
+        if (!allow_tmp) return -1;
+        len -= 4;
     }
-
-    return 0;
+    //dummy文件由copy_dummy_file生成，文件名固定为微秒时间戳
+	if (len > 6 && !memcmp(filename + len - 6, ".dummy", 6)) {
+        if (filename[0] < '0' || filename[0] > '9') return -1;
+        *dummy_flag = 1;
+        *timestamp = strtoll(filename, NULL, 10);
+        return 0;
+    }
+    *dummy_flag = 0;
+    return segname_match(&g_ctx.segname, filename, len, timestamp);
 }
 
-int strtoi(const char *s) {
-	if (!s) return;
-	int64_t num, i; 
-    char ch;
-    num = 0;
-    for (i = 0; i < strlen(s); i++) {
-        ch = s[i];
-        if (ch < '0' || ch > '9') break;
-        num = num * 10 + (ch - '0');
-    }
-    return num;
+/*加锁状态下插入发送队列并唤醒等待dummy超时的发送线程，返回值同add_file_after*/
+static int queue_insert(struct file_infor *file_item) {
+    if (add_file_after(&g_ctx.queue, file_item) < 0) return -1;
+    if (file_item->dummy_flag) 
+        metrics_event(METRICS_DUMMY_INSERTED, 1);
+    pthread_cond_signal(&g_ctx.wait_cond);
+    return 0;
 }
 
-void add_by_file_name(const char *filename) {
+/*加锁状态下入队，队列满时等待发送线程取走文件，返回NULL表示没有入队*/
+static struct file_infor *queue_file_locked(const char *filename, int64_t timestamp, int64_t duration,
+                              int dummy_flag, uint64_t hash, int growing, unsigned long size,
+                              int64_t arrive) {
 	char filepath[1024];
-    int  dummy_flag = 0;
-	if (!filename) return;
-    
-	if (strtoi(filename) == 0) return;
-	pthread_mutex_lock(&g_ctx.file_list_mutex); 
+    int64_t begin;
+    //同名文件已在队列中或已经发送过，合并重复事件
+    if (name_table_find(&g_ctx.queue, hash) || 
+        (!dummy_flag && timestamp <= g_ctx.sent_timestamp)) 
+        return NULL;
+    //队首文件正在锁外发送，更早的文件只能排在它后面，会打乱发送顺序
+    if (!dummy_flag && timestamp <= g_ctx.inflight_timestamp) {
+        log_warning("drop late file %s: timestamp %lld not after in-flight %lld",
+                 filename, (long long)timestamp, (long long)g_ctx.inflight_timestamp);
+        return NULL;
+    }
 
-	char *suffix = strrchr(filename, '.');
-	if (suffix && !strcmp(suffix, ".tmp")) {
-		pthread_mutex_unlock(&g_ctx.file_list_mutex);
-		return;
-	} else if(suffix && !strcmp(suffix,".dummy")) 
-        dummy_flag = 1;
+    begin = get_monotonic_time();
 
 	struct file_infor *tmp = (struct file_infor *)calloc(1,sizeof(*tmp));
 	if (tmp) {
-		memset(filepath, 0, sizeof(filepath));
-		sprintf(filepath, "%s/", g_ctx.work_dir);
-
-		strcat(filepath, filename);
+		snprintf(filepath, sizeof(filepath), "%s/%s", g_ctx.work_dir, filename);
 		tmp->file_path = strdup(filepath);
+        tmp->file_fd = -1;
 
 		tmp->seek_flag = 0;
-		tmp->timestamp = ((int64_t)strtoi(filename)) * TIME_SCALE;
+		tmp->timestamp = timestamp;
         tmp->dummy_flag = dummy_flag;
-		while (g_ctx.file_count >= MAX_UDP_FILE_COUNT) {
+        tmp->name_hash = hash;
+        tmp->growing = growing;
+        tmp->duration = duration;
+        tmp->queued_len = size;
+        tmp->arrive_time = arrive;
+		while (g_ctx.queue.file_count >= MAX_UDP_FILE_COUNT && !g_ctx.exit) {
 			pthread_cond_wait(&g_ctx.file_list_cond, &g_ctx.file_list_mutex);
 		}
 		//add_file_tail(tmp);
-		add_file_after(tmp);
-		pthread_mutex_unlock(&g_ctx.file_list_mutex);
+		if (queue_insert(tmp) == 0) {
+            name_table_insert(&g_ctx.queue, hash, tmp);
+        } else {
+            free(tmp->file_path);
+            free(tmp);
+            tmp = NULL;
+        }
+        metrics_stage(METRICS_STAGE_ENQUEUE, get_monotonic_time() - begin);
 	}
+    return tmp;
+}
 
+/*入队前在锁外取得文件长度，用于queue_bytes*/
+static unsigned long queued_file_size(const char *filename) {
+	char filepath[1024];
+    struct stat st;
+	snprintf(filepath, sizeof(filepath), "%s/%s", g_ctx.work_dir, filename);
+    return stat(filepath, &st) == 0 ? st.st_size : 0;
 }
-int scan_dir(const char *dirpath, char *filename) {
 
-	struct dirent **namelist;
-	int n;
-	int i;
+/*合并表的键去掉.tmp后缀，重命名前后的事件对应同一项*/
+static uint64_t file_key_hash(const char *filename) {
+    size_t len = strlen(filename);
+    if (len > 4 && !strcmp(filename + len - 4, ".tmp")) len -= 4;
+    return name_hash(filename, len);
+}
 
-	if (!dirpath && !filename) return -1;
-	if (dirpath) {
-		n = scandir(dirpath, &namelist, custom_filter, alphasort);
-		if (n < 0) {
-			perror("scandir");
-		} else {
-			for (i = 0; i < n; i++) {
+void add_by_file_name(const char *filename) {
+    int64_t arrive = get_monotonic_time();
+    int  dummy_flag = 0;
+    int64_t timestamp;
+    uint64_t hash;
+    unsigned long size;
+	if (parse_file_name(filename, &timestamp, &dummy_flag, 0) < 0) return;
+    //playlist和stream模式下分片不从目录入队
+    if ((g_ctx.playlist_name || g_ctx.stream_input) && !dummy_flag) return;
+
+    hash = file_key_hash(filename);
+    size = queued_file_size(filename);
+	pthread_mutex_lock(&g_ctx.file_list_mutex); 
+    queue_file_locked(filename, timestamp, 0, dummy_flag, hash, 0, size, arrive);
+	pthread_mutex_unlock(&g_ctx.file_list_mutex);
+}
 
-				add_by_file_name(namelist[i]->d_name);
-                free(namelist[i]);
+/*tail模式：文件创建后立即入队，标记为正在写入*/
+static void add_growing_file(const char *filename) {
+    int64_t arrive = get_monotonic_time();
+    int  dummy_flag = 0;
+    int64_t timestamp;
+	if (parse_file_name(filename, &timestamp, &dummy_flag, 1) < 0) return;
 
-			}
-		}
+	pthread_mutex_lock(&g_ctx.file_list_mutex); 
+    queue_file_locked(filename, timestamp, 0, dummy_flag, file_key_hash(filename), 1, 0, arrive);
+	pthread_mutex_unlock(&g_ctx.file_list_mutex);
+}
 
-		free(namelist);
-	}
+/*tail模式：文件有新数据或写入完成，唤醒发送线程。返回0表示文件已在队列中*/
+static int notify_growing_file(const char *filename, int finished) {
+    struct name_slot *slot;
+    int ret = -1;
+	pthread_mutex_lock(&g_ctx.file_list_mutex); 
+    slot = name_table_find(&g_ctx.queue, file_key_hash(filename));
+    if (slot) {
+        if (finished) slot->info->growing = 0;
+        if (slot->info->growing || finished)
+            pthread_cond_broadcast(&g_ctx.tail_cond);
+        ret = 0;
+    }
+	pthread_mutex_unlock(&g_ctx.file_list_mutex);
+    return ret;
+}
+
+/*启动扫描项，文件名保存在连续的名字缓冲区中*/
+struct scan_entry {
+    int64_t  timestamp;
+    uint64_t size;     //待发送文件的长度，计入queue_bytes
+    uint32_t name_off;
+    int      dummy_flag;
+};
+
+struct linux_dirent64 {
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+/*按时间戳LSD基数排序，每次8位，所有键该字节相同时跳过*/
+static void radix_sort_entries(struct scan_entry *a, struct scan_entry *tmp, int n) {
+    int shift, i;
+    size_t count[256];
+    struct scan_entry *src = a, *dst = tmp, *swap;
+    for (shift = 0; shift < 64; shift += 8) {
+        memset(count, 0, sizeof(count));
+        for (i = 0; i < n; i++) 
+            count[((uint64_t)src[i].timestamp >> shift) & 0xff]++;
+        if (count[((uint64_t)src[0].timestamp >> shift) & 0xff] == (size_t)n) 
+            continue;
+        size_t sum = 0, c;
+        for (i = 0; i < 256; i++) {
+            c = count[i];
+            count[i] = sum;
+            sum += c;
+        }
+        for (i = 0; i < n; i++) 
+            dst[count[((uint64_t)src[i].timestamp >> shift) & 0xff]++] = src[i];
+        swap = src; src = dst; dst = swap;
+    }
+    if (src != a) memcpy(a, src, n * sizeof(*a));
+}
+
+/*用getdents64批量读取目录，排序后一次性按序装入队列；
+  rescan用于inotify队列溢出后补回丢失的事件，已在队列中或已发送的文件由名字表和sent_timestamp过滤*/
+static int scan_dir_bulk(const char *dirpath, int rescan) {
+    int fd, nread, pos, n = 0, cap = 4096, i;
+    size_t names_len = 0, names_cap = 65536, name_len;
+    int64_t begin = get_current_time(), timestamp;
+    uint64_t total_bytes = 0;
+    int dummy_flag;
+    char *buf, *names;
+    struct stat st;
+    struct scan_entry *entries, *tmp;
+    struct linux_dirent64 *d;
+
+    fd = open(dirpath, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        log_error("open dir %s failed:%s", dirpath, strerror(errno));
+        return -1;
+    }
+    buf = malloc(SCAN_DIR_BUF_SIZE);
+    names = malloc(names_cap);
+    entries = malloc(cap * sizeof(*entries));
+    if (!buf || !names || !entries) {
+        free(buf); free(names); free(entries);
+        close(fd);
+        return -1;
+    }
+
+    while ((nread = syscall(SYS_getdents64, fd, buf, SCAN_DIR_BUF_SIZE)) > 0) {
+        for (pos = 0; pos < nread; pos += d->d_reclen) {
+            d = (struct linux_dirent64 *)(buf + pos);
+            if (d->d_type == DT_DIR) continue;
+            if (parse_file_name(d->d_name, &timestamp, &dummy_flag, 0) < 0) continue;
+            //dummy副本由发送线程生成，保留策略下发送后仍在目录中，重新扫描时不能再次入队
+            if (rescan && dummy_flag) continue;
+            name_len = strlen(d->d_name) + 1;
+            if (names_len + name_len > names_cap) {
+                char *p = realloc(names, names_cap * 2);
+                if (!p) continue;
+                names = p;
+                names_cap *= 2;
+            }
+            if (n == cap) {
+                struct scan_entry *p = realloc(entries, cap * 2 * sizeof(*entries));
+                if (!p) continue;
+                entries = p;
+                cap *= 2;
+            }
+            memcpy(names + names_len, d->d_name, name_len);
+            //已发送的文件不入队，不需要长度
+            entries[n].size = 0;
+            if ((dummy_flag || timestamp > g_ctx.sent_timestamp) &&
+                fstatat(fd, d->d_name, &st, 0) == 0) {
+                entries[n].size = st.st_size;
+                total_bytes += st.st_size;
+            }
+            entries[n].timestamp = timestamp;
+            entries[n].name_off = names_len;
+            entries[n].dummy_flag = dummy_flag;
+            names_len += name_len;
+            n++;
+        }
+    }
+    if (nread < 0) 
+        log_error("getdents64 %s failed:%s", dirpath, strerror(errno));
+    close(fd);
+    free(buf);
+
+    if (n > 0 && (tmp = malloc(n * sizeof(*tmp)))) {
+        radix_sort_entries(entries, tmp, n);
+        free(tmp);
+    }
+    log_info("%s of %s: %d files (%llu bytes) indexed and sorted in %lld us",
+             rescan ? "rescan" : "startup scan", dirpath, n, (unsigned long long)total_bytes, (long long)(get_current_time() - begin));
+
+    //上次运行已发送的文件交给保留策略处理，本次发送的文件已由发送线程交出
+    if (g_ctx.retention_enabled && !rescan) {
+        for (i = 0; i < n; i++) {
+            if (!entries[i].dummy_flag && entries[i].timestamp <= g_ctx.sent_timestamp)
+                retention_add(&g_ctx.retention, names + entries[i].name_off,
+                              entries[i].timestamp, 0, 0);
+        }
+    }
+
+    //已排序，逐项插入都落在链表尾部
+	pthread_mutex_lock(&g_ctx.file_list_mutex); 
+    for (i = 0; i < n; i++) {
+        queue_file_locked(names + entries[i].name_off, entries[i].timestamp, 0,
+                          entries[i].dummy_flag, file_key_hash(names + entries[i].name_off), 0,
+                          entries[i].size, 0);
+    }
+	pthread_mutex_unlock(&g_ctx.file_list_mutex);
+
+    free(names);
+    free(entries);
+    //超过MAX_UDP_FILE_COUNT的部分需要等待发送线程，因此这里包含发送时间
+    log_info("%s of %s: %d files loaded in %lld us",
+             rescan ? "rescan" : "startup scan", dirpath, n, (long long)(get_current_time() - begin));
+    metrics_stage(METRICS_STAGE_SCAN, get_current_time() - begin);
+    return n;
+}
+
+int scan_dir(const char *dirpath, char *filename) {
+
+	if (!dirpath && !filename) return -1;
+	if (dirpath) 
+        scan_dir_bulk(dirpath, 0);
 
 	if (filename) {
 		add_by_file_name(filename);
 	}
+    return 0;
+}
+
+
+/*playlist模式：新分片按#EXTINF时长累加媒体时间后入队*/
+static void on_playlist_segment(void *opaque, int64_t sequence,
+                                int64_t duration, const char *uri) {
+    int64_t arrive = get_monotonic_time();
+    int64_t timestamp = g_ctx.playlist_clock;
+    unsigned long size = queued_file_size(uri);
+    struct file_infor *file_item;
+    //时长未知时至少前进1微秒，保持顺序
+    g_ctx.playlist_clock += duration > 0 ? duration : 1;
+	pthread_mutex_lock(&g_ctx.file_list_mutex); 
+    file_item = queue_file_locked(uri, timestamp, duration, 0, name_hash(uri, strlen(uri)),
+                                  0, size, arrive);
+    if (file_item) 
+        file_item->sequence = sequence;
+	pthread_mutex_unlock(&g_ctx.file_list_mutex);
+    log_debug("playlist segment seq=%lld,uri=%s,duration=%lld,timestamp=%lld",
+              (long long)sequence, uri, (long long)duration, (long long)timestamp);
+}
+
+static void on_playlist_changed(void) {
+    playlist_update(&g_ctx.playlist, on_playlist_segment, NULL);
 }
 
+/*stream模式：PCR切出的分片直接进入发送队列，队列满时阻塞读取，由管道对FFmpeg反压*/
+static void on_stream_slice(void *opaque, char *data, size_t len, int64_t duration) {
+    int64_t begin = get_monotonic_time();
+	pthread_mutex_lock(&g_ctx.file_list_mutex); 
+	struct file_infor *tmp = (struct file_infor *)calloc(1,sizeof(*tmp));
+    if (tmp) {
+        tmp->file_path = strdup(g_ctx.stream_input);
+        tmp->file_fd = -1;
+        tmp->data = data;
+        tmp->file_len = len;
+        tmp->queued_len = len;
+        tmp->arrive_time = begin;
+        tmp->timestamp = g_ctx.stream_clock;
+        tmp->duration = duration;
+		while (g_ctx.queue.file_count >= MAX_UDP_FILE_COUNT && !g_ctx.exit) {
+			pthread_cond_wait(&g_ctx.file_list_cond, &g_ctx.file_list_mutex);
+		}
+        if (queue_insert(tmp) < 0) {
+            free(tmp->file_path);
+            free(tmp);
+            tmp = NULL;
+        }
+    }
+    if (!tmp) free(data);
+    g_ctx.stream_clock += duration > 0 ? duration : 1;
+	pthread_mutex_unlock(&g_ctx.file_list_mutex);
+    metrics_stage(METRICS_STAGE_ENQUEUE, get_monotonic_time() - begin);
+}
+
+/*从共享内存环读取同机生产者写入的TS包，不经过文件系统和管道*/
+static void stream_shm_loop(struct ts_slicer *slicer, char *buf) {
+    const char *name = g_ctx.stream_input + strlen(STREAM_SHM_PREFIX);
+    struct shmring ring;
+    int n;
+
+    if (shmring_create(&ring, name, 0, 0) < 0) {
+        log_error("create shm ring %s failed:%s", name, strerror(errno));
+        return;
+    }
+    log_info("stream input shm ring /dev/shm/%s, %u slots of %u bytes", name,
+             ring.hdr->slot_count, ring.hdr->slot_size);
+    while (!g_ctx.exit) {
+        n = shmring_read(&ring, buf, STREAM_SHM_POLL_MS);
+        if (n > 0 && ts_slicer_feed(slicer, buf, n) < 0) 
+            log_error_ratelimited("stream slice out of memory, dropped %d bytes", n);
+    }
+    ts_slicer_flush(slicer);
+    shmring_close(&ring);
+}
+
+/*读取标准输入或命名管道中的TS流，管道写端关闭后重新打开等待下一个写入者*/
+void* stream_loop() {
+    struct ts_slicer slicer;
+    struct stat st;
+    char *buf;
+    ssize_t n;
+    int fd, is_stdin = !strcmp(g_ctx.stream_input, "-");
+
+    buf = malloc(STREAM_READ_SIZE);
+    if (!buf) return NULL;
+    ts_slicer_init(&slicer, g_ctx.stream_slice_duration, on_stream_slice, NULL);
+    if (!strncmp(g_ctx.stream_input, STREAM_SHM_PREFIX, strlen(STREAM_SHM_PREFIX))) {
+        stream_shm_loop(&slicer, buf);
+        ts_slicer_destroy(&slicer);
+        free(buf);
+        return NULL;
+    }
+    while (!g_ctx.exit) {
+        //非阻塞打开，命名管道没有写入者时也不阻塞在open上，由poll等待
+        fd = is_stdin ? STDIN_FILENO : open(g_ctx.stream_input, O_RDONLY | O_NONBLOCK);
+        if (fd < 0) {
+            log_error("open %s failed:%s", g_ctx.stream_input, strerror(errno));
+            break;
+        }
+        log_info("stream input %s opened", g_ctx.stream_input);
+        while (!g_ctx.exit) {
+            struct pollfd pfd = { fd, POLLIN, 0 };
+            if (poll(&pfd, 1, EXIT_POLL_MS) == 0) continue;
+            n = read(fd, buf, STREAM_READ_SIZE);
+            if (n == 0) break;
+            if (n < 0) {
+                if (errno == EINTR || errno == EAGAIN) continue;
+                log_error("read %s failed:%s", g_ctx.stream_input, strerror(errno));
+                break;
+            }
+            if (ts_slicer_feed(&slicer, buf, n) < 0) 
+                log_error_ratelimited("stream slice out of memory, dropped %zd bytes", n);
+        }
+        ts_slicer_flush(&slicer);
+        log_info("stream input %s closed", g_ctx.stream_input);
+        if (is_stdin || fstat(fd, &st) < 0 || !S_ISFIFO(st.st_mode)) {
+            if (!is_stdin) close(fd);
+            break;
+        }
+        close(fd);
+    }
+    ts_slicer_destroy(&slicer);
+    free(buf);
+    return NULL;
+}
 
 /*循环读取目录文件信息*/
 int event_loop() {
@@ -374,39 +778,68 @@ int event_loop() {
 	int nread;
 	char buf[BUFSIZ];
 
-	fd = inotify_init();
+	//非阻塞读取，poll超时后检查退出标志
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
 	if (fd < 0) {
 		log_debug("inotify_init failed,fd=%d", fd);
 		return -1;
 	}
 
-	wd = inotify_add_watch(fd, g_ctx.work_dir,
-						   IN_CREATE | IN_ATTRIB | IN_MODIFY |  IN_MOVE);
+	//只关注写完关闭和移入的文件，写入过程中的IN_MODIFY不再触发扫描
+	//tail模式额外关注创建和写入，用于边写边发
+	wd = inotify_add_watch(fd, g_ctx.work_dir, IN_CLOSE_WRITE | IN_MOVED_TO |
+                           (g_ctx.tail_mode ? IN_CREATE | IN_MODIFY : 0));
 	if (wd < 0) {
 		log_debug("inotify_add_watch %s failed,ret=%d", g_ctx.work_dir, wd);
+		close(fd);
 		return -1;
 	}
 
 	buf[sizeof(buf) - 1] = 0;
 	while (!g_ctx.exit) {
 		if (first_scan == 1) {
-			scan_dir(g_ctx.work_dir, NULL);
+            if (g_ctx.playlist_name) 
+                on_playlist_changed();
+            else if (!g_ctx.stream_input)
+			    scan_dir(g_ctx.work_dir, NULL);
 			first_scan = 0;
 		}
 
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		if (poll(&pfd, 1, EXIT_POLL_MS) <= 0) 
+			continue;
 		while ((len = read(fd, buf, sizeof(buf) - 1)) > 0) {
 			nread = 0;
 			while (len > 0) {
 				event = (struct inotify_event *)&buf[nread];
-
-				if (!(event->mask & IN_ISDIR) &&
-					event->mask & IN_CREATE || event->mask & IN_ATTRIB ||
-					event->mask & IN_MODIFY || event->mask &  IN_MOVE) {
-
-					if (g_ctx.work_dir &&  (strlen(g_ctx.work_dir) > 0)) 
+                metrics_event(METRICS_INOTIFY_EVENTS, 1);
+
+				if (event->mask & IN_Q_OVERFLOW) {
+                    //丢失的写完事件只能靠重新扫描补回，否则这些分片永远不会发送
+                    metrics_event(METRICS_INOTIFY_OVERFLOWS, 1);
+                    log_warning_ratelimited("inotify queue overflow, events lost, rescanning");
+                    if (g_ctx.playlist_name) 
+                        on_playlist_changed();
+                    else if (!g_ctx.stream_input)
+                        scan_dir_bulk(g_ctx.work_dir, 1);
+                } else if ((event->mask & IN_ISDIR) || event->len == 0) {
+                    //忽略目录事件
+                } else if (g_ctx.playlist_name) {
+                    //playlist模式只跟踪播放列表，分片文件事件忽略，dummy文件照常入队
+                    if (!(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))) 
+                        ;
+                    else if (!strcmp(event->name, g_ctx.playlist_name))
+                        on_playlist_changed();
+                    else
                         scan_dir(NULL, event->name);
-
-				}
+                } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                    if (!g_ctx.tail_mode || notify_growing_file(event->name, 1) < 0)
+                        scan_dir(NULL, event->name);
+                } else if (event->mask & IN_CREATE) {
+                    add_growing_file(event->name);
+                } else if (event->mask & IN_MODIFY) {
+                    notify_growing_file(event->name, 0);
+                }
 				nread = nread + sizeof(struct inotify_event) + event->len;
 				len = len - sizeof(struct inotify_event) - event->len;
 			}
@@ -414,22 +847,51 @@ int event_loop() {
 
 
 	}
+	close(fd);
+	return 0;
 }
 
 void wait_time(int64_t file_timestamp) {
 
     int64_t current_timestamp = get_current_time();
+    int media_clock = g_ctx.playlist_name || g_ctx.stream_input, first = 0;
 
     //初始第一个文件的时间为流开始时间
     if (g_ctx.stream_start_timestamp == -1) {
         g_ctx.stream_start_timestamp = file_timestamp;
+        first = 1;
 
-        if (file_timestamp + g_ctx.start_wait_interval >  current_timestamp) {
+        //playlist和stream模式的时间戳是从0开始的媒体时间，不能和墙上时间比较
+        if (!media_clock && file_timestamp + g_ctx.start_wait_interval >  current_timestamp) {
             usleep(g_ctx.start_wait_interval);
         }
 
     }
 
+    //playlist和stream模式时长精确，按媒体时间排期发送
+    if (media_clock) {
+        int64_t now = get_monotonic_time();
+        int64_t release = g_ctx.release_base + (file_timestamp - g_ctx.stream_start_timestamp);
+        if (g_ctx.release_base < 0 || release < now - PACE_MAX_LATE) {
+            g_ctx.release_base = now - (file_timestamp - g_ctx.stream_start_timestamp);
+            if (!first || g_ctx.start_wait_interval <= 0) 
+                return;
+            //第一个分片推迟start_wait_interval发送，之后按媒体时间排期，
+            //队列中始终缓存start_wait_interval的数据
+            g_ctx.release_base += g_ctx.start_wait_interval;
+            release = g_ctx.release_base;
+        }
+        //分段睡眠，退出时不等到发送时刻
+        while (release > now && !g_ctx.exit) {
+            int64_t until = release - now > EXIT_POLL_MS * 1000 ? now + EXIT_POLL_MS * 1000 : release;
+            struct timespec ts;
+            ts.tv_sec = until / TIME_SCALE;
+            ts.tv_nsec = (until % TIME_SCALE) * 1000;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            now = get_monotonic_time();
+        }
+    }
+
 }
 
 ssize_t readn(int fd, void *vptr, size_t n) {
@@ -450,49 +912,167 @@ ssize_t readn(int fd, void *vptr, size_t n) {
 }
 
 
+/*记录当前文件已发送的字节数，dummy数据不记录*/
+static void checkpoint_progress(struct file_infor *file_item, off_t offset) {
+    if (!g_ctx.checkpoint_path || file_item->dummy_flag) return;
+    g_ctx.checkpoint_pos.cur_timestamp = file_item->timestamp;
+    g_ctx.checkpoint_pos.cur_offset = offset;
+    checkpoint_update(&g_ctx.checkpoint, &g_ctx.checkpoint_pos);
+}
+
+/*检查点中记录的未发完文件，返回续传偏移*/
+static off_t checkpoint_resume_offset(struct file_infor *file_item) {
+    if (!g_ctx.checkpoint_path || file_item->dummy_flag ||
+        file_item->timestamp != g_ctx.checkpoint_pos.cur_timestamp)
+        return 0;
+    log_info("resume %s from offset %lld", file_item->file_path,
+             (long long)g_ctx.checkpoint_pos.cur_offset);
+    return g_ctx.checkpoint_pos.cur_offset;
+}
+
+/*offset处数据的媒体时间，换算为90kHz RTP时钟；时长已知时按字节位置插值*/
+static uint32_t rtp_clock(struct file_infor *file_item, off_t offset) {
+    int64_t t = file_item->timestamp;
+    if (file_item->duration > 0 && file_item->file_len > 0 && !file_item->growing) 
+        t += file_item->duration * offset / (int64_t)file_item->file_len;
+    else
+        t += get_monotonic_time() - file_item->send_start;
+    return (uint32_t)(t * 9 / 100);
+}
+
+/*发送一段数据，失败时记录错误并重试；offset为buf在文件中的位置*/
+static void send_block(struct file_infor *file_item, struct sockaddr_in *serv_addr,
+                       const char *buf, int len, off_t offset) {
+    int send_bytes = 0;
+    if (!file_item->first_byte_time) 
+        file_item->first_byte_time = get_monotonic_time();
+    if (g_ctx.segment_crc) 
+        file_item->crc = crc32c_update(file_item->crc, buf, len);
+    if (g_ctx.rtp) {
+        rtp_send(&g_ctx.rtp_sender, buf, len, rtp_clock(file_item, offset));
+        return;
+    }
+    if (g_ctx.reliable) {
+        nack_send(&g_ctx.nack, buf, len);
+        return;
+    }
+    while (send_bytes < len) {
+        int block_len = sendto(g_ctx.sock_fd, buf + send_bytes,
+                               len - send_bytes, 0, (struct sockaddr *)serv_addr,
+                               sizeof(struct sockaddr_in));
+        if (block_len > 0) {
+            send_bytes += block_len;
+            metrics_sent(METRICS_OUT_UDP, block_len, 1);
+        } else {
+            metrics_send_error(METRICS_OUT_UDP, errno);
+            log_error_ratelimited("Send File:%s failed,timestamp=%lld Failed\n,truncted size=%d",
+                      file_item->file_path, file_item->timestamp, len - send_bytes);
+        }
+    }
+}
+
+/*tail模式：边写边发，只发送已经写完的整TS包，文件关闭或重命名后发送剩余部分*/
+static void send_growing_file(struct file_infor *file_item, struct sockaddr_in *serv_addr) {
+    struct stat fs;
+    struct timespec outtime;
+    off_t offset = checkpoint_resume_offset(file_item);
+    int growing = 1, read_bytes;
+    size_t chunk = g_ctx.send_buf_size - g_ctx.send_buf_size % TS_PACKET_SIZE;
+
+    while (!g_ctx.exit) {
+        if (fstat(file_item->file_fd, &fs) < 0) break;
+        size_t avail = fs.st_size - offset;
+        if (growing) avail -= avail % TS_PACKET_SIZE;
+        if (avail > 0) {
+            read_bytes = pread(file_item->file_fd, g_ctx.send_buf,
+                               avail < chunk ? avail : chunk, offset);
+            if (read_bytes <= 0) break;
+            send_block(file_item, serv_addr, g_ctx.send_buf, read_bytes, offset);
+            offset += read_bytes;
+            checkpoint_progress(file_item, offset);
+            continue;
+        }
+        if (!growing) break;
+
+        //等待新数据或写入完成
+        int64_t deadline = get_current_time() + TAIL_POLL_INTERVAL;
+        outtime.tv_sec = deadline / TIME_SCALE;
+        outtime.tv_nsec = (deadline % TIME_SCALE) * 1000;
+        pthread_mutex_lock(&g_ctx.file_list_mutex);
+        if (file_item->growing) 
+            pthread_cond_timedwait(&g_ctx.tail_cond, &g_ctx.file_list_mutex, &outtime);
+        growing = file_item->growing;
+        pthread_mutex_unlock(&g_ctx.file_list_mutex);
+    }
+    file_item->file_len = offset;
+}
+
 ///*向客户端发送文件*/
 int send_file(struct file_infor *file_item) {
-    int buf_len = 0;
-    int file_block_length = 0;
-    static int first_send = 1;
-
     struct sockaddr_in     serv_addr;
 	memset(&serv_addr,0,sizeof(serv_addr));  
     serv_addr.sin_family = AF_INET;
     inet_pton(AF_INET, g_ctx.ip_addr, &serv_addr.sin_addr);
     serv_addr.sin_port = htons(g_ctx.port);
 
+    int64_t begin = get_monotonic_time();
     wait_time(file_item->timestamp);
+    file_item->send_start = get_monotonic_time();
+    metrics_stage(METRICS_STAGE_WAIT, file_item->send_start - begin);
+
+    //stream模式的分片已在内存中
+    if (file_item->data) {
+        off_t offset = 0;
+        while ((unsigned long)offset < file_item->file_len && !g_ctx.exit) {
+            int len = file_item->file_len - offset < (unsigned long)g_ctx.send_buf_size ?
+                      (int)(file_item->file_len - offset) : g_ctx.send_buf_size;
+            send_block(file_item, &serv_addr, file_item->data + offset, len, offset);
+            offset += len;
+        }
+        return 0;
+    }
 
+    file_item->file_fd = open(file_item->file_path, O_RDONLY);
+    //.tmp文件可能在打开前已经被重命名
+    if (file_item->file_fd < 0 && errno == ENOENT) {
+        char *suffix = strrchr(file_item->file_path, '.');
+        if (suffix && !strcmp(suffix, ".tmp")) {
+            *suffix = '\0';
+            file_item->file_fd = open(file_item->file_path, O_RDONLY);
+        }
+    }
+    if (file_item->file_fd < 0) {
+        log_error("open %s failed:%s", file_item->file_path, strerror(errno));
+        return -1;
+    }
 
-    file_item->file_fd = open(file_item->file_path, O_SYNC | O_RDONLY);
+    pthread_mutex_lock(&g_ctx.file_list_mutex);
+    int growing = file_item->growing;
+    pthread_mutex_unlock(&g_ctx.file_list_mutex);
+    if (growing) {
+        send_growing_file(file_item, &serv_addr);
+        return 0;
+    }
 
     struct stat fs;
-    if (-1 != fstat(file_item->file_fd, &fs)) 
+    if (-1 != fstat(file_item->file_fd, &fs)) {
         file_item->file_len = fs.st_size;
+    }
 
-
-	int total_send_bytes = 0, read_bytes = 0, send_bytes = 0;
-	while (total_send_bytes < file_item->file_len) {
+    off_t total_send_bytes = checkpoint_resume_offset(file_item);
+    int read_bytes = 0;
+    if (total_send_bytes > 0 && lseek(file_item->file_fd, total_send_bytes, SEEK_SET) < 0) {
+        total_send_bytes = 0;
+    }
+	while ((unsigned long)total_send_bytes < file_item->file_len && !g_ctx.exit) {
 		read_bytes = readn(file_item->file_fd, g_ctx.send_buf, g_ctx.send_buf_size);
 		if (read_bytes <= 0)  
             break;
-		send_bytes = 0; 
-		while (send_bytes < read_bytes) {
-			int block_len = sendto(g_ctx.sock_fd, g_ctx.send_buf + send_bytes,
-								   read_bytes - send_bytes, 0, (struct sockaddr *)&(serv_addr),
-								   sizeof(struct sockaddr_in));
-			if (block_len > 0) {
-				send_bytes += block_len;
-			} else {
-				log_error("Send File:%s failed,timestamp=%lld Failed\n,truncted size=%d",
-						  file_item->file_path, file_item->timestamp, file_item->file_len - total_send_bytes);
-			}
-		}
-		total_send_bytes += send_bytes;
-		memset(g_ctx.send_buf, 0, g_ctx.send_buf_size);
-
+        send_block(file_item, &serv_addr, g_ctx.send_buf, read_bytes, total_send_bytes);
+		total_send_bytes += read_bytes;
+        checkpoint_progress(file_item, total_send_bytes);
 	}
+    return 0;
 }
 
 static int copy_dummy_file(const char *dummy_file_path,char*file_name) {
@@ -516,11 +1096,14 @@ static int copy_dummy_file(const char *dummy_file_path,char*file_name) {
 	   mode=S_IRUSR|S_IWUSR表示S_IRUSR 用户可以读 S_IWUSR 用户可以写*/
 
 	//把文件copy到工作目录，并且重命名文件为最后发送文件时间戳+1
-    struct file_infor* file_info = get_list_tail();
+    //文件名为微秒时间戳，不受file_template影响
+    struct file_infor* file_info = get_list_tail(&g_ctx.queue);
 	if (file_info) {
-        sprintf(path, "%s/%lld.dummy", g_ctx.work_dir, (file_info->timestamp + TIME_SCALE) / TIME_SCALE); 
+        sprintf(path, "%s/%lld.dummy", g_ctx.work_dir,
+                (long long)(file_info->timestamp + TIME_SCALE)); 
 	} else
-        sprintf(path, "%s/1.dummy",g_ctx.work_dir); 
+        sprintf(path, "%s/%lld.dummy",g_ctx.work_dir,
+                (long long)((g_ctx.sent_timestamp > 0 ? g_ctx.sent_timestamp : 0) + TIME_SCALE)); 
 	
 	if ((to_fd = open(path, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR)) == -1) {
 		ret = -1;
@@ -565,16 +1148,39 @@ static int copy_dummy_file(const char *dummy_file_path,char*file_name) {
 }
 
 
+/*把发送完的文件交给保留线程，正在写入时的.tmp名字已经被重命名*/
+static void retain_sent_file(struct file_infor *file_item) {
+    char name[1024];
+    size_t len;
+    snprintf(name, sizeof(name), "%s", file_item->file_path + strlen(g_ctx.work_dir) + 1);
+    len = strlen(name);
+    if (len > 4 && !strcmp(name + len - 4, ".tmp")) name[len - 4] = '\0';
+    retention_add(&g_ctx.retention, name, file_item->timestamp,
+                  file_item->file_len, file_item->dummy_flag);
+}
+
+/*各阶段耗时计入延迟直方图，dummy文件和缺少时间戳的阶段不计入*/
+static void record_latency(struct file_infor *file_item) {
+    if (file_item->dummy_flag) return;
+    if (file_item->arrive_time) 
+        metrics_latency(METRICS_LAT_INGEST, file_item->queue_time - file_item->arrive_time);
+    metrics_latency(METRICS_LAT_QUEUED, file_item->dequeue_time - file_item->queue_time);
+    //打开失败或空文件没有发送任何数据
+    if (!file_item->first_byte_time) return;
+    metrics_latency(METRICS_LAT_START, file_item->first_byte_time - file_item->dequeue_time);
+    metrics_latency(METRICS_LAT_TRANSMIT, file_item->last_byte_time - file_item->first_byte_time);
+    if (file_item->arrive_time) 
+        metrics_latency(METRICS_LAT_TOTAL, file_item->last_byte_time - file_item->arrive_time);
+}
+
 /*发送文件处理*/
 void* on_request() {
-    int tmp;
-    struct list_head *pos,*n;
     struct file_infor *file_item;
     while (!g_ctx.exit) {
         //test_
         //当文件不够发送的时候 ，等待超时时间，并且发送dummy文件
-        //if (g_ctx.file_count == 0) {
-		while (g_ctx.file_count <= 0 && g_ctx.dummy_file_path) {
+        //if (g_ctx.queue.file_count == 0) {
+		while (g_ctx.queue.file_count <= 0 && g_ctx.dummy_file_path && !g_ctx.exit) {
             pthread_mutex_lock(&g_ctx.wait_mutex);
         //test file_cout正常情况下应该设置成0
 			struct timeval now;
@@ -582,7 +1188,9 @@ void* on_request() {
 			gettimeofday(&now, NULL);
 			outtime.tv_sec = now.tv_sec + g_ctx.send_dummy_interval;
 			outtime.tv_nsec = now.tv_usec * 1000;
-			if (ETIMEDOUT == pthread_cond_timedwait(&g_ctx.wait_cond, &g_ctx.wait_mutex, &outtime)) {
+			//退出标志在wait_mutex下重新检查，主线程持锁广播，不会错过唤醒
+			if (!g_ctx.exit &&
+                ETIMEDOUT == pthread_cond_timedwait(&g_ctx.wait_cond, &g_ctx.wait_mutex, &outtime)) {
                     char file_name[1024];
                     memset(file_name,0,sizeof(file_name));
 
@@ -592,28 +1200,180 @@ void* on_request() {
             pthread_mutex_unlock(&g_ctx.wait_mutex);
 		}
 
+        //发送期间不持有队列锁，inotify线程可以继续入队和通知tail文件
         pthread_mutex_lock(&g_ctx.file_list_mutex);
+        file_item = list_empty(&g_ctx.queue.head) ? NULL :
+            list_entry(g_ctx.queue.head.next, struct file_infor, list);
+        if (file_item && !file_item->dummy_flag) 
+            g_ctx.inflight_timestamp = file_item->timestamp;
+        pthread_mutex_unlock(&g_ctx.file_list_mutex);
+        if (!file_item) continue;
 
-        list_for_each_safe(pos, n, &g_ctx.head) {
-
-            file_item = list_entry(pos, struct file_infor, list);
-            send_file(file_item);
-			if (file_item->dummy_flag == 0) 
-                g_ctx.sent_timestamp = file_item->timestamp; 
-            else 
-                remove(file_item->file_path);////dummy数据，删除copy的文件
-            log_debug("sendfile file_item=%p,filename=%s,timestamp=%lld,"
-                      "sent_timestamp=%lld,fd=%d", file_item, file_item->file_path, 
-                       file_item->timestamp,g_ctx.sent_timestamp,file_item->file_fd);
-
-            //remove(file_item->file_path);
-            remove_list_file(file_item);
-            pthread_cond_signal(&g_ctx.file_list_cond);
+        file_item->dequeue_time = get_monotonic_time();
+        send_file(file_item);
+        //退出时文件可能没有发完，不记为已发送，检查点保留发送位置，重启后续传
+        if (g_ctx.exit) 
             break;
-        }
+        file_item->last_byte_time = get_monotonic_time();
+        metrics_stage(METRICS_STAGE_SEND, file_item->last_byte_time - file_item->send_start);
+        metrics_event(METRICS_SEGMENTS_SENT, 1);
+        record_latency(file_item);
+
+        pthread_mutex_lock(&g_ctx.file_list_mutex);
+        if (file_item->dummy_flag == 0) {
+            g_ctx.sent_timestamp = file_item->timestamp; 
+            if (g_ctx.checkpoint_path) {
+                g_ctx.checkpoint_pos.sent_timestamp = file_item->timestamp;
+                g_ctx.checkpoint_pos.cur_timestamp = -1;
+                g_ctx.checkpoint_pos.cur_offset = 0;
+                //playlist模式记录下一个分片的序号和媒体时间，重启后时间轴不变
+                if (g_ctx.playlist_name) {
+                    g_ctx.checkpoint_pos.next_sequence = file_item->sequence + 1;
+                    g_ctx.checkpoint_pos.next_clock = file_item->timestamp +
+                        (file_item->duration > 0 ? file_item->duration : 1);
+                }
+                checkpoint_update(&g_ctx.checkpoint, &g_ctx.checkpoint_pos);
+            }
+        } else if (!g_ctx.retention_enabled)
+            remove(file_item->file_path);////dummy数据，删除copy的文件
+        //已发送文件交给后台线程清理，发送线程不等待目录元数据IO
+        if (g_ctx.retention_enabled && !file_item->data) 
+            retain_sent_file(file_item);
+        if (g_ctx.segment_crc) 
+            log_info("sent %s,bytes=%lu,crc32c=%08x", file_item->file_path,
+                     file_item->file_len, file_item->crc);
+        log_debug("sendfile file_item=%p,filename=%s,timestamp=%lld,"
+                  "sent_timestamp=%lld,fd=%d", file_item, file_item->file_path, 
+                   file_item->timestamp,g_ctx.sent_timestamp,file_item->file_fd);
+
+        //remove(file_item->file_path);
+        remove_list_file(&g_ctx.queue, file_item);
+        pthread_cond_signal(&g_ctx.file_list_cond);
         pthread_mutex_unlock(&g_ctx.file_list_mutex);
     }
+    return NULL;
+}
+
+/*退出时记录各阶段延迟分布(毫秒)*/
+static void dump_latency(void) {
+    struct metrics_latency_stats s;
+    int i;
+    for (i = 0; i < METRICS_LATENCIES; i++) {
+        metrics_latency_stats(i, &s);
+        if (!s.count) continue;
+        log_info("latency %s: count=%llu,p50=%.3fms,p90=%.3fms,p99=%.3fms,p999=%.3fms,max=%.3fms",
+                 metrics_latency_name(i), (unsigned long long)s.count, s.p50 / 1000.0,
+                 s.p90 / 1000.0, s.p99 / 1000.0, s.p999 / 1000.0, s.max / 1000.0);
+    }
+}
+
+/*等待SIGINT/SIGTERM*/
+static void wait_exit_signal(void) {
+    int sig;
+    while (sigwait(&exit_signals, &sig) != 0) 
+        ;
+    g_ctx.exit = 1;
+    log_info("exit on signal %d", sig);
+    dump_latency();
+}
+
+/*唤醒在条件变量上等待的线程，与检查退出标志使用同一把锁，阻塞在IO上的线程按EXIT_POLL_MS检查*/
+static void wake_workers(void) {
+    pthread_mutex_lock(&g_ctx.wait_mutex);
+    pthread_cond_broadcast(&g_ctx.wait_cond);
+    pthread_mutex_unlock(&g_ctx.wait_mutex);
+    pthread_mutex_lock(&g_ctx.file_list_mutex);
+    pthread_cond_broadcast(&g_ctx.file_list_cond);
+    pthread_cond_broadcast(&g_ctx.tail_cond);
+    pthread_mutex_unlock(&g_ctx.file_list_mutex);
+}
 
+/*每个新数据包发送后计算FEC校验*/
+static void on_datagram_sent(void *opaque, uint32_t seq, const unsigned char *wire, int len) {
+    fec_add(opaque, seq, 0, 0, wire, len);
+}
+
+/*RTP模式下FEC保护RTP负载，PT和时间戳参与恢复*/
+static void on_rtp_sent(void *opaque, uint16_t seq, uint8_t pt, uint32_t ts,
+                        const unsigned char *payload, unsigned int len) {
+    fec_add(opaque, seq, pt, ts, payload, len);
+}
+
+/*relay模式输入中断时发送dummy文件，与文件模式使用同一发送路径*/
+static void on_relay_idle(void *opaque) {
+    struct file_infor dummy;
+    memset(&dummy, 0, sizeof(dummy));
+    dummy.file_path = g_ctx.dummy_file_path;
+    dummy.dummy_flag = 1;
+    dummy.file_fd = -1;
+    metrics_event(METRICS_DUMMY_INSERTED, 1);
+    if (send_file(&dummy) == 0) 
+        close(dummy.file_fd);
+    metrics_stage(METRICS_STAGE_SEND, get_monotonic_time() - dummy.send_start);
+    metrics_event(METRICS_SEGMENTS_SENT, 1);
+}
+
+/*relay模式：转发实时UDP输入，输入中断send_dummy_interval秒后发送dummy数据*/
+static int run_relay(void) {
+    struct relay_config cfg;
+    struct sockaddr_in dst;
+
+    memset(&dst, 0, sizeof(dst));
+    dst.sin_family = AF_INET;
+    dst.sin_port = htons(g_ctx.port);
+    if (!g_ctx.ip_addr || inet_pton(AF_INET, g_ctx.ip_addr, &dst.sin_addr) != 1) {
+        log_error("relay: invalid output address %s", g_ctx.ip_addr ? g_ctx.ip_addr : "");
+        return -1;
+    }
+    cfg.ip = g_ctx.relay_ip;
+    cfg.port = g_ctx.relay_port;
+    cfg.gro = g_ctx.relay_gro;
+    cfg.ring_slots = g_ctx.relay_ring_slots;
+    cfg.idle_timeout = g_ctx.dummy_file_path ? 
+        ((int64_t)g_ctx.send_dummy_interval) * TIME_SCALE : 0;
+    if (relay_start(&g_ctx.relay, &cfg, g_ctx.sock_fd, &dst, on_relay_idle, NULL) < 0) 
+        return -1;
+    wait_exit_signal();
+    relay_stop(&g_ctx.relay);
+    relay_wait(&g_ctx.relay);
+    return 0;
+}
+
+/*metrics抓取时追加队列状态，不加锁读取，数值可能落后一次更新*/
+static void on_metrics_collect(void *opaque, struct metrics_buf *m) {
+    int64_t queued = __atomic_load_n(&g_ctx.queue.queued_timestamp, __ATOMIC_RELAXED);
+    int64_t sent = __atomic_load_n(&g_ctx.sent_timestamp, __ATOMIC_RELAXED);
+    //第一个文件还没有发完时从流开始时间算起
+    if (sent < 0) sent = __atomic_load_n(&g_ctx.stream_start_timestamp, __ATOMIC_RELAXED);
+    int64_t lag = queued >= 0 && sent >= 0 && queued > sent ? queued - sent : 0;
+    metrics_printf(m, "# HELP udpproxy_queue_segments Segments queued, including the one being sent.\n"
+                   "# TYPE udpproxy_queue_segments gauge\n"
+                   "udpproxy_queue_segments %d\n"
+                   "# HELP udpproxy_queue_bytes Bytes of the queued segments whose size was known when queued.\n"
+                   "# TYPE udpproxy_queue_bytes gauge\n"
+                   "udpproxy_queue_bytes %llu\n"
+                   "# HELP udpproxy_live_edge_lag_seconds Newest queued segment timestamp minus the last one sent.\n"
+                   "# TYPE udpproxy_live_edge_lag_seconds gauge\n"
+                   "udpproxy_live_edge_lag_seconds %lld.%06lld\n"
+                   "# HELP udpproxy_log_dropped_total Log lines dropped by the async or binary logger.\n"
+                   "# TYPE udpproxy_log_dropped_total counter\n"
+                   "udpproxy_log_dropped_total %lu\n",
+                   __atomic_load_n(&g_ctx.queue.file_count, __ATOMIC_RELAXED),
+                   (unsigned long long)__atomic_load_n(&g_ctx.queue.queue_bytes, __ATOMIC_RELAXED),
+                   (long long)(lag / TIME_SCALE), (long long)(lag % TIME_SCALE), log_dropped());
+}
+
+/*SIGUSR1日志详细一级，SIGUSR2简略一级；只用异步信号安全的调用*/
+static void on_log_level_signal(int sig) {
+    int level = log_get_level() + (sig == SIGUSR1 ? -1 : 1);
+    char msg[40] = "udpproxy: log level ";
+    size_t len = strlen(msg), n;
+    if (level < LOG_LEVEL_DEBUG || level > LOG_LEVEL_FATAL) return;
+    log_set_level(level);
+    n = strlen(log_level_name(level));
+    memcpy(msg + len, log_level_name(level), n);
+    msg[len + n] = '\n';
+    if (write(STDERR_FILENO, msg, len + n + 1) < 0) return;
 }
 
 int main(int argc, char *argv[]) {
@@ -621,6 +1381,7 @@ int main(int argc, char *argv[]) {
     struct timeval t_new;
     pthread_t req_tid;
     pthread_t res_tid;
+    pthread_t stream_tid;
     struct sockaddr_in     serv_addr;
 
     //命令行参数解析
@@ -635,6 +1396,12 @@ int main(int argc, char *argv[]) {
 	int     cfg_index, type; 
 
 
+    //退出信号在创建任何线程之前屏蔽，所有线程继承
+    sigemptyset(&exit_signals);
+    sigaddset(&exit_signals, SIGINT);
+    sigaddset(&exit_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &exit_signals, NULL);
+
     udp_init();
     while ((c = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
 
@@ -715,6 +1482,72 @@ int main(int argc, char *argv[]) {
 					g_ctx.log_dir = strdup(path);
 				} else if (!strcmp(keyword, "dummy_file") && !g_ctx.dummy_file_path) 
                     g_ctx.dummy_file_path = strdup(value); 
+				else if (!strcmp(keyword, "checkpoint_file") && !g_ctx.checkpoint_path) 
+                    g_ctx.checkpoint_path = strdup(value);
+				else if (!strcmp(keyword,"checkpoint_sync_interval")) 
+                    g_ctx.checkpoint_sync_interval = strtoi(value);
+				else if (!strcmp(keyword,"keep_segments")) 
+                    g_ctx.retention_policy.keep_segments = strtoi(value);
+				else if (!strcmp(keyword,"keep_seconds")) 
+                    g_ctx.retention_policy.keep_duration = ((int64_t)strtoi(value)) * TIME_SCALE;
+				else if (!strcmp(keyword,"keep_gb")) 
+                    g_ctx.retention_policy.keep_bytes = (uint64_t)(atof(value) * (1ULL << 30));
+				else if (!strcmp(keyword, "archive_dir") && !g_ctx.retention_policy.archive_dir) 
+                    g_ctx.retention_policy.archive_dir = strdup(value);
+				else if (!strcmp(keyword, "file_template") && !g_ctx.file_template) 
+                    g_ctx.file_template = strdup(value);
+				else if (!strcmp(keyword,"segment_duration_ms")) 
+                    g_ctx.segment_duration = ((int64_t)strtoi(value)) * 1000;
+				else if (!strcmp(keyword, "playlist") && !g_ctx.playlist_name) 
+                    g_ctx.playlist_name = strdup(value);
+				else if (!strcmp(keyword, "stream_input") && !g_ctx.stream_input) 
+                    g_ctx.stream_input = strdup(value);
+				else if (!strcmp(keyword,"stream_slice_ms") && strtoi(value) > 0) 
+                    g_ctx.stream_slice_duration = ((int64_t)strtoi(value)) * 1000;
+				else if (!strcmp(keyword,"reliable")) 
+                    g_ctx.reliable = strtoi(value);
+				else if (!strcmp(keyword,"nack_window")) 
+                    g_ctx.nack_window = strtoi(value);
+				else if (!strcmp(keyword,"segment_crc")) 
+                    g_ctx.segment_crc = strtoi(value);
+				else if (!strcmp(keyword,"log_async")) 
+                    g_ctx.log_async = strtoi(value);
+				else if (!strcmp(keyword,"log_queue")) 
+                    g_ctx.log_queue = strtoi(value);
+				else if (!strcmp(keyword,"log_binary")) 
+                    g_ctx.log_binary = strtoi(value);
+				else if (!strcmp(keyword,"log_level")) 
+                    g_ctx.log_level = log_level_from_name(value);
+				else if (!strcmp(keyword,"log_compress")) 
+                    g_ctx.log_archive_policy.compress = strtoi(value);
+				else if (!strcmp(keyword,"log_keep_mb")) 
+                    g_ctx.log_archive_policy.keep_bytes = ((uint64_t)strtoi(value)) << 20;
+				else if (!strcmp(keyword,"log_keep_hours")) 
+                    g_ctx.log_archive_policy.keep_age = ((int64_t)strtoi(value)) * 3600;
+				else if (!strcmp(keyword,"metrics_port")) 
+                    g_ctx.metrics_port = strtoi(value);
+				else if (!strcmp(keyword, "metrics_socket") && !g_ctx.metrics_socket) 
+                    g_ctx.metrics_socket = strdup(value);
+				else if (!strcmp(keyword,"rtp")) 
+                    g_ctx.rtp = strtoi(value);
+				else if (!strcmp(keyword,"rtp_ssrc")) 
+                    g_ctx.rtp_ssrc = strtoul(value, NULL, 0);
+				else if (!strcmp(keyword,"fec_columns")) 
+                    g_ctx.fec_columns = strtoi(value);
+				else if (!strcmp(keyword,"fec_rows")) 
+                    g_ctx.fec_rows = strtoi(value);
+				else if (!strcmp(keyword,"fec_row_parity")) 
+                    g_ctx.fec_row_parity = strtoi(value);
+				else if (!strcmp(keyword, "relay_ip") && !g_ctx.relay_ip) 
+                    g_ctx.relay_ip = strdup(value);
+				else if (!strcmp(keyword,"relay_port")) 
+                    g_ctx.relay_port = strtoi(value);
+				else if (!strcmp(keyword,"relay_gro")) 
+                    g_ctx.relay_gro = strtoi(value);
+				else if (!strcmp(keyword,"relay_ring_slots")) 
+                    g_ctx.relay_ring_slots = strtoi(value);
+				else if (!strcmp(keyword,"tail_mode")) 
+                    g_ctx.tail_mode = strtoi(value);
 				else if (!strcmp(keyword,"send_dummy_interval")) 
                     g_ctx.send_dummy_interval = strtoi(value);
 				else if (!strcmp(keyword,"start_wait_interval") && 
@@ -733,6 +1566,25 @@ int main(int argc, char *argv[]) {
 		log_debug("init log succeed in %s", g_ctx.log_dir);
 	} else 
         log_init(".udpproxy", LOGGER_ROTATE_BY_SIZE | LOGGER_ROTATE_PER_HOUR, 64); 
+    //发送路径上的日志不再等待磁盘IO
+    //二进制日志优先于异步日志
+    if (g_ctx.log_binary && log_start_binary() < 0) {
+        log_error("start binary logger failed, logging text");
+        g_ctx.log_binary = 0;
+    }
+    if (!g_ctx.log_binary && g_ctx.log_async && log_start_async(g_ctx.log_queue) < 0) 
+        log_error("start async logger failed, logging synchronously");
+    if (g_ctx.log_level < 0) {
+        log_error("invalid log_level, use debug|user|info|warning|error|fatal");
+        g_ctx.log_level = LOG_LEVEL_DEBUG;
+    }
+    log_set_level(g_ctx.log_level);
+    //轮转后的日志在空闲IO优先级下压缩和清理
+    if (log_archive_policy_enabled(&g_ctx.log_archive_policy) && 
+        log_start_archive(&g_ctx.log_archive_policy) < 0) 
+        log_error("start log archive worker failed");
+    signal(SIGUSR1, on_log_level_signal);
+    signal(SIGUSR2, on_log_level_signal);
         
     //dupm info
 	log_debug("[-----------------dump config begin-----------------------------]");
@@ -740,10 +1592,168 @@ int main(int argc, char *argv[]) {
 	if (g_ctx.log_dir) log_debug("log_dir：%s", g_ctx.log_dir);
 	if (g_ctx.ip_addr && g_ctx.port)
          log_debug("send to ip：%s,port:%d", g_ctx.ip_addr, g_ctx.port); 
-	log_debug("start_wait_interval=%d",g_ctx.start_wait_interval);
+	log_debug("start_wait_interval=%lld",(long long)g_ctx.start_wait_interval);
 	log_debug("send_dummy_interval=%d",g_ctx.send_dummy_interval);
+	log_debug("tail_mode=%d",g_ctx.tail_mode);
+	if (g_ctx.log_async) log_debug("log_async=1,log_queue=%d", g_ctx.log_queue);
+	if (g_ctx.log_binary) log_debug("log_binary=1");
+	log_debug("log_level=%s", log_level_name(g_ctx.log_level));
+	if (log_archive_policy_enabled(&g_ctx.log_archive_policy)) 
+		log_debug("log_compress=%d,log_keep_bytes=%llu,log_keep_age=%llds",
+				  g_ctx.log_archive_policy.compress,
+				  (unsigned long long)g_ctx.log_archive_policy.keep_bytes,
+				  (long long)g_ctx.log_archive_policy.keep_age);
+	if (g_ctx.metrics_port || g_ctx.metrics_socket) 
+		log_debug("metrics_port=%d,metrics_socket=%s", g_ctx.metrics_port,
+				  g_ctx.metrics_socket ? g_ctx.metrics_socket : "");
+	if (g_ctx.reliable) log_debug("reliable=1,nack_window=%d", g_ctx.nack_window);
+	if (g_ctx.rtp) log_debug("rtp=1,ssrc=%u", g_ctx.rtp_ssrc);
+	if (g_ctx.segment_crc || g_ctx.reliable) log_debug("crc32c=%s", crc32c_impl());
+	if (g_ctx.fec_columns) 
+        log_debug("fec=%dx%d,row_parity=%d", g_ctx.fec_columns, g_ctx.fec_rows,
+                  g_ctx.fec_row_parity);
+	if (g_ctx.playlist_name) log_debug("playlist=%s", g_ctx.playlist_name);
+	if (g_ctx.stream_input) 
+        log_debug("stream_input=%s,slice=%lldms", g_ctx.stream_input,
+                  (long long)(g_ctx.stream_slice_duration / 1000));
+	if (g_ctx.relay_port) 
+        log_debug("relay from %s:%d,gro=%d,ring_slots=%d", g_ctx.relay_ip ? g_ctx.relay_ip : "*",
+                  g_ctx.relay_port, g_ctx.relay_gro, g_ctx.relay_ring_slots);
+	if (g_ctx.file_template) {
+        log_debug("file_template=%s,segment_duration=%lldus",
+                  g_ctx.file_template, (long long)g_ctx.segment_duration);
+        if (segname_compile(&g_ctx.segname, g_ctx.file_template, g_ctx.segment_duration) < 0) {
+            log_error("invalid file_template %s, using %s", g_ctx.file_template, SEGNAME_DEFAULT);
+            segname_compile(&g_ctx.segname, SEGNAME_DEFAULT, 0);
+        }
+    }
+	log_debug("keep_segments=%u,keep_seconds=%lld,keep_bytes=%llu,archive_dir=%s",
+              g_ctx.retention_policy.keep_segments,
+              (long long)(g_ctx.retention_policy.keep_duration / TIME_SCALE),
+              (unsigned long long)g_ctx.retention_policy.keep_bytes,
+              g_ctx.retention_policy.archive_dir ? g_ctx.retention_policy.archive_dir : "");
+	if (g_ctx.checkpoint_path) 
+        log_debug("checkpoint_file=%s,sync_interval=%dms",
+                  g_ctx.checkpoint_path, g_ctx.checkpoint_sync_interval);
 	log_debug("[-----------------dump config end-----------------------------]");
-    if (pthread_create(&req_tid, NULL, (void *)event_loop, NULL) != 0) {
+
+    //计数器由各线程无锁累加，抓取线程只读取
+    if ((g_ctx.metrics_port || g_ctx.metrics_socket) && 
+        metrics_start(&g_ctx.metrics, g_ctx.metrics_port, g_ctx.metrics_socket,
+                      on_metrics_collect, NULL) < 0) 
+        log_error("start metrics endpoint failed");
+
+    //relay模式原样转发收到的数据报，没有udp_datapack封装和序号，空闲时的dummy文件也直接发送
+    if (g_ctx.relay_port && (g_ctx.reliable || g_ctx.fec_columns)) {
+        log_error("reliable and fec_* are not supported with relay_port, disabled");
+        g_ctx.reliable = 0;
+        g_ctx.fec_columns = 0;
+    }
+    //rtp_sender只在文件发送路径上初始化，relay的输入可能已经是RTP
+    if (g_ctx.relay_port && g_ctx.rtp) {
+        log_error("rtp is not supported with relay_port, disabled");
+        g_ctx.rtp = 0;
+    }
+    if (g_ctx.relay_port) {
+        int ret = run_relay();
+        udp_destroy();
+        log_destroy();
+        return ret;
+    }
+
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(g_ctx.port);
+    if ((g_ctx.rtp || g_ctx.reliable) && 
+        (!g_ctx.ip_addr || inet_pton(AF_INET, g_ctx.ip_addr, &serv_addr.sin_addr) != 1)) {
+        log_error("invalid output address, rtp and reliable mode disabled");
+        g_ctx.rtp = g_ctx.reliable = 0;
+    }
+    //RTP模式：每个数据报7个TS包，读取块按数据报大小对齐
+    if (g_ctx.rtp) {
+        if (g_ctx.reliable) {
+            log_error("reliable mode is ignored with rtp = 1");
+            g_ctx.reliable = 0;
+        }
+        free(g_ctx.send_buf);
+        g_ctx.send_buf_size = RTP_PAYLOAD_MAX * RTP_BATCH;
+        g_ctx.send_buf = calloc(g_ctx.send_buf_size, sizeof(char));
+        rtp_init(&g_ctx.rtp_sender, g_ctx.sock_fd, &serv_addr, g_ctx.rtp_ssrc);
+    }
+    //可靠模式：数据按序号封装，后台线程接收NACK并从窗口中重传
+    if (g_ctx.reliable &&
+        nack_start(&g_ctx.nack, g_ctx.sock_fd, &serv_addr, g_ctx.nack_window) < 0) {
+        log_error("reliable mode disabled");
+        g_ctx.reliable = 0;
+    }
+    //FEC需要带序号的数据包：RTP模式保护RTP负载，可靠模式保护整个udp_datapack
+    if (g_ctx.fec_columns) {
+        if (!g_ctx.reliable && !g_ctx.rtp) 
+            log_error("fec needs sequence numbered output, set rtp = 1 or reliable = 1");
+        else if (fec_init(&g_ctx.fec, g_ctx.sock_fd, &serv_addr, g_ctx.fec_columns,
+                          g_ctx.fec_rows, g_ctx.fec_row_parity) == 0) {
+            g_ctx.fec_enabled = 1;
+            if (g_ctx.rtp) {
+                g_ctx.rtp_sender.sent_opaque = &g_ctx.fec;
+                g_ctx.rtp_sender.sent_cb = on_rtp_sent;
+            } else {
+                g_ctx.nack.sent_opaque = &g_ctx.fec;
+                g_ctx.nack.sent_cb = on_datagram_sent;
+            }
+        }
+    }
+
+    //stream模式的分片只存在于内存，检查点和tail模式没有意义
+    if (g_ctx.stream_input) {
+        if (g_ctx.checkpoint_path) {
+            log_info("checkpoint_file is ignored in stream mode");
+            free(g_ctx.checkpoint_path);
+            g_ctx.checkpoint_path = NULL;
+        }
+        g_ctx.tail_mode = 0;
+    }
+
+    //恢复检查点：跳过已发送文件，未发完的文件从断点续传，不再等待start_wait_interval
+    if (g_ctx.checkpoint_path) {
+        if (checkpoint_open(&g_ctx.checkpoint, g_ctx.checkpoint_path,
+                            g_ctx.checkpoint_sync_interval, &g_ctx.checkpoint_pos) < 0) {
+            free(g_ctx.checkpoint_path);
+            g_ctx.checkpoint_path = NULL;
+        } else if (g_ctx.checkpoint_pos.sent_timestamp >= 0 ||
+                   g_ctx.checkpoint_pos.cur_timestamp >= 0) {
+            g_ctx.sent_timestamp = g_ctx.checkpoint_pos.sent_timestamp;
+            g_ctx.stream_start_timestamp = g_ctx.sent_timestamp;
+        }
+    }
+    if (g_ctx.playlist_name && g_ctx.work_dir) {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", g_ctx.work_dir, g_ctx.playlist_name);
+        playlist_init(&g_ctx.playlist, path);
+        //媒体时间由#EXTINF累加，从检查点恢复序号和时钟，否则重启后时钟归零，分片都早于sent_timestamp
+        if (g_ctx.checkpoint_pos.next_sequence >= 0) {
+            g_ctx.playlist.next_sequence = g_ctx.checkpoint_pos.next_sequence;
+            g_ctx.playlist_clock = g_ctx.checkpoint_pos.next_clock;
+            log_info("playlist resumes at sequence %lld, media time %lld us",
+                     (long long)g_ctx.playlist.next_sequence, (long long)g_ctx.playlist_clock);
+        } else if (g_ctx.sent_timestamp >= 0) {
+            //检查点不是playlist模式写入的，只能保证新分片排在已发送之后
+            g_ctx.playlist_clock = g_ctx.sent_timestamp + 1;
+            log_warning("checkpoint has no playlist sequence, playlist restarts from its window");
+        }
+    }
+
+    if (retention_policy_enabled(&g_ctx.retention_policy) && g_ctx.work_dir) 
+        g_ctx.retention_enabled = retention_start(&g_ctx.retention, g_ctx.work_dir,
+                                                  &g_ctx.retention_policy) == 0;
+
+    //stream模式下work_dir只用于dummy文件
+    if (g_ctx.stream_input && 
+        pthread_create(&stream_tid, NULL, (void *)stream_loop, NULL) != 0) {
+        close(g_ctx.sock_fd);
+        return -2;
+    }
+    if (g_ctx.work_dir &&
+        pthread_create(&req_tid, NULL, (void *)event_loop, NULL) != 0) {
         close(g_ctx.sock_fd);
         return -2;
     }
@@ -753,9 +1763,16 @@ int main(int argc, char *argv[]) {
         return -2;
     }
 
-    pthread_join(req_tid, NULL);
+    wait_exit_signal();
+    //先等工作线程退出，再停止后台线程、关闭检查点，最后关闭日志
+    wake_workers();
     pthread_join(res_tid, NULL);
-
+    if (g_ctx.work_dir) 
+        pthread_join(req_tid, NULL);
+    if (g_ctx.stream_input) 
+        pthread_join(stream_tid, NULL);
     udp_destroy();
+    log_destroy();
+    return 0;
 }
 
@@ -7,6 +7,10 @@ MKDIR=mkdir
 
 # -----Begin user-editable area-----
 
+# zlib is optional, without it rotated logs are compressed by running gzip
+ZLIB_CFLAGS:=$(shell printf '\#include <zlib.h>\n' | gcc -E - >/dev/null 2>&1 && echo -DHAVE_ZLIB)
+ZLIB_LIB:=$(if $(ZLIB_CFLAGS),-lz)
+
 # -----End user-editable area-----
 
 # If no configuration is specified, "Debug" will be used
@@ -20,13 +24,13 @@ endif
 ifeq "$(CFG)" "Debug"
 OUTDIR=Debug
 OUTFILE=$(OUTDIR)/udp
-CFG_INC=
+CFG_INC=$(ZLIB_CFLAGS)
 CFG_LIB=-lpthread 
 CFG_OBJ=
-COMMON_OBJ=$(OUTDIR)/config.o $(OUTDIR)/logger.o $(OUTDIR)/udp.o 
+COMMON_OBJ=$(OUTDIR)/binlog.o $(OUTDIR)/checkpoint.o $(OUTDIR)/config.o $(OUTDIR)/crc32c.o $(OUTDIR)/fec.o $(OUTDIR)/logarchive.o $(OUTDIR)/logger.o $(OUTDIR)/metrics.o $(OUTDIR)/nack.o $(OUTDIR)/playlist.o $(OUTDIR)/queue.o $(OUTDIR)/relay.o $(OUTDIR)/retention.o $(OUTDIR)/rtp.o $(OUTDIR)/segname.o $(OUTDIR)/shmring.o $(OUTDIR)/tsslice.o $(OUTDIR)/udp.o 
 OBJ=$(COMMON_OBJ) $(CFG_OBJ)
-ALL_OBJ=$(OUTDIR)/config.o $(OUTDIR)/logger.o $(OUTDIR)/udp.o \
-	-lpthread 
+ALL_OBJ=$(OUTDIR)/binlog.o $(OUTDIR)/checkpoint.o $(OUTDIR)/config.o $(OUTDIR)/crc32c.o $(OUTDIR)/fec.o $(OUTDIR)/logarchive.o $(OUTDIR)/logger.o $(OUTDIR)/metrics.o $(OUTDIR)/nack.o $(OUTDIR)/playlist.o $(OUTDIR)/queue.o $(OUTDIR)/relay.o $(OUTDIR)/retention.o $(OUTDIR)/rtp.o $(OUTDIR)/segname.o $(OUTDIR)/shmring.o $(OUTDIR)/tsslice.o $(OUTDIR)/udp.o \
+	-lpthread $(ZLIB_LIB)
 
 COMPILE=gcc -c   -g -o "$(OUTDIR)/$(*F).o" $(CFG_INC) $<
 LINK=gcc  -g -o "$(OUTFILE)" $(ALL_OBJ)
@@ -62,13 +66,13 @@ endif
 ifeq "$(CFG)" "Release"
 OUTDIR=Release
 OUTFILE=$(OUTDIR)/udp
-CFG_INC=
+CFG_INC=$(ZLIB_CFLAGS)
 CFG_LIB=-lpthread 
 CFG_OBJ=
-COMMON_OBJ=$(OUTDIR)/config.o $(OUTDIR)/logger.o $(OUTDIR)/udp.o 
+COMMON_OBJ=$(OUTDIR)/binlog.o $(OUTDIR)/checkpoint.o $(OUTDIR)/config.o $(OUTDIR)/crc32c.o $(OUTDIR)/fec.o $(OUTDIR)/logarchive.o $(OUTDIR)/logger.o $(OUTDIR)/metrics.o $(OUTDIR)/nack.o $(OUTDIR)/playlist.o $(OUTDIR)/queue.o $(OUTDIR)/relay.o $(OUTDIR)/retention.o $(OUTDIR)/rtp.o $(OUTDIR)/segname.o $(OUTDIR)/shmring.o $(OUTDIR)/tsslice.o $(OUTDIR)/udp.o 
 OBJ=$(COMMON_OBJ) $(CFG_OBJ)
-ALL_OBJ=$(OUTDIR)/config.o $(OUTDIR)/logger.o $(OUTDIR)/udp.o \
-	-lpthread 
+ALL_OBJ=$(OUTDIR)/binlog.o $(OUTDIR)/checkpoint.o $(OUTDIR)/config.o $(OUTDIR)/crc32c.o $(OUTDIR)/fec.o $(OUTDIR)/logarchive.o $(OUTDIR)/logger.o $(OUTDIR)/metrics.o $(OUTDIR)/nack.o $(OUTDIR)/playlist.o $(OUTDIR)/queue.o $(OUTDIR)/relay.o $(OUTDIR)/retention.o $(OUTDIR)/rtp.o $(OUTDIR)/segname.o $(OUTDIR)/shmring.o $(OUTDIR)/tsslice.o $(OUTDIR)/udp.o \
+	-lpthread $(ZLIB_LIB)
 
 COMPILE=gcc -c   -o "$(OUTDIR)/$(*F).o" $(CFG_INC) $<
 LINK=gcc  -o "$(OUTFILE)" $(ALL_OBJ)
@@ -97,3 +101,54 @@ clean:
 # Clean this project and all dependencies
 cleanall: clean
 endif
+
+#
+# Tools, built with "make -f udp.mak tools" next to $(OUTFILE)
+#
+TOOLS=$(OUTDIR)/udpproxy-shmfeed $(OUTDIR)/udpproxy-crcbench $(OUTDIR)/udpproxy-sink \
+	$(OUTDIR)/udpproxy-seggen $(OUTDIR)/udpproxy-queuebench $(OUTDIR)/udpproxy-logcat \
+	$(OUTDIR)/udpproxy-shmringtest $(OUTDIR)/udpproxy-fectest $(OUTDIR)/udpproxy-nacktest
+
+tools: $(TOOLS)
+
+$(OUTDIR)/udpproxy-shmfeed: $(OUTDIR) shmfeed.c shmring.c shmring.h
+	gcc -g -O2 -o "$@" shmfeed.c shmring.c
+
+$(OUTDIR)/udpproxy-shmringtest: $(OUTDIR) shmringtest.c shmring.c shmring.h
+	gcc -g -O2 -o "$@" shmringtest.c shmring.c -lpthread
+
+# fec.c logs and counts through the process logger and metrics
+FECTEST_SRC=fec.c binlog.c logarchive.c logger.c metrics.c
+
+$(OUTDIR)/udpproxy-fectest: $(OUTDIR) fectest.c fec.h $(FECTEST_SRC)
+	gcc -g -O2 $(ZLIB_CFLAGS) -o "$@" fectest.c $(FECTEST_SRC) -lpthread $(ZLIB_LIB)
+
+# so does nack.c, the sink and nacktest use its receiver side
+NACK_SRC=nack.c crc32c.c binlog.c logarchive.c logger.c metrics.c
+
+$(OUTDIR)/udpproxy-nacktest: $(OUTDIR) nacktest.c nack.h $(NACK_SRC)
+	gcc -g -O2 $(ZLIB_CFLAGS) -o "$@" nacktest.c $(NACK_SRC) -lpthread $(ZLIB_LIB)
+
+$(OUTDIR)/udpproxy-crcbench: $(OUTDIR) crcbench.c crc32c.c crc32c.h
+	gcc -g -O2 -o "$@" crcbench.c crc32c.c -lpthread
+
+$(OUTDIR)/udpproxy-sink: $(OUTDIR) sink.c nack.h bench.h $(NACK_SRC)
+	gcc -g -O2 $(ZLIB_CFLAGS) -o "$@" sink.c $(NACK_SRC) -lpthread $(ZLIB_LIB)
+
+$(OUTDIR)/udpproxy-seggen: $(OUTDIR) seggen.c bench.h
+	gcc -g -O2 -o "$@" seggen.c
+
+$(OUTDIR)/udpproxy-queuebench: $(OUTDIR) queuebench.c queue.c queue.h
+	gcc -g -O2 -DNDEBUG -o "$@" queuebench.c queue.c
+
+$(OUTDIR)/udpproxy-logcat: $(OUTDIR) logcat.c binlog.c binlog.h
+	gcc -g -O2 -o "$@" logcat.c binlog.c -lpthread
+
+#
+# End-to-end benchmark on loopback, see bench.sh for the BENCH_* parameters:
+#     make -f udp.mak bench BENCH_BITRATE=200000000 BENCH_MODE=rtp
+#
+bench: $(OUTFILE) $(TOOLS)
+	sh bench.sh $(OUTDIR)
+
+.PHONY: tools bench